@@ -0,0 +1,67 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#ifndef __TBB_blocking_region_H
+#define __TBB_blocking_region_H
+
+#include "tbb_stddef.h"
+
+#if __TBB_ARENA_PER_MASTER
+
+namespace tbb {
+
+//! Scope where the thread may block, e.g. in I/O or waiting on a concurrent_bounded_queue.
+/** While a thread of an arena is in the region, the arena may employ one more worker,
+    so that the blocked thread does not reduce the parallelism. Nested regions of
+    a thread count as one. The region has no effect in a thread that has not
+    initialized the task scheduler.
+    @ingroup task_scheduling */
+class blocking_region: internal::no_copy {
+    //! The arena that was lent a worker, or NULL.
+    void* my_arena;
+
+    void __TBB_EXPORTED_METHOD internal_enter();
+    void __TBB_EXPORTED_METHOD internal_exit();
+public:
+    //! Enters the region
+    blocking_region() : my_arena(NULL) {
+        internal_enter();
+    }
+
+    //! Leaves the region
+    ~blocking_region() {
+        if( my_arena )
+            internal_exit();
+    }
+};
+
+} // namespace tbb
+
+#endif /* __TBB_ARENA_PER_MASTER */
+
+#endif /* __TBB_blocking_region_H */
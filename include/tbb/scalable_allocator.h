@@ -31,6 +31,9 @@
 /** @file */
 
 #include <stddef.h> /* Need ptrdiff_t and size_t from here. */
+#if !_MSC_VER
+#include <stdint.h> /* Need intptr_t from here. */
+#endif
 
 #if !defined(__cplusplus) && __ICC==1100
     #pragma warning (push)
@@ -55,6 +58,13 @@ void * __TBB_EXPORTED_FUNC scalable_malloc (size_t size);
     @ingroup memory_allocation */
 void   __TBB_EXPORTED_FUNC scalable_free (void* ptr);
 
+/** The "free" analogue for an object of known size, faster than scalable_free.
+    The size must be the one requested from scalable_malloc, scalable_calloc
+    or scalable_realloc, or from scalable_aligned_malloc or scalable_aligned_realloc
+    with alignment up to 128.
+    @ingroup memory_allocation */
+void   __TBB_EXPORTED_FUNC scalable_free_sized (void* ptr, size_t size);
+
 /** The "realloc" analogue complementing scalable_malloc.
     @ingroup memory_allocation */
 void * __TBB_EXPORTED_FUNC scalable_realloc (void* ptr, size_t size);
@@ -79,12 +89,111 @@ void * __TBB_EXPORTED_FUNC scalable_aligned_realloc (void* ptr, size_t size, siz
     @ingroup memory_allocation */
 void __TBB_EXPORTED_FUNC scalable_aligned_free (void* ptr);
 
+/** Allocates an object that shares no cache line with other objects,
+    to avoid false sharing. The object is freed with scalable_free.
+    Reallocation does not keep the object isolated.
+    @ingroup memory_allocation */
+void * __TBB_EXPORTED_FUNC scalable_malloc_isolated (size_t size);
+
 /** The analogue of _msize/malloc_size/malloc_usable_size.
     Returns the usable size of a memory block previously allocated by scalable_*,
     or 0 (zero) if ptr does not point to such a block.
     @ingroup memory_allocation */
 size_t __TBB_EXPORTED_FUNC scalable_msize (void* ptr);
 
+/* Results for scalable_allocation_* functions */
+typedef enum {
+    TBBMALLOC_OK,
+    TBBMALLOC_INVALID_PARAM,
+    TBBMALLOC_UNSUPPORTED,
+    TBBMALLOC_NO_MEMORY,
+    TBBMALLOC_NO_EFFECT
+} ScalableAllocationResult;
+
+/* Setting TBB_MALLOC_USE_HUGE_PAGES environment variable to 1 enables huge pages.
+   scalable_allocation_mode call has priority over environment variable. */
+typedef enum {
+    TBBMALLOC_USE_HUGE_PAGES,  /* value turns using huge pages on and off */
+    /* When memory obtained from the OS would exceed value bytes, cached
+       memory is released, and freed memory is not cached. The limit is
+       exceeded if the memory in use needs it. 0 means no limit. */
+    TBBMALLOC_SET_SOFT_HEAP_LIMIT,
+    /* Sample allocations for the heap profile, one per value bytes
+       on average; 0 switches sampling off. Returns TBBMALLOC_NO_EFFECT
+       where call stacks can't be obtained. See TBBMALLOC_DUMP_HEAP_PROFILE. */
+    TBBMALLOC_SET_HEAP_SAMPLING_INTERVAL
+} AllocationModeParam;
+
+/** Set TBB allocator-specific allocation modes.
+    Returns TBBMALLOC_NO_EFFECT if the mode is accepted but cannot be
+    supported on the current platform.
+    @ingroup memory_allocation */
+int __TBB_EXPORTED_FUNC scalable_allocation_mode(int param, intptr_t value);
+
+typedef enum {
+    /* Clean internal allocator buffers for all threads.
+       Returns TBBMALLOC_NO_EFFECT if no buffers cleaned,
+       TBBMALLOC_OK if some memory released from buffers. */
+    TBBMALLOC_CLEAN_ALL_BUFFERS,
+    /* Clean internal allocator buffer for current thread only.
+       Return values same as for TBBMALLOC_CLEAN_ALL_BUFFERS. */
+    TBBMALLOC_CLEAN_THREAD_BUFFERS,
+    /* Same as TBBMALLOC_CLEAN_ALL_BUFFERS, but done in portions and stopped
+       when the time budget in microseconds, pointed to by size_t* param, is over.
+       Intended to be called repeatedly, e.g. from a background thread.
+       Returns TBBMALLOC_NO_EFFECT once a complete pass over the buffers
+       released nothing, TBBMALLOC_OK otherwise. */
+    TBBMALLOC_CLEAN_ALL_BUFFERS_INCREMENTAL,
+    /* Fill the ScalableLargeObjectCacheStat structure pointed to by param
+       with the counters of the large object cache. */
+    TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT,
+    /* Write the heap profile of sampled allocations, in the format pprof
+       reads, to the file named by the string param.
+       Returns TBBMALLOC_INVALID_PARAM if the file can't be written. */
+    TBBMALLOC_DUMP_HEAP_PROFILE
+} ScalableAllocationCmd;
+
+/* Counters of the large object cache, since the process start.
+   The counters are not synchronized with concurrent allocations. */
+typedef struct {
+    size_t hits;         /* allocations served from the cache */
+    size_t misses;       /* allocations of cached sizes not found in the cache */
+    size_t evictions;    /* blocks released as the cache for their size was full */
+    size_t cachedBlocks; /* blocks in the cache now */
+    size_t cachedBytes;  /* and their total size */
+} ScalableLargeObjectCacheStat;
+
+/** Call TBB allocator-specific commands.
+    Buffers of a thread other than the calling one are released
+    when the thread exits.
+    @ingroup memory_allocation */
+int __TBB_EXPORTED_FUNC scalable_allocation_command(int cmd, void *param);
+
+#define TBBMALLOC_MAX_SIZE_CLASSES 64
+
+/* Current memory usage of the allocator, filled by scalable_allocation_stats.
+   The values are collected from all threads without stopping them,
+   so under concurrent allocations they are approximate. */
+typedef struct {
+    size_t mappedBytes;       /* memory obtained from the OS */
+    size_t sizeClasses;       /* number of size classes of small objects */
+    size_t sizeClassObjectSize[TBBMALLOC_MAX_SIZE_CLASSES]; /* object size of a class */
+    size_t sizeClassBytes[TBBMALLOC_MAX_SIZE_CLASSES];      /* bytes in use in a class */
+    size_t largeObjects;      /* large objects in use */
+    size_t largeObjectBytes;  /* and memory taken by them */
+    ScalableLargeObjectCacheStat largeObjectCache;
+    size_t orphanedBlocks;    /* partially used blocks left by exited threads */
+    size_t threads;           /* threads with allocator data */
+    size_t threadPoolBlocks;  /* free blocks in the pools of all threads */
+    size_t maxThreadPoolBlocks; /* free blocks in the biggest pool of a thread */
+} ScalableAllocationStat;
+
+/** Get statistics of memory usage. Cheap enough to be called periodically,
+    e.g. for monitoring; does not slow down allocations in other threads.
+    Returns TBBMALLOC_INVALID_PARAM if stat is NULL, TBBMALLOC_OK otherwise.
+    @ingroup memory_allocation */
+int __TBB_EXPORTED_FUNC scalable_allocation_stats(ScalableAllocationStat *stat);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
@@ -142,8 +251,8 @@ public:
     }
 
     //! Free previously allocated block of memory
-    void deallocate( pointer p, size_type ) {
-        scalable_free( p );
+    void deallocate( pointer p, size_type n ) {
+        scalable_free_sized( p, n * sizeof(value_type) );
     }
 
     //! Largest value for which method allocate might succeed.
@@ -38,6 +38,10 @@ namespace tbb {
 
 class task;
 class task_list;
+#if __TBB_ARENA_PER_MASTER
+class completion_event;
+class tick_count;
+#endif /* __TBB_ARENA_PER_MASTER */
 
 #if __TBB_TASK_GROUP_CONTEXT
 class task_group_context;
@@ -638,6 +642,21 @@ public:
         t.prefix().owner->enqueue( t, NULL );
     }
 
+    //! Enqueue task for starvation-resistant execution at the deadline or later.
+    /** Until the deadline the task waits in the timer queue of the arena, where an idle
+        worker sleeps until the earliest deadline instead of polling for it.
+        Like other enqueued tasks, all the timed tasks must be executed before
+        the scheduler terminates. **/
+    static void __TBB_EXPORTED_FUNC enqueue_at( task& t, const tick_count& deadline );
+
+    //! Enqueue task for starvation-resistant execution after the delay.
+    /** Interval is tick_count::interval_t; it is a template parameter
+        so that this header does not depend on tick_count.h. **/
+    template<typename Interval>
+    static void enqueue_after( task& t, const Interval& delay ) {
+        internal_enqueue_after( t, delay.seconds() );
+    }
+
 #endif /* __TBB_ARENA_PER_MASTER */
     //! The innermost task being executed or destroyed by the current thread at the moment.
     static task& __TBB_EXPORTED_FUNC self();
@@ -715,7 +734,15 @@ private:
     friend class internal::allocate_continuation_proxy;
     friend class internal::allocate_child_proxy;
     friend class internal::allocate_additional_child_of_proxy;
+#if __TBB_ARENA_PER_MASTER
+    friend class completion_event;
+#endif /* __TBB_ARENA_PER_MASTER */
     
+#if __TBB_ARENA_PER_MASTER
+    //! Enqueues the task after the delay in seconds; used by enqueue_after.
+    static void __TBB_EXPORTED_FUNC internal_enqueue_after( task& t, double delay );
+#endif /* __TBB_ARENA_PER_MASTER */
+
     //! Get reference to corresponding task_prefix.
     /** Version tag prevents loader on Linux from using the wrong symbol in debug builds. **/
     internal::task_prefix& prefix( internal::version_tag* = NULL ) const {
@@ -773,6 +800,38 @@ public:
     }
 };
 
+#if __TBB_ARENA_PER_MASTER
+//! External event that a task waits for, e.g. completion of an asynchronous read.
+/** Constructing the event adds a reference to the task, which is typically a continuation
+    allocated with allocate_continuation(). When the event fires and that was the last
+    reference, the task is enqueued into the arena of the thread that constructed the event.
+    So no thread blocks while the event is pending, and the task's predecessor can return
+    right after starting the operation.
+    The event may be fired by any thread, including threads not known to TBB,
+    and must be fired exactly once. The scheduler that constructed the event must not
+    terminate while the event is pending.
+    @ingroup task_scheduling */
+class completion_event: internal::no_copy {
+    task* my_task;
+    void* my_arena;
+
+    void __TBB_EXPORTED_METHOD internal_construct();
+    void __TBB_EXPORTED_METHOD internal_fire();
+public:
+    //! Makes the task wait for the event.
+    /** The task must not be spawned or enqueued yet. */
+    explicit completion_event( task& t ) : my_task(&t) {
+        internal_construct();
+    }
+
+    //! Signals that the event happened.
+    /** The task may destroy the event object even before the method returns. */
+    void fire() {
+        internal_fire();
+    }
+};
+#endif /* __TBB_ARENA_PER_MASTER */
+
 inline void interface5::internal::task_base::spawn( task& t ) {
     t.prefix().owner->spawn( t, t.prefix().next );
 }
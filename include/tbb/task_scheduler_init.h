@@ -90,6 +90,9 @@ public:
     //! Returns the number of threads tbb scheduler would create if initialized by default.
     /** Result returned by this method does not depend on whether the scheduler 
         has already been initialized.
+
+        On Linux, only the CPUs in the affinity mask of the process are counted,
+        and the result does not exceed the cgroup CPU quota of the process.
         
         Because tbb 2.0 does not support blocking tasks yet, you may use this method
         to boost the number of threads in the tbb's internal pool, if your tasks are 
@@ -97,6 +100,56 @@ public:
         much time your tasks spend in the blocked state. */
     static int __TBB_EXPORTED_FUNC default_num_threads ();
 
+    //! Makes worker threads take enqueued tasks even when they have other work to do.
+    /** By default, a worker takes an enqueued task only when it finds no other work,
+        so a constant flow of spawned tasks can delay enqueued tasks for a long time.
+        In the fairness mode, a worker checks the tasks enqueued into its arena at least
+        once in max_tasks tasks taken from its local pool, or once in max_microseconds.
+        A zero argument turns the respective limit off; both zeros restore the default.
+        Affects all the threads. */
+    static void __TBB_EXPORTED_FUNC set_enqueue_fairness( unsigned max_tasks, unsigned max_microseconds );
+
+    //! Makes the scheduler use fewer worker threads when the machine is loaded by other processes.
+    /** In the load-aware mode, the system load average and the cgroup CPU quota of the process
+        are checked periodically, and the workers that would only compete with other processes
+        for CPU are not employed. Affects all the threads. */
+    static void __TBB_EXPORTED_FUNC set_load_aware_mode( bool enable );
+
+    //! Policies of binding worker threads to CPUs
+    enum affinity_policy {
+        //! Workers may run on any CPU allowed to the process
+        affinity_none,
+        //! Workers fill the hardware threads of a core, then the cores of a package, then the next package
+        affinity_compact,
+        //! Workers are spread over the packages first, then over the cores, then over the hardware threads
+        affinity_scatter,
+        //! Each worker is bound to all the CPUs of a NUMA node, taking the nodes in turn
+        affinity_numa_round_robin,
+        //! Workers are bound to the CPUs of the list given to set_worker_affinity, taking them in turn
+        affinity_cpu_list
+    };
+
+    //! Makes worker threads bind themselves to CPUs according to the policy.
+    /** The policy is applied by the thread pool when a worker thread is created, so it
+        does not change when the worker moves between arenas. Worker threads created
+        before the call keep their binding; call it before the first initialization.
+        With affinity_compact and affinity_scatter, the first CPU is left to the master thread.
+        The cpus array is used by affinity_cpu_list only; it is copied by the call.
+        CPUs that are not allowed to the process are ignored. Binding is supported on Linux only.
+        The CPU a worker is bound to is reported by task_scheduler_observer::bound_cpu(). */
+    static void __TBB_EXPORTED_FUNC set_worker_affinity( affinity_policy policy, const int* cpus = NULL, size_t num_cpus = 0 );
+
+    //! Turns recording of the task scheduler events on or off.
+    /** Each thread records its spawns, steal attempts, steals, mailbox hits, enqueues,
+        dequeues, and moves between arenas and the thread pool into its own ring buffer,
+        which keeps the latest events. Affects all the threads. */
+    static void __TBB_EXPORTED_FUNC set_tracing( bool enable );
+
+    //! Writes the recorded task scheduler events into the file in the Chrome trace format (JSON).
+    /** Can be called while the threads record events. Returns false if the file cannot be
+        written, or if the library is built without tracing. */
+    static bool __TBB_EXPORTED_FUNC write_trace( const char* file_name );
+
     //! Returns true if scheduler is active (initialized); false otherwise
     bool is_active() const { return my_scheduler != NULL; }
 };
@@ -59,6 +59,10 @@ public:
     //! Called by thread when it no longer takes part in task stealing.
     virtual void on_scheduler_exit( bool /*is_worker*/ ) {}
 
+    //! Returns the CPU the calling thread is bound to, or -1 if it may run on several CPUs.
+    /** Worker threads are bound according to task_scheduler_init::set_worker_affinity. */
+    static int __TBB_EXPORTED_FUNC bound_cpu();
+
     //! Destructor
     virtual ~task_scheduler_observer_v3() {observe(false);}
 };
@@ -42,6 +42,7 @@
 #include "blocked_range.h"
 #include "blocked_range2d.h"
 #include "blocked_range3d.h"
+#include "blocking_region.h"
 #include "cache_aligned_allocator.h"
 #include "combinable.h"
 #include "concurrent_unordered_map.h"
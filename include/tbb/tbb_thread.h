@@ -169,7 +169,7 @@ namespace internal {
         inline id get_id() const;
         native_handle_type native_handle() { return my_handle; }
     
-        //! The number of hardware thread contexts.
+        //! The number of hardware thread contexts available to the process.
         static unsigned __TBB_EXPORTED_FUNC hardware_concurrency();
     private:
         native_handle_type my_handle; 
@@ -0,0 +1,80 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+// Benchmark of the memory allocator for the case when a thread takes empty
+// blocks from the shared pool and returns them there at high rate:
+// every thread allocates many objects that need new blocks, then frees
+// them, so the blocks overflow the thread's own pool.
+// Command line: time_malloc_blocks [-v] [MinThreads[:MaxThreads]]
+
+#include <stdio.h>
+#include "tbb/scalable_allocator.h"
+#include "tbb/tick_count.h"
+#define HARNESS_CUSTOM_MAIN 1
+#include "../test/harness.h"
+
+const size_t objectsPerRound = 2*1024;
+const size_t rounds = 500;
+
+static size_t objectSize;
+
+class AllocateAndFree: NoAssign {
+public:
+    AllocateAndFree() {}
+    void operator()(int) const {
+        void **objects = new void*[objectsPerRound];
+        for (size_t r=0; r<rounds; r++) {
+            for (size_t i=0; i<objectsPerRound; i++) {
+                objects[i] = scalable_malloc(objectSize);
+                ASSERT(objects[i], NULL);
+            }
+            for (size_t i=0; i<objectsPerRound; i++)
+                scalable_free(objects[i]);
+        }
+        delete [] objects;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    MinThread = 1; MaxThread = 4;
+    ParseCommandLine( argc, argv );
+    // objects that occupy half, quarter and 1/16 of a block
+    const size_t sizes[] = {8000, 4000, 1000};
+
+    printf("threads, object size, Mallocs/s\n");
+    for (int threads=MinThread; threads<=MaxThread; threads*=2) {
+        for (unsigned i=0; i<sizeof(sizes)/sizeof(size_t); i++) {
+            objectSize = sizes[i];
+            tbb::tick_count t0 = tbb::tick_count::now();
+            NativeParallelFor( threads, AllocateAndFree() );
+            double time = (tbb::tick_count::now()-t0).seconds();
+            printf("%d, %lu, %.2f\n", threads, (unsigned long)objectSize, 
+                   threads*rounds*objectsPerRound/time/1E6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+// Benchmark of the memory allocator fragmentation: objects of random sizes
+// from a range are allocated, and the growth of memory obtained from the OS
+// is compared with the sum of the requested sizes.
+// Command line: time_malloc_fragmentation [-v]
+
+#include <stdio.h>
+#include <stdlib.h>
+#if !_WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "tbb/scalable_allocator.h"
+#define HARNESS_CUSTOM_MAIN 1
+#include "../test/harness.h"
+#include "../test/harness_memory.h"
+
+const size_t requestedPerRange = 64*1024*1024;
+
+struct SizeRange {
+    size_t min, max;
+};
+
+//! Linear congruential generator, to get the same sizes with any allocator
+class SizeGenerator {
+    unsigned state;
+public:
+    SizeGenerator() : state(12345) {}
+    size_t get(const SizeRange &range) {
+        state = state*1664525 + 1013904223;
+        return range.min + (state>>8) % (range.max-range.min+1);
+    }
+};
+
+static void measure(const SizeRange &range) {
+    const size_t maxObjects = requestedPerRange/range.min + 1;
+    void **objects = (void**)malloc(maxObjects*sizeof(void*));
+    ASSERT(objects, NULL);
+    memset(objects, 0, maxObjects*sizeof(void*));
+
+    SizeGenerator generator;
+    size_t requested = 0, num = 0;
+    size_t memBefore = GetMemoryUsage();
+    while (requested < requestedPerRange) {
+        size_t size = generator.get(range);
+        objects[num] = scalable_malloc(size);
+        ASSERT(objects[num], NULL);
+        requested += size;
+        num++;
+    }
+    size_t used = GetMemoryUsage()-memBefore;
+    printf("%lu-%lu, %.1f, %.1f, %.1f\n", (unsigned long)range.min,
+           (unsigned long)range.max, requested/1048576., used/1048576.,
+           100.*((double)used-requested)/used);
+    fflush(stdout);
+    for (size_t i=0; i<num; i++)
+        scalable_free(objects[i]);
+    free(objects);
+}
+
+int main(int argc, char* argv[]) {
+    ParseCommandLine( argc, argv );
+    const SizeRange ranges[] = {
+        {8, 64}, {65, 1024}, {1025, 8000}, {1200, 1260}, {3000, 3100}, {5000, 5400}
+    };
+
+    printf("sizes, requested MB, used MB, waste %%\n");
+    fflush(stdout);
+    for (unsigned r=0; r<sizeof(ranges)/sizeof(SizeRange); r++) {
+#if _WIN32
+        measure(ranges[r]);
+#else
+        // memory kept by the allocator after the previous range would be reused
+        // by the next one, so every range is measured in a new process
+        pid_t pid = fork();
+        ASSERT(pid>=0, "fork failed");
+        if (!pid) {
+            measure(ranges[r]);
+            exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        ASSERT(WIFEXITED(status) && !WEXITSTATUS(status), NULL);
+#endif
+    }
+    return 0;
+}
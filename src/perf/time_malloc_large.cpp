@@ -0,0 +1,93 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+// Benchmark of large object allocation: every thread keeps a window of
+// buffers of random sizes in a range and replaces them one by one,
+// touching every page of each, as a workload using big temporary buffers does.
+// Command line: time_malloc_large [-v] [MinThreads[:MaxThreads]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tbb/scalable_allocator.h"
+#include "tbb/tick_count.h"
+#define HARNESS_CUSTOM_MAIN 1
+#include "../test/harness.h"
+
+const int iterations = 50000;
+const int windowSize = 8;
+
+static size_t minSize, maxSize;
+
+class Churn: NoAssign {
+public:
+    Churn() {}
+    void operator()(int id) const {
+        unsigned seed = id+1;
+        char *window[windowSize] = {};
+        for (int i=0; i<iterations; i++) {
+            int slot = i % windowSize;
+            scalable_free(window[slot]);
+            seed = seed*1103515245+12345;
+            size_t size = minSize + (seed>>8)%(maxSize-minSize);
+            window[slot] = (char*)scalable_malloc(size);
+            ASSERT(window[slot], NULL);
+            for (size_t j=0; j<size; j+=4096)
+                window[slot][j] = 1;
+        }
+        for (int i=0; i<windowSize; i++)
+            scalable_free(window[i]);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    MinThread = 1; MaxThread = 2;
+    ParseCommandLine( argc, argv );
+    const size_t ranges[][2] = {{200*1024, 1024*1024}, {1024*1024, 8*1024*1024},
+                                {200*1024, 8*1024*1024}};
+
+    printf("threads, sizes KB, Kallocs/s, cache hits, misses, evictions\n");
+    for (int threads=MinThread; threads<=MaxThread; threads*=2) {
+        for (unsigned i=0; i<sizeof(ranges)/sizeof(ranges[0]); i++) {
+            minSize = ranges[i][0];
+            maxSize = ranges[i][1];
+            ScalableLargeObjectCacheStat before = {}, after = {};
+            scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, &before);
+            tbb::tick_count t0 = tbb::tick_count::now();
+            NativeParallelFor( threads, Churn() );
+            double time = (tbb::tick_count::now()-t0).seconds();
+            scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, &after);
+            scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+            printf("%d, %lu-%lu, %.1f, %lu, %lu, %lu\n", threads,
+                   (unsigned long)minSize/1024, (unsigned long)maxSize/1024,
+                   threads*iterations/time/1E3,
+                   (unsigned long)(after.hits-before.hits),
+                   (unsigned long)(after.misses-before.misses),
+                   (unsigned long)(after.evictions-before.evictions));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+// Producer/consumer benchmark of the memory allocator: objects allocated
+// by producer threads are freed by consumer threads, so every free
+// is a free of an object owned by another thread.
+// Command line: time_malloc_remote_free [-v] [MinPairs[:MaxPairs]]
+
+#include <stdio.h>
+#include "tbb/scalable_allocator.h"
+#include "tbb/tick_count.h"
+#include "tbb/atomic.h"
+#include "tbb/tbb_machine.h"
+#define HARNESS_CUSTOM_MAIN 1
+#include "../test/harness.h"
+
+const size_t objectsPerThread = 4*1024*1024;
+const size_t ringSize = 1024; // must be power of 2
+
+//! Single producer single consumer ring to pass objects between threads
+class Ring: NoCopy {
+    void *slot[ringSize];
+    tbb::atomic<size_t> pushed, popped;
+public:
+    Ring() { pushed = 0; popped = 0; }
+    void push(void *object) {
+        size_t p = pushed;
+        while (p-popped == ringSize)
+            __TBB_Yield();
+        slot[p & (ringSize-1)] = object;
+        pushed = p+1;
+    }
+    void *pop() {
+        size_t p = popped;
+        while (p == pushed)
+            __TBB_Yield();
+        void *object = slot[p & (ringSize-1)];
+        popped = p+1;
+        return object;
+    }
+};
+
+static Ring *rings;
+static size_t objectSize;
+
+class ProducerConsumer: NoAssign {
+public:
+    ProducerConsumer() {}
+    void operator()(int id) const {
+        Ring &ring = rings[id/2];
+        if (id%2 == 0) {
+            for (size_t i=0; i<objectsPerThread; i++) {
+                void *object = scalable_malloc(objectSize);
+                ASSERT(object, NULL);
+                ring.push(object);
+            }
+        } else {
+            for (size_t i=0; i<objectsPerThread; i++)
+                scalable_free(ring.pop());
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    MinThread = 1; MaxThread = 2;
+    ParseCommandLine( argc, argv );
+    const size_t sizes[] = {8, 64, 256, 1024, 4096};
+
+    printf("pairs, object size, Mfrees/s\n");
+    for (int pairs=MinThread; pairs<=MaxThread; pairs*=2) {
+        for (unsigned i=0; i<sizeof(sizes)/sizeof(size_t); i++) {
+            objectSize = sizes[i];
+            rings = new Ring[pairs];
+            tbb::tick_count t0 = tbb::tick_count::now();
+            NativeParallelFor( 2*pairs, ProducerConsumer() );
+            double time = (tbb::tick_count::now()-t0).seconds();
+            delete [] rings;
+            printf("%d, %lu, %.2f\n", pairs, (unsigned long)objectSize, 
+                   pairs*objectsPerThread/time/1E6);
+        }
+    }
+    return 0;
+}
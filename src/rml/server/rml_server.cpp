@@ -1912,6 +1912,8 @@ server_thread::~server_thread() {
 __RML_DECL_THREAD_ROUTINE server_thread::thread_routine( void* arg ) {
     server_thread* self = static_cast<server_thread*>(arg);
     AVOID_64K_ALIASING( self->my_index );
+    // The thread that launched the server thread may be bound to a part of the allowed CPUs
+    tbb::internal::BindToProcessAffinityMask();
 #if TBB_USE_ASSERT
     __TBB_ASSERT( !self->has_active_thread, NULL );
     self->has_active_thread = true;
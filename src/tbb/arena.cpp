@@ -122,9 +122,11 @@ void arena::process( generic_scheduler& s ) {
     s.my_arena = this;
     s.arena_index = index;
     s.attach_mailbox( affinity_id(index+1) );
+    RECORD_EVENT( s, te_arena_join, int(index) );
 
     slot[index].hint_for_push = index ^ unsigned(&s-(generic_scheduler*)NULL)>>16; // randomizer seed
     slot[index].hint_for_pop  = index; // initial value for round-robin
+    slot[index].numa_node = GetCurrentNumaNode();
 
     unsigned new_limit = index + 1;
     unsigned old_limit = my_limit;
@@ -157,11 +159,14 @@ void arena::process( generic_scheduler& s ) {
         --my_num_threads_leaving;
         __TBB_ASSERT( !slot[0].my_scheduler || my_num_threads_active > 0, "Who requested more workers after the last one left the dispatch loop and the master's gone?" );
     }
+    // Tasks freed here must not wait in the batch while the worker sleeps in the market
+    s.flush_return_batch();
 #if __TBB_STATISTICS
     ++s.my_counters.arena_roundtrips;
     *slot[index].my_counters += s.my_counters;
     s.my_counters.reset();
 #endif /* __TBB_STATISTICS */
+    RECORD_EVENT( s, te_arena_leave, 0 );
     __TBB_store_with_release( slot[index].my_scheduler, (generic_scheduler*)NULL );
     s.inbox.detach();
     __TBB_ASSERT( s.inbox.is_idle_state(true), NULL );
@@ -180,14 +185,35 @@ void arena::process( generic_scheduler& s ) {
         close_arena();
 }
 
+//! Number of slots in the arena with the given number of workers
+/** Two slots are mandatory: for the master, and for 1 worker (required to support starvation resistant tasks).
+    Besides, each thread of the arena can be replaced by an extra worker while it is in a blocking region. **/
+static unsigned num_slots_to_use( unsigned max_num_workers ) {
+    return max(2u, max_num_workers + 1) + max_num_workers + 1;
+}
+
+void arena::enqueue_task( task& t ) {
+    // The thread passes through the arena, so that the arena is not closed until the task is advertised
+    ++my_num_threads_active;
+    ++my_num_threads_leaving;
+    __TBB_ASSERT( is_alive(my_guard), NULL );
+    unsigned hint = unsigned(uintptr_t(&t)>>8); // randomizer seed
+    ITT_NOTIFY(sync_releasing, &my_task_stream);
+    my_task_stream.push( &t, hint, GetCurrentNumaNode() );
+    advertise_new_work< /*Spawned=*/ false >();
+    my_timers.wake_keeper();
+    --my_num_threads_leaving;
+    if ( !--my_num_threads_active )
+        close_arena();
+}
+
 arena::arena ( market& m, unsigned max_num_workers ) {
     __TBB_ASSERT( !my_guard, "improperly allocated arena?" );
     __TBB_ASSERT( sizeof(slot[0]) % NFS_GetLineSize()==0, "arena::slot size not multiple of cache line size" );
     __TBB_ASSERT( (uintptr_t)this % NFS_GetLineSize()==0, "arena misaligned" );
     my_market = &m;
     my_limit = 1;
-    // Two slots are mandatory: for the master, and for 1 worker (required to support starvation resistant tasks).
-    my_num_slots = max(2u, max_num_workers + 1);
+    my_num_slots = num_slots_to_use( max_num_workers );
     my_max_num_workers = max_num_workers;
     my_num_threads_active = 1; // accounts for the master
     __TBB_ASSERT ( my_max_num_workers < my_num_slots, NULL );
@@ -201,7 +227,7 @@ arena::arena ( market& m, unsigned max_num_workers ) {
         slot[i].my_counters = new ( NFS_Allocate(sizeof(statistics_counters), 1, NULL) ) statistics_counters;
 #endif /* __TBB_STATISTICS */
     }
-    my_task_stream.initialize(my_num_slots);
+    my_task_stream.initialize(my_num_slots, governor::number_of_numa_nodes());
     ITT_SYNC_CREATE(&my_task_stream, SyncType_Scheduler, SyncObj_TaskStream);
     my_mandatory_concurrency = false;
 #if __TBB_TASK_GROUP_CONTEXT
@@ -214,7 +240,7 @@ arena& arena::allocate_arena( market& m, unsigned max_num_workers ) {
     __TBB_ASSERT( sizeof(base_type) % NFS_GetLineSize() == 0, "arena slots area misaligned: wrong padding" );
     __TBB_ASSERT( sizeof(mail_outbox) == NFS_MaxLineSize, "Mailbox padding is wrong" );
 
-    unsigned num_slots = max(2u, max_num_workers + 1);
+    unsigned num_slots = num_slots_to_use( max_num_workers );
     size_t n = sizeof(base_type) + num_slots * (sizeof(mail_outbox) + sizeof(arena_slot));
 
     unsigned char* storage = (unsigned char*)NFS_Allocate( n, 1, NULL );
@@ -230,6 +256,7 @@ void arena::free_arena () {
     for ( unsigned i = 1; i <= my_num_slots; ++i )
         drained += mailbox(i).drain();
     __TBB_ASSERT(my_task_stream.empty() && my_task_stream.drain()==0, "Not all enqueued tasks were executed");
+    __TBB_ASSERT( my_timers.empty(), "Not all timed tasks were executed" );
 #if __TBB_COUNT_TASK_NODES
     my_market->update_task_node_count( -drained );
 #endif /* __TBB_COUNT_TASK_NODES */
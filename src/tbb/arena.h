@@ -37,6 +37,7 @@
 #include "market.h"
 #include "intrusive_list.h"
 #include "task_stream.h"
+#include "timer_queue.h"
 #else /* !__TBB_ARENA_PER_MASTER */
 #include "../rml/include/rml_tbb.h"
 #endif /* !__TBB_ARENA_PER_MASTER */
@@ -48,6 +49,7 @@ namespace tbb {
 #if __TBB_ARENA_PER_MASTER
 class task_group_context;
 class allocate_root_with_context_proxy;
+class blocking_region;
 #endif /* __TBB_ARENA_PER_MASTER */
 
 namespace internal {
@@ -213,6 +215,9 @@ struct arena_slot {
     /** Modified by the owner thread (during these operations). **/
     unsigned hint_for_push, hint_for_pop;
 
+    //! NUMA node of the owner thread, as seen when it occupied the slot.
+    unsigned numa_node;
+
 #endif /* __TBB_ARENA_PER_MASTER */
 
 #if __TBB_STATISTICS
@@ -222,7 +227,7 @@ struct arena_slot {
     //! Padding to avoid false sharing caused by the thieves accessing the next slot
     char pad2[NFS_MaxLineSize - sizeof(size_t)
 #if __TBB_ARENA_PER_MASTER
-              - 2*sizeof(unsigned)
+              - 3*sizeof(unsigned)
 #endif /* __TBB_ARENA_PER_MASTER */
 #if __TBB_STATISTICS
               - sizeof(statistics_counters*)
@@ -258,6 +263,10 @@ struct arena_base : intrusive_list_node {
     //! Number of workers that have been marked out by the resource manager to service the arena
     unsigned my_num_workers_allotted;
 
+    //! Number of the arena's threads in blocking regions
+    /** Each of them can be replaced by an extra worker. Protected by the market's arenas list mutex. **/
+    int my_num_blocked_threads;
+
     //! Number of threads in the arena at the moment
     /** Consists of the workers servicing the arena and one master until it starts 
         arena shutdown and detaches from it. Plays the role of the arena's ref count. **/
@@ -281,6 +290,9 @@ struct arena_base : intrusive_list_node {
     //! The task pool that guarantees eventual execution even if new tasks are constantly coming.
     task_stream my_task_stream;
 
+    //! The enqueued tasks waiting for their deadlines.
+    timer_queue my_timers;
+
     bool my_mandatory_concurrency;
 
 #if TBB_USE_ASSERT
@@ -305,9 +317,12 @@ class arena
 
 #if __TBB_ARENA_PER_MASTER
     friend class market;
+    friend class tbb::completion_event;
+    friend class tbb::blocking_region;
     friend class tbb::task_group_context;
     friend class allocate_root_with_context_proxy;
     friend class intrusive_list<arena>;
+    friend class timer_queue;
 
     typedef padded<arena_base> base_type;
 
@@ -398,6 +413,18 @@ class arena
     //! Registers the worker with the arena and enters TBB scheduler dispatch loop
     void process( generic_scheduler& s );
 
+    //! Puts the ready task into the task stream on behalf of a thread that may not belong to the arena.
+    void enqueue_task( task& t );
+
+    //! True if the keeper of the timed tasks should stop sleeping and return to the dispatch loop.
+    /** That is if the arena has spawned or enqueued work, or fewer workers are allotted
+        to it than are active. An arena without work has no workers allotted, and its
+        keeper stays. Does not take locks. **/
+    bool keeper_has_work() {
+        return prefix().pool_state!=SNAPSHOT_EMPTY || !my_task_stream.empty()
+            || (my_num_workers_allotted && my_num_workers_allotted < num_workers_active());
+    }
+
 #if __TBB_STATISTICS
     //! Outputs internal statistics accumulated by the arena
     void dump_arena_statistics ();
@@ -452,6 +479,8 @@ template<bool Spawned> void arena::advertise_new_work() {
             // This thread transitioned pool from empty to full state, and thus is responsible for
             // telling RML that there is work to do.
             if( Spawned ) {
+                // The compare_and_swap above orders the transition before the check for the keeper
+                my_timers.wake_keeper();
                 if( my_mandatory_concurrency ) {
                     __TBB_ASSERT(my_max_num_workers==1, "");
                     // There was deliberate oversubscription on 1 core for sake of starvation-resistant tasks.
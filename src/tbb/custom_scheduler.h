@@ -166,12 +166,14 @@ task* custom_scheduler<SchedulerTraits>::receive_or_steal_task( reference_count&
 #endif /* !__TBB_ARENA_PER_MASTER */
         if( n>1 ) {
             if( my_affinity_id && (t=get_mailbox_task()) ) {
+                RECORD_EVENT( *this, te_mailbox, 0 );
                 GATHER_STATISTIC( ++my_counters.mails_received );
             }
 #if __TBB_ARENA_PER_MASTER
             // Check if there are tasks in starvation-resistant stream.
             // Only allowed for workers with empty stack, which is identified by return_if_no_work.
-            else if ( return_if_no_work && (t=dequeue_task()) ) {
+            // The timed tasks whose deadline has come go first, as they have already waited.
+            else if ( return_if_no_work && ((t=dequeue_timed_task()) || (t=dequeue_task())) ) {
                 // just proceed with the obtained task
             }
             // Check if the resource manager requires our arena to relinquish some threads 
@@ -196,6 +198,7 @@ task* custom_scheduler<SchedulerTraits>::receive_or_steal_task( reference_count&
                 // the checks simple seems to be preferable to complicating the code.
                 if( k >= arena_index )
                     ++victim;               // Adjusts random distribution to exclude self
+                RECORD_EVENT( *this, te_steal_attempt, int(victim-my_arena->slot) );
                 t = steal_task( *victim );
                 if( !t ) goto fail;
                 if( is_proxy(*t) ) {
@@ -208,6 +211,7 @@ task* custom_scheduler<SchedulerTraits>::receive_or_steal_task( reference_count&
                     innermost_running_task = t;
                     t->note_affinity( my_affinity_id );
                 }
+                RECORD_EVENT( *this, te_steal, int(victim-my_arena->slot) );
                 GATHER_STATISTIC( ++my_counters.steals_committed );
             }
             __TBB_ASSERT(t,NULL);
@@ -246,6 +250,20 @@ fail:
                 // When a worker thread has nothing to do, return it to RML.
                 // For purposes of affinity support, the thread is considered idle while in RML.
                 if( return_if_no_work && my_arena->is_out_of_work() ) {
+#if __TBB_ARENA_PER_MASTER
+                    // Instead of leaving, sleep until the next timed task is due, unless another worker does.
+                    if( task* due = my_arena->my_timers.sleep_until_due( *my_arena ) ) {
+                        enqueue_ready_task( *due );
+                        failure_count = yield_threshold;
+                        continue;
+                    }
+                    if( my_arena->keeper_has_work() ) {
+                        // Woken up by new work, or by the market that takes workers away;
+                        // the dispatch loop takes the work, or leaves the arena.
+                        failure_count = yield_threshold;
+                        continue;
+                    }
+#endif /* __TBB_ARENA_PER_MASTER */
                     if( SchedulerTraits::itt_possible ) {
                         if( failure_count!=-1 )
                             ITT_NOTIFY(sync_cancel, this);
@@ -397,6 +415,12 @@ exception_was_caught:
 
             if ( parent.prefix().ref_count == quit_point )
                 break;
+#if __TBB_ARENA_PER_MASTER
+            // Like in receive_or_steal_task, only a worker with empty stack takes enqueued tasks.
+            if( !old_innermost_running_task && (t = dequeue_task_if_due()) )
+                t->prefix().owner = this;
+            else
+#endif /* __TBB_ARENA_PER_MASTER */
             t = get_task();
             __TBB_ASSERT(!t || !is_proxy(*t),"unexpected proxy");
 #if TBB_USE_ASSERT
@@ -414,7 +438,8 @@ exception_was_caught:
             return;
         }
 #if __TBB_ARENA_PER_MASTER
-        __TBB_ASSERT( my_arena->my_max_num_workers > 0 || parent.prefix().ref_count == 1, "deadlock detected" );
+        __TBB_ASSERT( my_arena->my_max_num_workers > 0 || my_arena->my_num_blocked_threads > 0
+                      || parent.prefix().ref_count == 1, "deadlock detected" );
 #else /* !__TBB_ARENA_PER_MASTER */
         __TBB_ASSERT( my_arena->prefix().number_of_workers>0||parent.prefix().ref_count==1, "deadlock detected" );
 #endif /* !__TBB_ARENA_PER_MASTER */
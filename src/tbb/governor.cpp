@@ -337,4 +337,36 @@ int task_scheduler_init::default_num_threads() {
     return governor::default_num_threads();
 }
 
+void task_scheduler_init::set_enqueue_fairness( unsigned max_tasks, unsigned max_microseconds ) {
+    governor::EnqueueFairnessTasks = max_tasks;
+    governor::EnqueueFairnessMicroseconds = max_microseconds;
+}
+
+void task_scheduler_init::set_load_aware_mode( bool enable ) {
+    governor::LoadAwareMode = enable;
+    market::refresh_load_limit();
+}
+
+void task_scheduler_init::set_worker_affinity( affinity_policy policy, const int* cpus, size_t num_cpus ) {
+    __TBB_ASSERT( policy!=affinity_cpu_list || cpus || !num_cpus, "no CPU list given" );
+    SetWorkerAffinity( policy, cpus, num_cpus );
+}
+
+void task_scheduler_init::set_tracing( bool enable ) {
+#if __TBB_TRACING
+    SetTracing( enable );
+#else
+    (void)enable;
+#endif /* __TBB_TRACING */
+}
+
+bool task_scheduler_init::write_trace( const char* file_name ) {
+#if __TBB_TRACING
+    return WriteTrace( file_name );
+#else
+    (void)file_name;
+    return false;
+#endif /* __TBB_TRACING */
+}
+
 } // namespace tbb
@@ -66,6 +66,7 @@ class __TBB_InitOnce;
     The class contains only static data members and methods.*/
 class governor {
     friend class __TBB_InitOnce;
+    friend class tbb::task_scheduler_init;
 #if __TBB_ARENA_PER_MASTER
     friend class market;
 #else /* !__TBB_ARENA_PER_MASTER */
@@ -88,6 +89,16 @@ class governor {
 
     //! Caches the maximal level of paralellism supported by the hardware 
     static unsigned DefaultNumberOfThreads;
+
+    //! Caches the number of NUMA nodes in the system
+    static unsigned NumberOfNumaNodes;
+
+    //! Limits set by task_scheduler_init::set_enqueue_fairness; zero means no limit.
+    static unsigned EnqueueFairnessTasks;
+    static unsigned EnqueueFairnessMicroseconds;
+
+    //! Set by task_scheduler_init::set_load_aware_mode.
+    static bool LoadAwareMode;
     
     static rml::tbb_factory theRMLServerFactory;
 
@@ -118,6 +129,14 @@ public:
         return DefaultNumberOfThreads ? DefaultNumberOfThreads : 
                                         DefaultNumberOfThreads = DetectNumberOfWorkers();
     }
+    static unsigned number_of_numa_nodes () {
+        // As above, at worst each invoking thread detects the topology once.
+        return NumberOfNumaNodes ? NumberOfNumaNodes :
+                                   NumberOfNumaNodes = DetectNumberOfNumaNodes();
+    }
+    static unsigned enqueue_fairness_tasks () { return EnqueueFairnessTasks; }
+    static unsigned enqueue_fairness_microseconds () { return EnqueueFairnessMicroseconds; }
+    static bool load_aware_mode () { return LoadAwareMode; }
     //! Processes scheduler initialization request (possibly nested) in a master thread
     /** If necessary creates new instance of arena and/or local scheduler.
         The auto_init argument specifies if the call is due to automatic initialization. **/
@@ -128,15 +128,9 @@ public:
     }
 
     //! Drain the mailbox 
-    intptr_t drain() {
-        intptr_t k = 0;
-        // No fences here because other threads have already quit.
-        for( ; task_proxy* t = my_first; ++k ) {
-            my_first = t->next_in_mailbox;
-            NFS_Free((char*)t - task_prefix_reservation_size);
-        }
-        return k;  
-    }
+    /** The proxies are returned to the schedulers that allocated them.
+        Returns the number of proxies whose schedulers are gone. **/
+    intptr_t drain();
 
     //! True if thread that owns this mailbox is looking for work.
     bool recipient_is_idle() {
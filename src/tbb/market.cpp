@@ -27,6 +27,7 @@
 */
 
 #include "tbb/tbb_stddef.h"
+#include "tbb/blocking_region.h"
 
 #if __TBB_ARENA_PER_MASTER
 
@@ -47,6 +48,10 @@ market::market ( unsigned max_num_workers, size_t stack_size )
     : my_ref_count(1)
     , my_stack_size(stack_size)
     , my_max_num_workers(max_num_workers)
+    , my_max_num_extra_workers(num_extra_workers(max_num_workers))
+    , my_num_blocked_threads(0)
+    , my_num_workers_requested(0)
+    , my_num_workers_load_limit(max_num_workers)
 {
     my_next_arena = my_arenas.begin();
 
@@ -74,7 +79,7 @@ market& market::global_market ( unsigned max_num_workers, size_t stack_size ) {
 #if __TBB_TASK_GROUP_CONTEXT
         __TBB_ASSERT( __TBB_offsetof(market, my_workers) + sizeof(generic_scheduler*) == sizeof(market),
                       "my_workers must be the last data field of the market class");
-        size += sizeof(generic_scheduler*) * (max_num_workers - 1);
+        size += sizeof(generic_scheduler*) * (max_num_workers + num_extra_workers(max_num_workers) - 1);
 #endif /* __TBB_TASK_GROUP_CONTEXT */
         __TBB_InitOnce::add_ref();
         void* storage = NFS_Allocate(size, 1, NULL);
@@ -150,45 +155,156 @@ arena* market::arena_in_need () {
     return NULL;
 }
 
-void market::update_allotment ( int max_workers ) {
+int market::effective_demand ( const arena& a ) {
+    // An arena without regular workers requests none even when it has work
+    return a.prefix().pool_state != arena::SNAPSHOT_EMPTY ? a.my_num_workers_requested + a.my_num_blocked_threads : 0;
+}
+
+int market::update_allotment () {
     unsigned carry = 0;
-    spin_mutex::scoped_lock lock(my_arenas_list_mutex);
     arena_list_type::iterator it = my_arenas.begin();
-    int total_demand = my_total_demand;
+    // Each thread in a blocking region makes room for one more worker, as long as its arena has work
+    int total_demand = 0;
+    for ( ; it != my_arenas.end(); ++it )
+        total_demand += effective_demand( *it );
+    int max_workers = min(my_num_workers_load_limit, (int)my_max_num_workers)
+                      + min(my_num_blocked_threads, (int)my_max_num_extra_workers);
     max_workers = min(max_workers, total_demand);
     if ( total_demand > 0 ) {
-        for ( ; it != my_arenas.end(); ++it ) {
+        for ( it = my_arenas.begin(); it != my_arenas.end(); ++it ) {
             arena& a = *it;
-            int tmp = a.my_num_workers_requested * max_workers + carry;
+            int tmp = effective_demand( a ) * max_workers + carry;
             int allotted = tmp / total_demand;
             carry = tmp % total_demand;
-            a.my_num_workers_allotted = min( allotted, (int)a.my_max_num_workers );
+            int limit = min( (int)a.my_max_num_workers + a.my_num_blocked_threads, (int)a.my_num_slots - 1 );
+            unsigned old_allotted = a.my_num_workers_allotted;
+            a.my_num_workers_allotted = min( allotted, limit );
+            if( a.my_num_workers_allotted < old_allotted ) {
+                // The keeper of the timed tasks has to leave as well if the arena gives up workers
+                __TBB_full_memory_fence();
+                a.my_timers.wake_keeper();
+            }
         }
     }
     else {
-        for ( ; it != my_arenas.end(); ++it ) {
+        for ( it = my_arenas.begin(); it != my_arenas.end(); ++it ) {
             it->my_num_workers_allotted = 0;
         }
     }
+    // The resource manager may have more threads than can be employed now, so request only the needed ones
+    int delta = max(max_workers, 0) - my_num_workers_requested;
+    my_num_workers_requested += delta;
+    return delta;
 }
 
 /** The balancing algorithm may be liable to data races. However the aberrations 
     caused by the races are not fatal and generally only temporarily affect fairness 
     of the workers distribution among arenas. **/
-void market::adjust_demand ( arena& a, int delta ) {
+void market::adjust_demand ( arena& a, int delta, bool blocked ) {
     __TBB_ASSERT( theMarket, "market instance was destroyed prematurely?" );
-    a.my_num_workers_requested += delta;
-    my_total_demand += delta;
-    update_allotment( my_max_num_workers );
+    update_load_limit();
+    int rml_delta;
+    {
+        spin_mutex::scoped_lock lock(my_arenas_list_mutex);
+        if ( blocked ) {
+            a.my_num_blocked_threads += delta;
+            my_num_blocked_threads += delta;
+        } else {
+            a.my_num_workers_requested += delta;
+            my_total_demand += delta;
+        }
+        rml_delta = update_allotment();
+    }
     // Must be called outside of any locks
-    my_server->adjust_job_count_estimate( delta );
+    my_server->adjust_job_count_estimate( rml_delta );
     GATHER_STATISTIC( governor::local_scheduler_if_initialized() ? ++governor::local_scheduler_if_initialized()->my_counters.gate_switches : 0 );
 }
 
+//! How often the load is sampled in the load-aware mode, in seconds
+static const double LoadSampleInterval = 1;
+
+//! How much the load must change, in CPUs, to change the number of workers
+/** Prevents the number of workers from flapping when the load fluctuates. **/
+static const double LoadHysteresis = 1;
+
+//! Returns the number of workers that fit into num_cpus CPUs under the given load.
+/** load is negative if it is unknown. num_own_threads is the number of threads of this process
+    counted in the load, and current_limit is the limit in effect, kept while the room for
+    the workers stays within LoadHysteresis from it. **/
+static int CalculateLoadLimit( int max_workers, int num_cpus, double load, int num_own_threads,
+                               int num_masters, int current_limit ) {
+    // One CPU is left for the master
+    int limit = min(max_workers, num_cpus - 1);
+    if( load >= 0 ) {
+        // The threads of this process are a part of the load, the rest takes CPUs away from them
+        double foreign_load = load - num_own_threads;
+        double room = num_cpus - num_masters - foreign_load;
+        if( room < current_limit - LoadHysteresis || room > current_limit + LoadHysteresis )
+            limit = min(limit, int(room + 0.5));
+        else
+            limit = min(limit, current_limit);
+    }
+    // At least one worker is required to support starvation resistant tasks
+    return max(limit, 1);
+}
+
+int market::calculate_load_limit () {
+    if( !governor::load_aware_mode() )
+        return my_max_num_workers;
+    int num_cpus = governor::default_num_threads();
+    if( int quota = DetectCpuQuota() )
+        num_cpus = min(num_cpus, quota);
+    return CalculateLoadLimit( (int)my_max_num_workers, num_cpus, GetSystemLoad(),
+                               my_num_workers_requested + num_active_masters(),
+                               num_active_masters(), my_num_workers_load_limit );
+}
+
+void market::update_load_limit ( bool force ) {
+    if( !governor::load_aware_mode() && my_num_workers_load_limit == (int)my_max_num_workers )
+        return;
+    int rml_delta;
+    {
+        // Unless forced, threads that find the sampling in progress need not wait for it
+        spin_mutex::scoped_lock load_lock;
+        if( force )
+            load_lock.acquire(my_load_mutex);
+        else if( !load_lock.try_acquire(my_load_mutex) )
+            return;
+        tick_count now = tick_count::now();
+        if( !force && (now - my_load_sample_time).seconds() < LoadSampleInterval && governor::load_aware_mode() )
+            return;
+        my_load_sample_time = now;
+        int limit = calculate_load_limit();
+        if( limit == my_num_workers_load_limit )
+            return;
+        spin_mutex::scoped_lock lock(my_arenas_list_mutex);
+        my_num_workers_load_limit = limit;
+        rml_delta = update_allotment();
+    }
+    // Must be called outside of any locks
+    my_server->adjust_job_count_estimate( rml_delta );
+}
+
+void market::refresh_load_limit () {
+    market* m;
+    {
+        global_market_mutex_type::scoped_lock lock( theMarketMutex );
+        m = theMarket;
+        if( !m )
+            return;
+        ++m->my_ref_count;
+    }
+    m->update_load_limit( /*force=*/true );
+    m->release();
+}
+
 void market::process( job& j ) {
     generic_scheduler& s = static_cast<generic_scheduler&>(j);
+    RECORD_EVENT( s, te_wake, 0 );
+    update_load_limit();
     while ( arena *a = arena_in_need() )
         a->process(s);
+    RECORD_EVENT( s, te_sleep, 0 );
     GATHER_STATISTIC( ++s.my_counters.market_roundtrips );
 }
 
@@ -264,6 +380,26 @@ intptr_t market::workers_task_node_count() {
 #endif /* __TBB_COUNT_TASK_NODES */
 
 } // namespace internal
+
+//------------------------------------------------------------------------
+// blocking_region
+//------------------------------------------------------------------------
+
+void blocking_region::internal_enter() {
+    internal::generic_scheduler* s = internal::governor::local_scheduler_if_initialized();
+    if( s && s->my_arena && !s->my_in_blocking_region ) {
+        s->my_in_blocking_region = true;
+        my_arena = s->my_arena;
+        s->my_arena->my_market->adjust_demand( *s->my_arena, 1, /*blocked=*/true );
+    }
+}
+
+void blocking_region::internal_exit() {
+    internal::arena* a = static_cast<internal::arena*>(my_arena);
+    a->my_market->adjust_demand( *a, -1, /*blocked=*/true );
+    internal::governor::local_scheduler()->my_in_blocking_region = false;
+}
+
 } // namespace tbb
 
 #endif /* __TBB_ARENA_PER_MASTER */
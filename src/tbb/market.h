@@ -35,6 +35,7 @@
 
 #include "tbb/atomic.h"
 #include "tbb/spin_mutex.h"
+#include "tbb/tick_count.h"
 #include "../rml/include/rml_tbb.h"
 
 #include "intrusive_list.h"
@@ -96,6 +97,30 @@ class market : no_copy, rml::tbb_client {
     //! Number of workers requested from the underlying resource manager
     unsigned my_max_num_workers;
 
+    //! Number of additional workers that can replace threads blocked in blocking regions
+    /** The resource manager is asked for up to my_max_num_workers + my_max_num_extra_workers threads,
+        but it is never requested more workers than can be employed at the moment. **/
+    unsigned my_max_num_extra_workers;
+
+    //! Number of threads of all arenas that are in blocking regions
+    /** Protected by my_arenas_list_mutex. **/
+    int my_num_blocked_threads;
+
+    //! Number of workers currently requested from the resource manager
+    /** Protected by my_arenas_list_mutex. **/
+    int my_num_workers_requested;
+
+    //! Number of regular workers the load on the machine leaves room for
+    /** Equals my_max_num_workers unless the load-aware mode is on.
+        Changed under both my_load_mutex and my_arenas_list_mutex. **/
+    int my_num_workers_load_limit;
+
+    //! Serializes sampling of the load
+    spin_mutex my_load_mutex;
+
+    //! When the load was sampled last time
+    tick_count my_load_sample_time;
+
 #if __TBB_COUNT_TASK_NODES
     //! Net number of nodes that have been allocated from heap.
     /** Updated each time a scheduler or arena is destroyed. */
@@ -108,6 +133,10 @@ class market : no_copy, rml::tbb_client {
     //! Constructor
     market ( unsigned max_num_workers, size_t stack_size );
 
+    //! Number of extra workers in the market with the given number of regular ones
+    /** Enough to replace every thread of an arena that employs all the regular workers. **/
+    static unsigned num_extra_workers ( unsigned max_num_workers ) { return max_num_workers + 1; }
+
     //! Factory method creating new market object
     static market& global_market ( unsigned max_num_workers, size_t stack_size );
 
@@ -119,8 +148,20 @@ class market : no_copy, rml::tbb_client {
 
     //! Recalculates the number of workers assigned to each arena.
     /** The actual number of workers servicing a particular arena may temporarily 
-        deviate from the calculated value. **/
-    void update_allotment ( int max_workers );
+        deviate from the calculated value. Must be called under my_arenas_list_mutex.
+        Returns the change in the number of workers to request from the resource manager. **/
+    int update_allotment ();
+
+    //! Number of workers the arena could employ now, including the ones replacing its blocked threads
+    static int effective_demand ( const arena& a );
+
+    //! Samples the load and updates my_num_workers_load_limit, if it is time to.
+    /** If force is true, the sample is taken at once, even if another thread is taking one.
+        Must be called outside of any locks. **/
+    void update_load_limit ( bool force = false );
+
+    //! Returns the number of regular workers the current load on the machine leaves room for.
+    int calculate_load_limit ();
 
     //! Returns number of masters doing computational (CPU-intensive) work
     int num_active_masters () { return 1; }  // APM TODO: replace with a real mechanism
@@ -130,7 +171,7 @@ class market : no_copy, rml::tbb_client {
 
     /*override*/ version_type version () const { return 0; }
 
-    /*override*/ unsigned max_job_count () const { return my_max_num_workers; }
+    /*override*/ unsigned max_job_count () const { return my_max_num_workers + my_max_num_extra_workers; }
 
     /*override*/ size_t min_stack_size () const { return worker_stack_size(); }
 
@@ -156,9 +197,14 @@ public:
     //! Decrements market's refcount and destroys it in the end
     void release ();
 
+    //! Updates the load limit of the current market, if any, without waiting for the next sample.
+    /** Called when the load-aware mode is switched, as nothing may change the demand afterwards. **/
+    static void refresh_load_limit ();
+
     //! Request that arena's need in workers should be adjusted.
-    /** Concurrent invocations are possible only on behalf of different arenas. **/
-    void adjust_demand ( arena&, int delta );
+    /** If blocked is true, delta changes the number of the arena's threads in blocking regions instead,
+        so that extra workers may replace them while the arena has work. **/
+    void adjust_demand ( arena&, int delta, bool blocked = false );
 
     //! Returns the requested stack size of worker threads.
     size_t worker_stack_size () const { return my_stack_size; }
@@ -231,6 +231,10 @@ void task_scheduler_observer_v3::observe( bool state ) {
     }
 }
 
+int task_scheduler_observer_v3::bound_cpu() {
+    return GetBoundCpu();
+}
+
 } // namespace internal
 } // namespace tbb
 
@@ -32,6 +32,7 @@
 #include "tbb/cache_aligned_allocator.h"
 #include "tbb/spin_mutex.h"
 #include "tbb/tbb_thread.h"
+#include "tbb_misc.h"
 
 #if _XBOX
     #define NONET
@@ -232,6 +233,9 @@ __RML_DECL_THREAD_ROUTINE private_worker::thread_routine( void* arg ) {
 #if _XBOX
     int HWThreadIndex = GetHardwareThreadIndex(i);
     XSetThreadProcessor(GetCurrentThread(), HWThreadIndex);
+#else
+    // Binding here rather than on entering an arena keeps it when the worker moves between arenas
+    tbb::internal::BindWorkerThread( self->my_index );
 #endif
     self->run();
     return 0;
@@ -111,7 +111,17 @@ generic_scheduler::generic_scheduler( arena* a, size_t index ) :
 #endif /* __TBB_ARENA_PER_MASTER */
     my_arena(a),
     random( unsigned(this-(generic_scheduler*)NULL) ),
-    free_list(NULL),
+    my_slab_ptr(NULL),
+    my_slab_end(NULL),
+    my_slabs(NULL),
+    my_return_batch(NULL),
+    my_return_batch_tail(NULL),
+    my_return_batch_size(0),
+    my_return_batch_origin(NULL),
+#if __TBB_ARENA_PER_MASTER
+    my_tasks_since_dequeue(0),
+    my_in_blocking_region(false),
+#endif /* __TBB_ARENA_PER_MASTER */
     innermost_running_task(NULL),
     dummy_task(NULL),
     ref_count(1),
@@ -134,6 +144,11 @@ generic_scheduler::generic_scheduler( arena* a, size_t index ) :
    ,my_cilk_state(cs_none)
 #endif /* __TBB_SURVIVE_THREAD_SWITCH && TBB_USE_ASSERT */
 {
+    for( size_t k=0; k<num_task_size_classes; ++k )
+        free_list[k] = NULL;
+#if __TBB_TRACING
+    my_trace_buffer = NULL;
+#endif /* __TBB_TRACING */
     dummy_slot.task_pool = allocate_task_pool( min_task_pool_size );
     dummy_slot.head = dummy_slot.tail = 0;
     dummy_task = &allocate_task( sizeof(task), __TBB_CONTEXT_ARG(NULL, NULL) );
@@ -366,20 +381,24 @@ void generic_scheduler::free_scheduler() {
 #endif /* !__TBB_ARENA_PER_MASTER */
 #endif /* __TBB_TASK_GROUP_CONTEXT */
     free_task<small_local_task>( *dummy_task );
+    flush_return_batch();
 
     // k accounts for a guard reference and each task that we deallocate.
+    // The memory of the tasks is freed with the slabs.
     intptr_t k = 1;
     for(;;) {
-        while( task* t = free_list ) {
-            free_list = t->prefix().next;
-            deallocate_task(*t);
-            ++k;
+        for( size_t i=0; i<num_task_size_classes; ++i ) {
+            while( task* t = free_list[i] ) {
+                free_list[i] = t->prefix().next;
+                ++k;
+            }
         }
         if( return_list==plugged_return_list() ) 
             break;
-        free_list = (task*)__TBB_FetchAndStoreW( &return_list, (intptr_t)plugged_return_list() );
+        free_list[0] = (task*)__TBB_FetchAndStoreW( &return_list, (intptr_t)plugged_return_list() );
     }
 #if __TBB_COUNT_TASK_NODES
+    task_node_count -= k-1;
 #if __TBB_ARENA_PER_MASTER
     my_market->update_task_node_count( task_node_count );
 #else /* !__TBB_ARENA_PER_MASTER */
@@ -389,38 +408,47 @@ void generic_scheduler::free_scheduler() {
 #if !__TBB_ARENA_PER_MASTER && __TBB_STATISTICS
     dump_statistics(my_counters, arena_index < my_arena->prefix().number_of_workers ? arena_index + 1 : 0 );
 #endif /* !__TBB_ARENA_PER_MASTER && __TBB_STATISTICS */
+#if __TBB_TRACING
+    release_trace_buffer( my_trace_buffer );
+#endif /* __TBB_TRACING */
     free_task_pool( dummy_slot.task_pool );
     dummy_slot.task_pool = NULL;
     // Update small_task_count last.  Doing so sooner might cause another thread to free *this.
     __TBB_ASSERT( small_task_count>=k, "small_task_count corrupted" );
     governor::sign_off(this);
-    if( __TBB_FetchAndAddW( &small_task_count, -k )==k )
-        NFS_Free( this );
+    release_small_tasks( *this, k );
+}
+
+void generic_scheduler::release_small_tasks( generic_scheduler& s, intptr_t n ) {
+    if( __TBB_FetchAndAddW( &s.small_task_count, -n )==n ) {
+        // We freed the last task allocated by scheduler s, so it's our responsibility
+        // to free the scheduler and the slabs of its tasks.
+        while( char* slab = s.my_slabs ) {
+            s.my_slabs = *(char**)slab;
+            NFS_Free( slab );
+        }
+        NFS_Free( &s );
+    }
 }
 
 task& generic_scheduler::allocate_task( size_t number_of_bytes, 
                                             __TBB_CONTEXT_ARG(task* parent, task_group_context* context) ) {
     GATHER_STATISTIC(++my_counters.active_tasks);
-    task* t = free_list;
-    if( number_of_bytes<=quick_task_size ) {
+    task* t;
+    if( number_of_bytes<=max_small_task_size ) {
+        size_t k = task_size_class( number_of_bytes );
+        t = free_list[k];
+        if( !t && return_list ) {
+            take_returned_tasks();
+            t = free_list[k];
+        }
         if( t ) {
             GATHER_STATISTIC(--my_counters.free_list_length);
+            GATHER_STATISTIC(++my_counters.free_list_hits);
             __TBB_ASSERT( t->state()==task::freed, "free list of tasks is corrupted" );
-            free_list = t->prefix().next;
-        } else if( return_list ) {
-            // No fence required for read of return_list above, because __TBB_FetchAndStoreW has a fence.
-            t = (task*)__TBB_FetchAndStoreW( &return_list, 0 );
-            __TBB_ASSERT( t, "another thread emptied the return_list" );
-            __TBB_ASSERT( t->prefix().origin==this, "task returned to wrong return_list" );
-            ITT_NOTIFY( sync_acquired, &return_list );
-            free_list = t->prefix().next;
+            free_list[k] = t->prefix().next;
         } else {
-            t = (task*)((char*)NFS_Allocate( task_prefix_reservation_size+quick_task_size, 1, NULL ) + task_prefix_reservation_size );
-#if __TBB_COUNT_TASK_NODES
-            ++task_node_count;
-#endif /* __TBB_COUNT_TASK_NODES */
-            t->prefix().origin = this;
-            ++small_task_count;
+            t = allocate_small_task( k );
         }
     } else {
         GATHER_STATISTIC(++my_counters.big_tasks);
@@ -447,28 +475,114 @@ task& generic_scheduler::allocate_task( size_t number_of_bytes,
     return *t;
 }
 
+task* generic_scheduler::allocate_small_task( size_t k ) {
+    size_t slot_size = min_task_slot_size<<k;
+    if( size_t(my_slab_end-my_slab_ptr)<slot_size ) {
+        // The rest of the current slab, if any, stays unused.
+        // The first line of a slab links it into the list, so the tasks stay cache aligned.
+        char* slab = (char*)NFS_Allocate( task_slab_size, 1, NULL );
+        *(char**)slab = my_slabs;
+        my_slabs = slab;
+        my_slab_ptr = slab+NFS_MaxLineSize;
+        my_slab_end = slab+task_slab_size;
+        GATHER_STATISTIC(++my_counters.task_slabs);
+    }
+    task* t = (task*)(my_slab_ptr+task_prefix_reservation_size);
+    my_slab_ptr += slot_size;
+    GATHER_STATISTIC(++my_counters.slab_tasks);
+#if __TBB_COUNT_TASK_NODES
+    ++task_node_count;
+#endif /* __TBB_COUNT_TASK_NODES */
+    t->prefix().origin = (scheduler*)((uintptr_t)static_cast<scheduler*>(this) | k);
+    ++small_task_count;
+    return t;
+}
+
+void generic_scheduler::take_returned_tasks() {
+    // No fence required for read of return_list by the caller, because __TBB_FetchAndStoreW has a fence.
+    task* t = (task*)__TBB_FetchAndStoreW( &return_list, 0 );
+    __TBB_ASSERT( t, "another thread emptied the return_list" );
+    ITT_NOTIFY( sync_acquired, &return_list );
+    do {
+        __TBB_ASSERT( origin_of(*t)==this, "task returned to wrong return_list" );
+        task* next = t->prefix().next;
+        size_t k = size_class_of(*t);
+        t->prefix().next = free_list[k];
+        free_list[k] = t;
+        GATHER_STATISTIC(++my_counters.returned_tasks);
+        t = next;
+    } while( t );
+}
+
 void generic_scheduler::free_nonlocal_small_task( task& t ) {
     __TBB_ASSERT( t.state()==task::freed, NULL );
-    generic_scheduler& s = *static_cast<generic_scheduler*>(t.prefix().origin);
-    __TBB_ASSERT( &s!=this, NULL );
+    generic_scheduler* s = origin_of(t);
+    __TBB_ASSERT( s!=this, NULL );
+    if( s!=my_return_batch_origin ) {
+        flush_return_batch();
+        my_return_batch_origin = s;
+        my_return_batch_tail = &t;
+    }
+    t.prefix().next = my_return_batch;
+    my_return_batch = &t;
+    if( ++my_return_batch_size==return_batch_size )
+        flush_return_batch();
+}
+
+void generic_scheduler::flush_return_batch() {
+    task* first = my_return_batch;
+    if( !first )
+        return;
+    task* last = my_return_batch_tail;
+    intptr_t n = my_return_batch_size;
+    generic_scheduler& s = *my_return_batch_origin;
+    my_return_batch = NULL;
+    my_return_batch_size = 0;
+    my_return_batch_origin = NULL;
     for(;;) {
         task* old = s.return_list;
         if( old==plugged_return_list() ) 
             break;
-        // Atomically insert t at head of s.return_list
-        t.prefix().next = old; 
+        // Atomically insert the batch at head of s.return_list
+        last->prefix().next = old; 
         ITT_NOTIFY( sync_releasing, &s.return_list );
-        if( __TBB_CompareAndSwapW( &s.return_list, (intptr_t)&t, (intptr_t)old )==(intptr_t)old ) {
-            GATHER_STATISTIC(++my_counters.free_list_length);
+        if( __TBB_CompareAndSwapW( &s.return_list, (intptr_t)first, (intptr_t)old )==(intptr_t)old ) {
+            GATHER_STATISTIC(my_counters.free_list_length += n);
+            GATHER_STATISTIC(++my_counters.return_batches);
             return;
         }
     }
-    deallocate_task(t);
-    if( __TBB_FetchAndDecrementWrelease( &s.small_task_count )==1 ) {
-        // We freed the last task allocated by scheduler s, so it's our responsibility
-        // to free the scheduler.
-        NFS_Free( &s );
+#if __TBB_COUNT_TASK_NODES
+    task_node_count -= n;
+#endif /* __TBB_COUNT_TASK_NODES */
+    release_small_tasks( s, n );
+}
+
+bool generic_scheduler::return_orphaned_small_task( task& t ) {
+    generic_scheduler& s = *origin_of(t);
+    t.prefix().state = task::freed;
+    for(;;) {
+        task* old = s.return_list;
+        if( old==plugged_return_list() ) 
+            break;
+        t.prefix().next = old; 
+        ITT_NOTIFY( sync_releasing, &s.return_list );
+        if( __TBB_CompareAndSwapW( &s.return_list, (intptr_t)&t, (intptr_t)old )==(intptr_t)old )
+            return false;
     }
+    release_small_tasks( s, 1 );
+    return true;
+}
+
+intptr_t mail_outbox::drain() {
+    intptr_t k = 0;
+    // No fences here because other threads have already quit.
+    while( task_proxy* t = my_first ) {
+        my_first = t->next_in_mailbox;
+        if( generic_scheduler::return_orphaned_small_task(*t) )
+            ++k;
+    }
+    return k;
 }
 
 task** generic_scheduler::allocate_task_pool( size_t n ) {
@@ -634,6 +748,7 @@ inline task* generic_scheduler::prepare_for_spawning( task* t ) {
 void generic_scheduler::local_spawn( task& first, task*& next ) {
     __TBB_ASSERT( governor::is_set(this), NULL );
     assert_task_pool_valid();
+    RECORD_EVENT( *this, te_spawn, 0 );
     if ( &first.prefix().next == &next ) {
         // Single task is being spawned
         if ( my_arena_slot->tail == task_pool_size ) {
@@ -783,7 +898,7 @@ inline task* generic_scheduler::strip_proxy( task_proxy* tp ) {
 }
 
 #if __TBB_ARENA_PER_MASTER
-void generic_scheduler::local_enqueue( task& t ) {
+void generic_scheduler::local_enqueue( task& t, const tick_count* deadline ) {
     __TBB_ASSERT( governor::is_set(this), NULL );
     __TBB_ASSERT( t.state()==task::allocated, "attempt to enqueue task that is not in 'allocated' state" );
     t.prefix().owner = this;
@@ -800,17 +915,56 @@ void generic_scheduler::local_enqueue( task& t ) {
 #endif /* TBB_USE_ASSERT */
 
     __TBB_ASSERT( my_arena, "thread is not in any arena" );
+    RECORD_EVENT( *this, te_enqueue, 0 );
+    if( deadline ) {
+        my_arena->my_timers.push( &t, *deadline );
+        // Brings a worker that takes the task when due, or sleeps until the deadline
+        my_arena->advertise_new_work< /*Spawned=*/ false >();
+    } else {
+        enqueue_ready_task( t );
+    }
+    assert_task_pool_valid();
+}
+
+void generic_scheduler::enqueue_ready_task( task& t ) {
     ITT_NOTIFY(sync_releasing, &my_arena->my_task_stream);
-    my_arena->my_task_stream.push( &t, my_arena_slot->hint_for_push );
+    my_arena->my_task_stream.push( &t, my_arena_slot->hint_for_push, my_arena_slot->numa_node );
     my_arena->advertise_new_work< /*Spawned=*/ false >();
-    assert_task_pool_valid();
+    // The fence in advertise_new_work orders the push before the check for the keeper
+    my_arena->my_timers.wake_keeper();
 }
 
 inline task* generic_scheduler::dequeue_task() {
-    task* result = NULL;
-    my_arena->my_task_stream.pop(result, my_arena_slot->hint_for_pop);
-    if (result) ITT_NOTIFY(sync_acquired, &my_arena->my_task_stream);
-    return result;
+    stream_item item;
+    item.my_task = NULL;
+    my_arena->my_task_stream.pop(item, my_arena_slot->hint_for_pop, my_arena_slot->numa_node);
+    if (item.my_task) {
+        ITT_NOTIFY(sync_acquired, &my_arena->my_task_stream);
+        RECORD_EVENT( *this, te_dequeue, 0 );
+        GATHER_STATISTIC( my_counters.record_enqueue_latency( (tick_count::now()-item.my_enqueue_time).seconds() ) );
+    }
+    return item.my_task;
+}
+
+inline task* generic_scheduler::dequeue_task_if_due() {
+    unsigned max_tasks = governor::enqueue_fairness_tasks(),
+             max_microseconds = governor::enqueue_fairness_microseconds();
+    if( !(max_tasks|max_microseconds) )
+        return NULL;
+    bool due = max_tasks && ++my_tasks_since_dequeue>=max_tasks;
+    tick_count now;
+    if( max_microseconds ) {
+        now = tick_count::now();
+        due = due || (now-my_last_dequeue_time).seconds()*1E6 >= max_microseconds;
+    }
+    if( !due || (my_arena->my_task_stream.empty() && my_arena->my_timers.empty()) )
+        return NULL;
+    my_tasks_since_dequeue = 0;
+    my_last_dequeue_time = now;
+    task* t = dequeue_timed_task();
+    if( !t ) t = dequeue_task();
+    if( t ) GATHER_STATISTIC( ++my_counters.fair_dequeues );
+    return t;
 }
 #endif /* __TBB_ARENA_PER_MASTER */
 
@@ -1050,6 +1204,8 @@ generic_scheduler* generic_scheduler::create_master( arena& a ) {
     __TBB_ASSERT( s->arena_index == 0, "Master thread must occupy the first slot in its arena" );
     s->attach_mailbox(1);
     a.slot[0].my_scheduler = s;
+    // The master enqueues through dummy_slot while it is out of the arena
+    a.slot[0].numa_node = s->dummy_slot.numa_node = GetCurrentNumaNode();
 #if _WIN32|_WIN64
     __TBB_ASSERT( s->my_market, NULL );
     s->my_market->register_master( s->master_exec_resource );
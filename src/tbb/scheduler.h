@@ -33,6 +33,9 @@
 #include "arena.h"
 #include "mailbox.h"
 #include "tbb_misc.h" // for FastRandom
+#if __TBB_ARENA_PER_MASTER
+#include "tbb/tick_count.h"
+#endif /* __TBB_ARENA_PER_MASTER */
 
 #if __TBB_TASK_GROUP_CONTEXT
 #include "tbb/spin_mutex.h"
@@ -83,6 +86,8 @@ class generic_scheduler: public scheduler, public ::rml::job {
     friend class tbb::task;
 #if __TBB_ARENA_PER_MASTER
     friend class market;
+    friend class tbb::completion_event;
+    friend class tbb::blocking_region;
 #else
     friend class UnpaddedArenaPrefix;
 #endif /* !__TBB_ARENA_PER_MASTER */
@@ -99,8 +104,28 @@ class generic_scheduler: public scheduler, public ::rml::job {
     friend class scheduler;
     template<typename SchedulerTraits> friend class custom_scheduler;
 
+    //! Number of size classes of small tasks.
+    /** A small task of class k takes min_task_slot_size<<k bytes, including its prefix. **/
+    static const size_t num_task_size_classes = 3;
+
+    //! Memory taken by a small task of the smallest class.
+    static const size_t min_task_slot_size = 256;
+
     //! If sizeof(task) is <=quick_task_size, it is handled on a free list instead of malloc'd.
-    static const size_t quick_task_size = 256-task_prefix_reservation_size;
+    static const size_t quick_task_size = min_task_slot_size-task_prefix_reservation_size;
+
+    //! Largest task that is carved from a slab and handled on a free list.
+    static const size_t max_small_task_size = (min_task_slot_size<<(num_task_size_classes-1))-task_prefix_reservation_size;
+
+    //! Size of a slab small tasks are carved from.
+    static const size_t task_slab_size = 16*1024;
+
+    //! Low-order bits of task_prefix::origin of a small task that keep its size class.
+    /** Schedulers are aligned to NFS_MaxLineSize, so these bits of their addresses are zero. **/
+    static const uintptr_t task_size_class_mask = 3;
+
+    //! Number of tasks freed by this thread that are returned to their owner at once.
+    static const intptr_t return_batch_size = 16;
 
     static bool is_version_3_task( task& t ) {
         return (t.prefix().extra_state & 0x0F)>=0x1;
@@ -145,8 +170,33 @@ class generic_scheduler: public scheduler, public ::rml::job {
     //! Random number generator used for picking a random victim from which to steal.
     FastRandom random;
 
-    //! Free list of small tasks that can be reused.
-    task* free_list;
+    //! Free lists of small tasks that can be reused, one per size class.
+    task* free_list[num_task_size_classes];
+
+    //! Unused part of the slab small tasks are carved from.
+    char* my_slab_ptr;
+    char* my_slab_end;
+
+    //! Slabs allocated by this scheduler, linked via their first word.
+    /** The slabs are freed together with the scheduler, when all its small tasks are freed. **/
+    char* my_slabs;
+
+    //! Small tasks freed by this thread that are to be returned to my_return_batch_origin.
+    task* my_return_batch;
+    task* my_return_batch_tail;
+    intptr_t my_return_batch_size;
+    generic_scheduler* my_return_batch_origin;
+
+#if __TBB_ARENA_PER_MASTER
+    //! Number of tasks taken from the local pool since the fairness mode checked the task stream.
+    unsigned my_tasks_since_dequeue;
+
+    //! When the fairness mode checked the task stream last time.
+    tick_count my_last_dequeue_time;
+
+    //! True while the thread is in a blocking region.
+    bool my_in_blocking_region;
+#endif /* __TBB_ARENA_PER_MASTER */
 
     //! Innermost task whose task::execute() is running.
     task* innermost_running_task;
@@ -273,6 +323,20 @@ class generic_scheduler: public scheduler, public ::rml::job {
         The latter case does not mean that the stream is drained, however. **/
     task* dequeue_task();
 
+    //! Get a task from the task stream if the fairness mode requires checking it now.
+    /** See task_scheduler_init::set_enqueue_fairness. Returns NULL in the default mode. **/
+    task* dequeue_task_if_due();
+
+    //! Get a task from the timer queue of the current arena if its deadline has come.
+    task* dequeue_timed_task() {
+        task* t = my_arena->my_timers.pop_due();
+        if( t ) RECORD_EVENT( *this, te_dequeue, 0 );
+        return t;
+    }
+
+    //! Put the task, which is already in ready state, into the task stream of the current arena.
+    void enqueue_ready_task( task& t );
+
 #endif /* __TBB_ARENA_PER_MASTER */
     //! Steal task from another scheduler's ready pool.
     task* steal_task( arena_slot& victim_arena_slot );
@@ -331,7 +395,8 @@ public:
     /*override*/ 
     void enqueue( task& task_, void* reserved );
 
-    void local_enqueue( task& task_ );
+    //! Enqueue the task, or put it into the timer queue if the deadline is not NULL.
+    void local_enqueue( task& task_, const tick_count* deadline = NULL );
 #endif /* __TBB_ARENA_PER_MASTER */
 
     void local_spawn( task& first, task*& next );
@@ -346,6 +411,31 @@ public:
     task& allocate_task( size_t number_of_bytes, 
                        __TBB_CONTEXT_ARG(task* parent, task_group_context* context) );
 
+    //! Size class of a small task of the given size.
+    static size_t task_size_class( size_t number_of_bytes ) {
+        __TBB_ASSERT( number_of_bytes<=max_small_task_size, NULL );
+        size_t k = 0;
+        while( number_of_bytes > (min_task_slot_size<<k)-task_prefix_reservation_size )
+            ++k;
+        return k;
+    }
+
+    //! Scheduler that allocated the task, or NULL if the task is big.
+    static generic_scheduler* origin_of( task& t ) {
+        return static_cast<generic_scheduler*>( (scheduler*)((uintptr_t)t.prefix().origin & ~task_size_class_mask) );
+    }
+
+    //! Size class of a small task.
+    static size_t size_class_of( task& t ) {
+        return (uintptr_t)t.prefix().origin & task_size_class_mask;
+    }
+
+    //! Carve a small task of class k from the slab.
+    task* allocate_small_task( size_t k );
+
+    //! Move tasks returned by other schedulers to the free lists.
+    void take_returned_tasks();
+
     //! Put task on free list.
     /** Does not call destructor. */
     template<free_task_hint h>
@@ -410,8 +500,19 @@ public:
     virtual task* receive_or_steal_task( reference_count&, bool ) = 0; 
 
     //! Free a small task t that that was allocated by a different scheduler 
+    /** The task is returned to its scheduler with a batch of others. **/
     void free_nonlocal_small_task( task& t ); 
 
+    //! Return the batch of tasks freed by this thread to their scheduler.
+    void flush_return_batch();
+
+    //! Return small task t, freed outside of any scheduler, to the scheduler that allocated it.
+    /** Returns true if that scheduler is gone, so the task is not used anymore. **/
+    static bool return_orphaned_small_task( task& t );
+
+    //! Drop n references to s held by its small tasks; the last one frees s and its slabs.
+    static void release_small_tasks( generic_scheduler& s, intptr_t n );
+
 #if __TBB_TASK_GROUP_CONTEXT
     //! Padding isolating thread local members from members that can be written to by other threads.
     char _padding1[NFS_MaxLineSize - sizeof(context_list_node_t)];
@@ -505,6 +606,11 @@ private:
     mutable statistics_counters my_counters;
 #endif /* __TBB_STATISTICS */
 
+#if __TBB_TRACING
+    //! Ring buffer of the traced events of the thread, or NULL if the thread has recorded none
+    trace_buffer* my_trace_buffer;
+#endif /* __TBB_TRACING */
+
 }; // class generic_scheduler
 
 
@@ -513,7 +619,7 @@ void generic_scheduler::free_task( task& t ) {
     GATHER_STATISTIC(--my_counters.active_tasks);
     task_prefix& p = t.prefix();
     // Verify that optimization hints are correct.
-    __TBB_ASSERT( h!=small_local_task || p.origin==this, NULL );
+    __TBB_ASSERT( h!=small_local_task || origin_of(t)==this, NULL );
     __TBB_ASSERT( !(h&small_task) || p.origin, NULL );
 #if TBB_USE_ASSERT
     p.depth = 0xDEADBEEF;
@@ -522,10 +628,11 @@ void generic_scheduler::free_task( task& t ) {
 #endif /* TBB_USE_ASSERT */
     __TBB_ASSERT( 1L<<t.state() & (1L<<task::executing|1L<<task::allocated), NULL );
     p.state = task::freed;
-    if( h==small_local_task || p.origin==this ) {
+    if( h==small_local_task || origin_of(t)==this ) {
         GATHER_STATISTIC(++my_counters.free_list_length);
-        p.next = free_list;
-        free_list = &t;
+        size_t k = size_class_of(t);
+        p.next = free_list[k];
+        free_list[k] = &t;
     } else if( !(h&local_task) && p.origin ) {
         free_nonlocal_small_task(t);
     } else {
@@ -548,8 +655,9 @@ inline void tbb::internal::generic_scheduler::spawn_root_and_wait( task& first,
 }
 
 #if __TBB_ARENA_PER_MASTER
-inline void tbb::internal::generic_scheduler::enqueue( task& task_, void* /*reserved*/ ) {
-    governor::local_scheduler()->local_enqueue( task_ );
+inline void tbb::internal::generic_scheduler::enqueue( task& task_, void* reserved ) {
+    // The reserved argument is used by task::enqueue_at to pass the deadline
+    governor::local_scheduler()->local_enqueue( task_, static_cast<const tick_count*>(reserved) );
 }
 
 #endif /* __TBB_ARENA_PER_MASTER */
@@ -36,6 +36,7 @@
 #endif
 
 #include "tbb_statistics.h"
+#include "tbb_trace.h"
 
 /* Temporarily change "private" to "public" while including "tbb/task.h".
    This hack allows us to avoid publishing internal types and methods
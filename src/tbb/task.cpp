@@ -268,6 +268,37 @@ void task::spawn_and_wait_for_all( task_list& list ) {
     s->local_wait_for_all( *this, t );
 }
 
+#if __TBB_ARENA_PER_MASTER
+void task::enqueue_at( task& t, const tick_count& deadline ) {
+    // The deadline is passed through the reserved argument of scheduler::enqueue
+    t.prefix().owner->enqueue( t, const_cast<tick_count*>(&deadline) );
+}
+
+void task::internal_enqueue_after( task& t, double delay ) {
+    enqueue_at( t, tick_count::now()+tick_count::interval_t(delay) );
+}
+
+//------------------------------------------------------------------------
+// completion_event
+//------------------------------------------------------------------------
+
+void completion_event::internal_construct() {
+    __TBB_ASSERT( my_task->state()==task::allocated, "the task waiting for the event is already spawned" );
+    my_arena = governor::local_scheduler()->my_arena;
+    my_task->increment_ref_count();
+}
+
+void completion_event::internal_fire() {
+    // The task may destroy the event once the reference is released
+    task& t = *my_task;
+    arena* a = static_cast<arena*>(my_arena);
+    if( t.internal_decrement_ref_count()==0 ) {
+        t.prefix().state = task::ready;
+        a->enqueue_task( t );
+    }
+}
+#endif /* __TBB_ARENA_PER_MASTER */
+
 /** Defined out of line so that compiler does not replicate task's vtable. 
     It's pointless to define it inline anyway, because all call sites to it are virtual calls
     that the compiler is unlikely to optimize. */
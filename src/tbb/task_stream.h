@@ -40,6 +40,9 @@
 #include "tbb/tbb_allocator.h"
 #include "scheduler_common.h"
 #include "tbb_misc.h" // for FastRandom
+#if __TBB_STATISTICS
+#include "tbb/tick_count.h"
+#endif /* __TBB_STATISTICS */
 
 namespace tbb {
 namespace internal {
@@ -59,87 +62,247 @@ struct queue_and_mutex {
 };
 
 const uintptr_t one = 1;
+const unsigned bits_per_word = sizeof(uintptr_t) * CHAR_BIT;
 
-inline void set_one_bit( uintptr_t& dest, int pos ) {
-    __TBB_ASSERT( pos>=0, NULL );
-    __TBB_ASSERT( pos<32, NULL );
-    __TBB_AtomicOR( &dest, one<<pos );
+//! Sets bit pos in the bit set that spans an array of words.
+inline void set_one_bit( uintptr_t* dest, unsigned pos ) {
+    __TBB_AtomicOR( dest + pos/bits_per_word, one<<(pos%bits_per_word) );
 }
 
-inline void clear_one_bit( uintptr_t& dest, int pos ) {
-    __TBB_ASSERT( pos>=0, NULL );
-    __TBB_ASSERT( pos<32, NULL );
-    __TBB_AtomicAND( &dest, ~(one<<pos) );
+inline void clear_one_bit( uintptr_t* dest, unsigned pos ) {
+    __TBB_AtomicAND( dest + pos/bits_per_word, ~(one<<(pos%bits_per_word)) );
 }
 
-inline bool is_bit_set( uintptr_t val, int pos ) {
-    __TBB_ASSERT( pos>=0, NULL );
-    __TBB_ASSERT( pos<32, NULL );
-    return (val & (one<<pos)) != 0;
+inline bool is_bit_set( const uintptr_t* val, unsigned pos ) {
+    return (val[pos/bits_per_word] & (one<<(pos%bits_per_word))) != 0;
 }
 
+//! An enqueued task.
+struct stream_item {
+    task* my_task;
+#if __TBB_STATISTICS
+    //! When the task was enqueued, to gather the latency of its execution
+    tick_count my_enqueue_time;
+#endif /* __TBB_STATISTICS */
+};
+
+//! Bounded multi-producer multi-consumer FIFO queue of tasks.
+/** Each cell has a sequence number telling the turn it is ready for: a producer
+    takes a cell when the number equals the push position, a consumer takes it
+    when the number is one more than the pop position. So threads contend only
+    on the CAS of a position and never block each other. **/
+class task_ring {
+public:
+    static const unsigned capacity = 128;
+private:
+    struct cell_t {
+        atomic<uintptr_t> sequence;
+        stream_item item;
+    };
+    atomic<uintptr_t> my_push_pos;
+    char pad1[NFS_MaxLineSize - sizeof(atomic<uintptr_t>)];
+    atomic<uintptr_t> my_pop_pos;
+    char pad2[NFS_MaxLineSize - sizeof(atomic<uintptr_t>)];
+    cell_t my_cells[capacity];
+public:
+    task_ring() {
+        my_push_pos = 0;
+        my_pop_pos = 0;
+        for( unsigned i=0; i<capacity; ++i ) {
+            my_cells[i].sequence = i;
+            my_cells[i].item.my_task = NULL;
+        }
+    }
+    //! Returns false if the ring is full.
+    bool try_push( const stream_item& t ) {
+        uintptr_t pos = my_push_pos;
+        cell_t* c;
+        for( ; ; ) {
+            c = my_cells + pos%capacity;
+            intptr_t diff = intptr_t(c->sequence - pos);
+            if( diff==0 ) {
+                uintptr_t old = my_push_pos.compare_and_swap( pos+1, pos );
+                if( old==pos ) break;
+                pos = old;
+            } else if( diff<0 )
+                return false;
+            else
+                pos = my_push_pos;
+        }
+        c->item = t;
+        c->sequence = pos+1; // release
+        return true;
+    }
+    //! Returns false if the ring is empty, or its first task is not yet completely pushed.
+    bool try_pop( stream_item& t ) {
+        uintptr_t pos = my_pop_pos;
+        cell_t* c;
+        for( ; ; ) {
+            c = my_cells + pos%capacity;
+            intptr_t diff = intptr_t(c->sequence - (pos+1));
+            if( diff==0 ) {
+                uintptr_t old = my_pop_pos.compare_and_swap( pos+1, pos );
+                if( old==pos ) break;
+                pos = old;
+            } else if( diff<0 )
+                return false;
+            else
+                pos = my_pop_pos;
+        }
+        t = c->item;
+        c->sequence = pos+capacity; // release
+        return true;
+    }
+    //! True if no push has been started after the last pop.
+    bool empty() const {
+        return my_push_pos == my_pop_pos;
+    }
+};
+
+//! A lane of task_stream.
+/** Tasks go to the ring; when it is full, they go to the overflow queue,
+    so that push never fails. While the overflow queue is not empty, new tasks
+    go there too, so the tasks in the ring are always older than the tasks in
+    the overflow queue. When the ring runs empty, the overflow queue is moved
+    back into it in order. **/
+struct task_stream_lane {
+    task_ring my_ring;
+    queue_and_mutex<stream_item, spin_mutex> my_overflow;
+    //! Number of tasks in my_overflow, to check it without the lock.
+    atomic<uintptr_t> my_overflow_size;
+
+    task_stream_lane() { my_overflow_size = 0; }
+
+    void push( const stream_item& t ) {
+        if( !my_overflow_size && my_ring.try_push(t) ) return;
+        spin_mutex::scoped_lock lock(my_overflow.my_mutex);
+        my_overflow.my_queue.push_back(t);
+        ++my_overflow_size;
+    }
+    bool try_pop( stream_item& t ) {
+        if( my_ring.try_pop(t) ) return true;
+        if( !my_overflow_size ) return false;
+        spin_mutex::scoped_lock lock;
+        if( !lock.try_acquire(my_overflow.my_mutex) || my_overflow.my_queue.empty() )
+            return false;
+        t = my_overflow.my_queue.front();
+        my_overflow.my_queue.pop_front();
+        // The ring is empty, so the following tasks can go there without passing older ones
+        while( !my_overflow.my_queue.empty() && my_ring.try_push( my_overflow.my_queue.front() ) )
+            my_overflow.my_queue.pop_front();
+        my_overflow_size = my_overflow.my_queue.size();
+        return true;
+    }
+    bool empty() const {
+        return my_ring.empty() && !my_overflow_size;
+    }
+};
+
 //! The container for "fairness-oriented" aka "enqueued" tasks.
+/** Lanes are split in groups, one per NUMA node. A thread pushes to a random
+    lane of the group of its node, and pops from the lanes of its group first,
+    so tasks tend to stay on the node where they were enqueued. **/
 class task_stream {
-    typedef queue_and_mutex <task*, spin_mutex> lane_t;
+    typedef task_stream_lane lane_t;
+    //! Limits the memory of arenas on machines with lots of nodes.
+    static const unsigned max_groups = 64;
+    //! Number of lanes in a group; a power of 2.
+    unsigned lanes_per_group;
+    unsigned num_groups;
     unsigned N;
-    uintptr_t population;
+    //! Bit set of lanes that can be non-empty, of (N+bits_per_word-1)/bits_per_word words.
+    uintptr_t* population;
+    unsigned population_words;
     FastRandom random;
     padded<lane_t>* lanes;
 
-public:
-    task_stream() : N(), population(), random(unsigned(&N-(unsigned*)NULL)), lanes()
-    {
-        __TBB_ASSERT( sizeof(population) * CHAR_BIT >= 32, NULL );
+    //! Index of the first lane of the group of the node.
+    unsigned group_base( unsigned node ) const {
+        return node%num_groups * lanes_per_group;
     }
+    //! Clears the bit of the lane if the lane is empty.
+    void clear_bit_if_empty( unsigned idx ) {
+        lane_t& lane = lanes[idx];
+        if( lane.empty() ) {
+            clear_one_bit( population, idx );
+            // A push could complete in between, and it sets the bit before this check is done.
+            if( !lane.empty() )
+                set_one_bit( population, idx );
+        }
+    }
+    //! Pops from the lane and clears its bit if the lane is empty.
+    /** The bit is cleared after a failed pop as well, as the task of the push
+        that set it may have been taken by the pop that saw the lane empty before. **/
+    bool try_pop_lane( stream_item& dest, unsigned idx ) {
+        bool result = lanes[idx].try_pop(dest);
+        clear_bit_if_empty( idx );
+        return result;
+    }
+
+public:
+    task_stream() : lanes_per_group(), num_groups(), N(), population(), population_words(),
+                    random(unsigned(&N-(unsigned*)NULL)), lanes()
+    {}
 
-    void initialize( unsigned n_lanes ) {
-        N = n_lanes>=32 ? 32 : n_lanes>2 ? 1<<(__TBB_Log2(n_lanes-1)+1) : 2;
-        __TBB_ASSERT( N==32 || N>=n_lanes && ((N-1)&N)==0, "number of lanes miscalculated");
+    void initialize( unsigned n_lanes, unsigned n_nodes ) {
+        num_groups = n_nodes<1 ? 1 : n_nodes>max_groups ? max_groups : n_nodes;
+        unsigned n = (n_lanes+num_groups-1)/num_groups;
+        lanes_per_group = n>2 ? 1<<(__TBB_Log2(n-1)+1) : 2;
+        N = lanes_per_group*num_groups;
+        __TBB_ASSERT( N>=n_lanes && ((lanes_per_group-1)&lanes_per_group)==0, "number of lanes miscalculated");
         lanes = new padded<lane_t>[N];
-        __TBB_ASSERT( !population, NULL );
+        population_words = (N+bits_per_word-1)/bits_per_word;
+        population = new uintptr_t[population_words];
+        for( unsigned i=0; i<population_words; ++i )
+            population[i] = 0;
     }
 
-    ~task_stream() { if (lanes) delete[] lanes; }
+    ~task_stream() {
+        if (lanes) delete[] lanes;
+        if (population) delete[] population;
+    }
 
-    //! Push a task into a lane.
-    void push( task* source, unsigned& last_random ) {
+    //! Push a task into a lane of the group of the node.
+    void push( task* source, unsigned& last_random, unsigned node ) {
         // Lane selection is random. Each thread should keep a separate seed value.
-        unsigned idx;
-        for( ; ; ) {
-            idx = random.get(last_random) & (N-1);
-            spin_mutex::scoped_lock lock;
-            if( lock.try_acquire(lanes[idx].my_mutex) ) {
-                lanes[idx].my_queue.push_back(source);
-                set_one_bit( population, idx );
-                break;
-            }
-        }
+        unsigned idx = group_base(node) + (random.get(last_random) & (lanes_per_group-1));
+        stream_item item;
+        item.my_task = source;
+#if __TBB_STATISTICS
+        item.my_enqueue_time = tick_count::now();
+#endif /* __TBB_STATISTICS */
+        // The bit is set before the push, so that the task is never in a lane without the bit,
+        // and after it, in case a pop that saw the lane empty has cleared the bit meanwhile.
+        set_one_bit( population, idx );
+        lanes[idx].push(item);
+        if( !is_bit_set( population, idx ) )
+            set_one_bit( population, idx );
     }
     //! Try finding and popping a task.
-    /** Does not change destination if unsuccessful. */
-    void pop( task*& dest, unsigned& last_used_lane ) {
-        if( !population ) return; // keeps the hot path shorter
-        // Lane selection is round-robin. Each thread should keep its last used lane.
-        unsigned idx = (last_used_lane+1)&(N-1);
-        for( ; population; idx=(idx+1)&(N-1) ) {
-            if( is_bit_set( population, idx ) ) {
-                lane_t& lane = lanes[idx];
-                spin_mutex::scoped_lock lock;
-                if( lock.try_acquire(lane.my_mutex) && !lane.my_queue.empty() ) {
-                    dest = lane.my_queue.front();
-                    lane.my_queue.pop_front();
-                    if( lane.my_queue.empty() )
-                        clear_one_bit( population, idx );
-                    break;
+    /** Does not change destination if unsuccessful. Makes one pass over the lanes,
+        so it can fail while a concurrent push or pop is in progress; the caller retries. */
+    void pop( stream_item& dest, unsigned& last_used_lane, unsigned node ) {
+        if( empty() ) return; // keeps the hot path shorter
+        // Lane selection is round-robin within a group, and the group of the node goes first.
+        // Each thread should keep its last used lane.
+        unsigned first = group_base(node);
+        for( unsigned g=0; g<num_groups; ++g ) {
+            unsigned base = (first + g*lanes_per_group) % N;
+            for( unsigned i=0; i<lanes_per_group; ++i ) {
+                unsigned idx = base + ((last_used_lane+1+i) & (lanes_per_group-1));
+                if( is_bit_set( population, idx ) && try_pop_lane( dest, idx ) ) {
+                    last_used_lane = idx;
+                    return;
                 }
             }
         }
-        last_used_lane = idx;
     }
 
     //! Checks existence of a task.
     bool empty() {
-        return !population;
+        for( unsigned i=0; i<population_words; ++i )
+            if( population[i] ) return false;
+        return true;
     }
     //! Destroys all remaining tasks in every lane. Returns the number of destroyed tasks.
     /** Tasks are not executed, because it would potentially create more tasks at a late stage.
@@ -147,15 +310,11 @@ public:
     intptr_t drain() {
         intptr_t result = 0;
         for(unsigned i=0; i<N; ++i) {
-            lane_t& lane = lanes[i];
-            spin_mutex::scoped_lock lock(lane.my_mutex);
-            for(lane_t::queue_base_t::iterator it=lane.my_queue.begin();
-                it!=lane.my_queue.end(); ++it, ++result)
-            {
-                task* t = *it;
-                tbb::task::destroy(*t);
+            stream_item item;
+            while( lanes[i].try_pop(item) ) {
+                tbb::task::destroy(*item.my_task);
+                ++result;
             }
-            lane.my_queue.clear();
             clear_one_bit( population, i );
         }
         return result;
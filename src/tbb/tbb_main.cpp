@@ -51,6 +51,10 @@ mutex  governor::theArenaMutex;
 unsigned governor::NumWorkers;
 #endif /* !__TBB_ARENA_PER_MASTER */
 unsigned governor::DefaultNumberOfThreads;
+unsigned governor::NumberOfNumaNodes;
+unsigned governor::EnqueueFairnessTasks;
+unsigned governor::EnqueueFairnessMicroseconds;
+bool governor::LoadAwareMode;
 rml::tbb_factory governor::theRMLServerFactory;
 bool governor::UsePrivateRML;
 
@@ -33,6 +33,7 @@
 #include "tbb_assert_impl.h" // Out-of-line TBB assertion handling routines are instantiated here.
 #include "tbb/tbb_exception.h"
 #include "tbb/tbb_machine.h"
+#include "tbb/task_scheduler_init.h"
 #include "tbb_misc.h"
 #include <cstdio>
 #include <cstdlib>
@@ -152,6 +153,345 @@ bool GetBoolEnvironmentVariable( const char * name ) {
 }
 #endif /* !_XBOX */
 
+#if __linux__
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+int DetectNumberOfNumaNodes() {
+    // The file lists ranges of node numbers, like "0" or "0-3"; the last number is the biggest node.
+    // The online nodes are read, as the possible ones can be many more than the nodes that exist.
+    int biggest = 0;
+    if( FILE* f = fopen( "/sys/devices/system/node/online", "r" ) ) {
+        int c, number = 0;
+        while( (c = fgetc(f))!=EOF ) {
+            if( c>='0' && c<='9' ) {
+                number = number*10 + (c-'0');
+                biggest = number;
+            } else
+                number = 0;
+        }
+        fclose(f);
+    }
+    return biggest+1;
+}
+
+unsigned GetCurrentNumaNode() {
+#if defined(SYS_getcpu)
+    // sched_getcpu does not report the node, so the system call is used directly
+    unsigned cpu, node;
+    if( syscall( SYS_getcpu, &cpu, &node, NULL )==0 )
+        return node;
+#endif
+    return 0;
+}
+//! Finds in proc_cgroup the path of the cgroup for the given v1 controller, or the v2 cgroup if controller is NULL.
+static bool GetCgroupPath( const char* proc_cgroup, const char* controller, char* path, size_t size ) {
+    bool found = false;
+    if( FILE* f = fopen( proc_cgroup, "r" ) ) {
+        // Each line looks like "hierarchy-ID:controller-list:path"; the v2 line is "0::path"
+        char line[1024];
+        while( !found && fgets( line, sizeof(line), f ) ) {
+            char* controllers = strchr( line, ':' );
+            char* cgroup = controllers ? strchr( controllers+1, ':' ) : NULL;
+            if( !cgroup )
+                continue;
+            *controllers++ = 0;
+            *cgroup++ = 0;
+            if( controller ) {
+                // Look for the controller in the comma-separated list
+                size_t len = strlen( controller );
+                for( char* c = controllers; c && !found; c = strchr( c, ',' ), c = c ? c+1 : NULL )
+                    found = strncmp( c, controller, len )==0 && (c[len]==',' || !c[len]);
+            } else
+                found = !*controllers && strcmp( line, "0" )==0;
+            if( found ) {
+                cgroup[strcspn( cgroup, "\n" )] = 0;
+                snprintf( path, size, "%s", cgroup );
+            }
+        }
+        fclose(f);
+    }
+    return found;
+}
+
+//! Reads the quota and the period from the file; the quota is negative if there is no limit.
+static bool ReadCpuQuota( const char* v2_file, const char* v1_quota_file, const char* v1_period_file,
+                          long& quota, long& period ) {
+    bool result = false;
+    if( v2_file ) {
+        // cpu.max contains "max period" or "quota period"
+        if( FILE* f = fopen( v2_file, "r" ) ) {
+            char q[32];
+            if( fscanf( f, "%31s %ld", q, &period )==2 ) {
+                quota = strcmp( q, "max" )==0 ? -1 : atol(q);
+                result = true;
+            }
+            fclose(f);
+        }
+    } else {
+        FILE* fq = fopen( v1_quota_file, "r" );
+        FILE* fp = fopen( v1_period_file, "r" );
+        result = fq && fp && fscanf( fq, "%ld", &quota )==1 && fscanf( fp, "%ld", &period )==1;
+        if( fq ) fclose(fq);
+        if( fp ) fclose(fp);
+    }
+    return result;
+}
+
+int DetectCpuQuota( const char* proc_cgroup, const char* cgroup_root ) {
+    char cgroup[512], file[1024], period_file[1024];
+    long quota = -1, period = 0;
+    bool found = false;
+    // The group's own directory is tried first; inside a cgroup namespace
+    // the hierarchy is mounted at the group itself, so the root is tried next.
+    if( GetCgroupPath( proc_cgroup, NULL, cgroup, sizeof(cgroup) ) ) {
+        static const char* const mounts[] = { "", "/unified" };
+        for( int i=0; i<4 && !found; ++i ) {
+            snprintf( file, sizeof(file), "%s%s%s/cpu.max", cgroup_root, mounts[i/2], i%2 ? "" : cgroup );
+            found = ReadCpuQuota( file, NULL, NULL, quota, period );
+        }
+    }
+    if( !found && GetCgroupPath( proc_cgroup, "cpu", cgroup, sizeof(cgroup) ) ) {
+        static const char* const mounts[] = { "/cpu", "/cpu,cpuacct" };
+        for( int i=0; i<4 && !found; ++i ) {
+            const char* group = i%2 ? "" : cgroup;
+            snprintf( file, sizeof(file), "%s%s%s/cpu.cfs_quota_us", cgroup_root, mounts[i/2], group );
+            snprintf( period_file, sizeof(period_file), "%s%s%s/cpu.cfs_period_us", cgroup_root, mounts[i/2], group );
+            found = ReadCpuQuota( NULL, file, period_file, quota, period );
+        }
+    }
+    if( !found || quota<=0 || period<=0 )
+        return 0;
+    return int( (quota + period - 1) / period );
+}
+
+//! Affinity mask of the process, saved by DetectProcessAffinityMask
+static cpu_set_t ProcessAffinityMask;
+static bool ProcessAffinityMaskSaved;
+
+int DetectProcessAffinityMask() {
+    cpu_set_t mask;
+    CPU_ZERO( &mask );
+    // The mask of the main thread stands for the mask of the process
+    if( sched_getaffinity( getpid(), sizeof(mask), &mask ) )
+        return 0;
+    // Concurrent callers store the same mask
+    ProcessAffinityMask = mask;
+    __TBB_store_with_release( ProcessAffinityMaskSaved, true );
+    return CPU_COUNT( &mask );
+}
+
+void BindToProcessAffinityMask() {
+    if( __TBB_load_with_acquire( ProcessAffinityMaskSaved ) )
+        sched_setaffinity( 0, sizeof(ProcessAffinityMask), &ProcessAffinityMask );
+}
+
+//! Reads a number from a file of the sysfs, or returns -1.
+static int ReadSysfsNumber( const char* format, int n ) {
+    char file[128];
+    snprintf( file, sizeof(file), format, n );
+    int result = -1;
+    if( FILE* f = fopen( file, "r" ) ) {
+        if( fscanf( f, "%d", &result )!=1 )
+            result = -1;
+        fclose(f);
+    }
+    return result;
+}
+
+//! Adds the CPUs listed in the file, like "0-3,8-11", to the mask.
+static void ReadCpuList( const char* file, cpu_set_t& mask ) {
+    if( FILE* f = fopen( file, "r" ) ) {
+        int first, last;
+        while( fscanf( f, "%d", &first )==1 ) {
+            last = first;
+            int c = fgetc(f);
+            if( c=='-' ) {
+                if( fscanf( f, "%d", &last )!=1 )
+                    break;
+                c = fgetc(f);
+            }
+            for( int i=first; i<=last && i<CPU_SETSIZE; ++i )
+                CPU_SET( i, &mask );
+            if( c!=',' )
+                break;
+        }
+        fclose(f);
+    }
+}
+
+//! The maximal number of NUMA nodes the workers are distributed over
+static const int MaxAffinityNodes = 64;
+
+//! Places to bind the workers to, computed by SetWorkerAffinity.
+/** For affinity_numa_round_robin, the places are NUMA nodes with their masks in AffinityNodeMasks;
+    for other policies, the places are CPUs. **/
+static int AffinityPlaces[CPU_SETSIZE];
+static cpu_set_t AffinityNodeMasks[MaxAffinityNodes];
+static int NumAffinityPlaces;
+//! Index of the place taken by the first worker
+static int FirstAffinityPlace;
+//! The policy; affinity_none while the places are being changed
+static int AffinityPolicy;
+
+//! Position of a CPU in the machine, used to order the CPUs for affinity_compact and affinity_scatter
+struct cpu_position {
+    int cpu, package, core, thread, core_rank;
+};
+
+static bool PrecedesCompact( const cpu_position& a, const cpu_position& b ) {
+    if( a.package!=b.package ) return a.package<b.package;
+    if( a.core!=b.core ) return a.core<b.core;
+    return a.cpu<b.cpu;
+}
+
+static bool PrecedesScatter( const cpu_position& a, const cpu_position& b ) {
+    if( a.thread!=b.thread ) return a.thread<b.thread;
+    if( a.core_rank!=b.core_rank ) return a.core_rank<b.core_rank;
+    if( a.package!=b.package ) return a.package<b.package;
+    return a.cpu<b.cpu;
+}
+
+//! Fills AffinityPlaces with the allowed CPUs in the order of the policy.
+static int OrderCpus( const cpu_set_t& allowed, bool compact ) {
+    static cpu_position positions[CPU_SETSIZE];
+    int n = 0;
+    for( int cpu=0; cpu<CPU_SETSIZE; ++cpu )
+        if( CPU_ISSET( cpu, &allowed ) ) {
+            cpu_position& p = positions[n++];
+            p.cpu = cpu;
+            p.package = ReadSysfsNumber( "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu );
+            p.core = ReadSysfsNumber( "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu );
+        }
+    // The thread is the rank of the CPU among the CPUs of its core, and
+    // the core rank is the rank of the core among the cores of its package.
+    for( int i=0; i<n; ++i ) {
+        cpu_position& p = positions[i];
+        p.thread = 0;
+        for( int j=0; j<i; ++j )
+            if( positions[j].package==p.package && positions[j].core==p.core )
+                ++p.thread;
+    }
+    for( int i=0; i<n; ++i ) {
+        cpu_position& p = positions[i];
+        p.core_rank = 0;
+        for( int j=0; j<n; ++j )
+            if( positions[j].package==p.package && positions[j].core<p.core && positions[j].thread==0 )
+                ++p.core_rank;
+    }
+    // Insertion sort is enough, as it is done once
+    for( int i=1; i<n; ++i )
+        for( int j=i; j>0; --j ) {
+            bool swap = compact ? PrecedesCompact( positions[j], positions[j-1] )
+                                : PrecedesScatter( positions[j], positions[j-1] );
+            if( !swap )
+                break;
+            cpu_position t = positions[j]; positions[j] = positions[j-1]; positions[j-1] = t;
+        }
+    for( int i=0; i<n; ++i )
+        AffinityPlaces[i] = positions[i].cpu;
+    return n;
+}
+
+void SetWorkerAffinity( int policy, const int* cpus, size_t num_cpus ) {
+    // Threads being created meanwhile bind to the mask of the process
+    __TBB_store_with_release( AffinityPolicy, int(task_scheduler_init::affinity_none) );
+    if( policy==task_scheduler_init::affinity_none )
+        return;
+    cpu_set_t allowed;
+    CPU_ZERO( &allowed );
+    if( sched_getaffinity( getpid(), sizeof(allowed), &allowed ) )
+        return;
+    int n = 0, first = 0;
+    switch( policy ) {
+    case task_scheduler_init::affinity_compact:
+    case task_scheduler_init::affinity_scatter:
+        n = OrderCpus( allowed, policy==task_scheduler_init::affinity_compact );
+        first = n>1 ? 1 : 0;
+        break;
+    case task_scheduler_init::affinity_numa_round_robin:
+        for( int node=0; node<DetectNumberOfNumaNodes() && n<MaxAffinityNodes; ++node ) {
+            char file[128];
+            snprintf( file, sizeof(file), "/sys/devices/system/node/node%d/cpulist", node );
+            cpu_set_t& mask = AffinityNodeMasks[n];
+            CPU_ZERO( &mask );
+            ReadCpuList( file, mask );
+            CPU_AND( &mask, &mask, &allowed );
+            if( CPU_COUNT( &mask ) )
+                AffinityPlaces[n++] = node;
+        }
+        break;
+    case task_scheduler_init::affinity_cpu_list:
+        for( size_t i=0; i<num_cpus && n<CPU_SETSIZE; ++i )
+            if( cpus[i]>=0 && cpus[i]<CPU_SETSIZE && CPU_ISSET( cpus[i], &allowed ) )
+                AffinityPlaces[n++] = cpus[i];
+        break;
+    }
+    if( !n )
+        return;
+    NumAffinityPlaces = n;
+    FirstAffinityPlace = first;
+    __TBB_store_with_release( AffinityPolicy, policy );
+}
+
+void BindWorkerThread( size_t index ) {
+    int policy = __TBB_load_with_acquire( AffinityPolicy );
+    if( policy==task_scheduler_init::affinity_none ) {
+        BindToProcessAffinityMask();
+        return;
+    }
+    int place = int( (FirstAffinityPlace + index) % NumAffinityPlaces );
+    if( policy==task_scheduler_init::affinity_numa_round_robin ) {
+        sched_setaffinity( 0, sizeof(cpu_set_t), &AffinityNodeMasks[place] );
+    } else {
+        cpu_set_t mask;
+        CPU_ZERO( &mask );
+        CPU_SET( AffinityPlaces[place], &mask );
+        sched_setaffinity( 0, sizeof(mask), &mask );
+    }
+}
+
+int GetBoundCpu() {
+    cpu_set_t mask;
+    CPU_ZERO( &mask );
+    if( sched_getaffinity( 0, sizeof(mask), &mask ) || CPU_COUNT( &mask )!=1 )
+        return -1;
+    for( int cpu=0; cpu<CPU_SETSIZE; ++cpu )
+        if( CPU_ISSET( cpu, &mask ) )
+            return cpu;
+    return -1;
+}
+
+double GetSystemLoad( const char* loadavg ) {
+    double load = -1;
+    if( FILE* f = fopen( loadavg, "r" ) ) {
+        if( fscanf( f, "%lf", &load )!=1 )
+            load = -1;
+        fclose(f);
+    }
+    return load;
+}
+#else /* !__linux__ */
+int DetectNumberOfNumaNodes() { return 1; }
+
+unsigned GetCurrentNumaNode() { return 0; }
+
+int DetectCpuQuota( const char*, const char* ) { return 0; }
+
+int DetectProcessAffinityMask() { return 0; }
+
+void BindToProcessAffinityMask() {}
+
+void SetWorkerAffinity( int, const int*, size_t ) {}
+
+void BindWorkerThread( size_t ) {}
+
+int GetBoundCpu() { return -1; }
+
+double GetSystemLoad( const char* ) { return -1; }
+#endif /* !__linux__ */
+
 #include "tbb_version.h"
 
 /** The leading "\0" is here so that applying "strings" to the binary delivers a clean result. */
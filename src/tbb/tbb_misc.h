@@ -62,6 +62,20 @@ const size_t MByte = 1<<20;
     const size_t ThreadStackSize = 4*MByte;
 #endif
 
+//! Returns the number of CPUs the cgroup CPU quota of the process amounts to, or 0 if there is no quota.
+/** A fractional quota is rounded up. Both cgroup v2 (cpu.max) and v1 (cpu.cfs_quota_us) are recognized.
+    The files are looked up under cgroup_root for the groups listed in proc_cgroup. **/
+int DetectCpuQuota( const char* proc_cgroup = "/proc/self/cgroup", const char* cgroup_root = "/sys/fs/cgroup" );
+
+//! Returns the number of CPUs in the affinity mask of the process, or 0 if it is unknown.
+/** The mask is saved to be used by BindToProcessAffinityMask. **/
+int DetectProcessAffinityMask();
+
+//! Allows the calling thread to run on the CPUs of the saved affinity mask of the process.
+/** Threads created by a master thread inherit its mask, which may be narrower than that of the process.
+    Does nothing if the mask has not been saved. **/
+void BindToProcessAffinityMask();
+
 #if defined(__TBB_DetectNumberOfWorkers) // covers Mac OS* and other platforms
 
 static inline int DetectNumberOfWorkers() {
@@ -132,7 +146,14 @@ static inline int DetectNumberOfWorkers() {
 // In theory, sysconf should work everywhere.
 // But in practice, system-specific methods are more reliable
 #elif defined(__linux__)
-    number_of_workers = get_nprocs();
+    // The process may be allowed to run on a part of the CPUs only
+    number_of_workers = DetectProcessAffinityMask();
+    if( number_of_workers<=0 )
+        number_of_workers = get_nprocs();
+    // The CPU quota limits the process further, even if it may run on all the CPUs
+    int quota = DetectCpuQuota();
+    if( quota>0 && quota<number_of_workers )
+        number_of_workers = quota;
 #else
 #error DetectNumberOfWorkers: Method to detect the number of online CPUs is unknown
 #endif
@@ -153,6 +174,28 @@ void handle_win_error( int error_code );
 //! True if environment variable with given name is set and not 0; otherwise false.
 bool GetBoolEnvironmentVariable( const char * name );
 
+//! Returns the number of NUMA nodes in the system, or 1 if it is unknown.
+int DetectNumberOfNumaNodes();
+
+//! Returns the NUMA node of the CPU the calling thread runs on, or 0 if it is unknown.
+/** The result is a hint only, as the thread can migrate at any moment. **/
+unsigned GetCurrentNumaNode();
+
+//! Returns the system load average over the last minute, or a negative value if it is unknown.
+/** The load is read from loadavg, which has the format of /proc/loadavg. **/
+double GetSystemLoad( const char* loadavg = "/proc/loadavg" );
+
+//! Sets the policy of binding worker threads to CPUs; see task_scheduler_init::affinity_policy.
+/** The places for the workers are computed here, so that binding a new thread does not read the topology. **/
+void SetWorkerAffinity( int policy, const int* cpus, size_t num_cpus );
+
+//! Binds the calling worker thread according to the policy set by SetWorkerAffinity.
+/** Binds the thread to the affinity mask of the process if there is no policy. **/
+void BindWorkerThread( size_t index );
+
+//! Returns the CPU the calling thread is bound to, or -1 if it is not bound to a single CPU.
+int GetBoundCpu();
+
 //! Print TBB version information on stderr
 void PrintVersion();
 
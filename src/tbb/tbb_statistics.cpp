@@ -45,19 +45,20 @@ namespace internal {
 /** The order of this vector elements must correspond to the statistics_counters 
     structure layout. **/
 const char* StatGroupTitles[] = { 
-    "task objects", "tasks executed", "stealing attempts", "task proxies", "arena", "market"
+    "task objects", "tasks executed", "stealing attempts", "task proxies", "arena", "market", "enqueue latency"
 };
 
 //! Human readable titles of statistics elements defined by statistics_counters struct.
 /** The order of this vector elements must correspond to the statistics_counters 
     structure layout (with NULLs interspersed to separate groups). **/
 const char* StatFieldTitles[] = {
-    "active", "freed", "big", NULL,
+    "active", "freed", "big", "reused", "returned", "carved", "slabs", "batches", NULL,
     "total", "w/o spawn", NULL,
     "succeeded", "failed", "conflicts", NULL,
     "mailed", "revoked", "stolen", "bypassed", "ignored", NULL,
     "switches", "roundtrips", NULL,
     "roundtrips", NULL,
+    "fair", "<1us", "<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "<16ms", "<65ms", "<262ms", "<1s", ">=1s", NULL,
 };
 
 //! Class for logging statistics
@@ -103,12 +103,13 @@ enum statistics_groups {
     sg_affinity = 0x08,
     sg_arena = 0x10,
     sg_market = 0x20,
+    sg_enqueue = 0x40,
     // List end marker. Insert new groups only before it.
     sg_end
 };
 
 //! Groups of counters to output
-const uintptr_t __TBB_ActiveStatisticsGroups = sg_task_execution | sg_stealing | sg_affinity | sg_arena | sg_market;
+const uintptr_t __TBB_ActiveStatisticsGroups = sg_task_allocation | sg_task_execution | sg_stealing | sg_affinity | sg_arena | sg_market | sg_enqueue;
 
 //! A set of various statistics counters that are updated by the library on per thread basis.
 /** All the fields must be of the same type (statistics_counters::counter_type).
@@ -116,6 +117,9 @@ const uintptr_t __TBB_ActiveStatisticsGroups = sg_task_execution | sg_stealing |
 struct statistics_counters {
     typedef long counter_type;
 
+    //! Number of buckets in the histogram of enqueued tasks latency
+    static const size_t num_latency_buckets = 12;
+
     // Group: sg_task_allocation
     // Counters in this group can have negative values as the tasks migrate across 
     // threads while the associated counters are updated in the current thread only
@@ -128,6 +132,16 @@ struct statistics_counters {
     //! Number of big tasks allocated during the run
     /** To find total number of tasks malloc'd, compute (big_tasks+small_task_count) */
     counter_type big_tasks;
+    //! Number of small tasks allocated from the free lists
+    counter_type free_list_hits;
+    //! Number of small tasks received back from other threads
+    counter_type returned_tasks;
+    //! Number of small tasks carved from slabs
+    counter_type slab_tasks;
+    //! Number of slabs allocated for small tasks
+    counter_type task_slabs;
+    //! Number of batches of small tasks returned to other threads
+    counter_type return_batches;
     
     // Group: sg_task_execution
 
@@ -168,6 +182,14 @@ struct statistics_counters {
     //! Number of times workers left the market and returned into RML
     counter_type market_roundtrips;
 
+    // Group: sg_enqueue
+
+    //! Number of enqueued tasks taken because the fairness mode required checking the task stream
+    counter_type fair_dequeues;
+    //! Histogram of the time from enqueuing a task to starting its execution
+    /** Bucket i counts latencies below 4^i microseconds; the last bucket counts the rest. **/
+    counter_type enqueue_latency[num_latency_buckets];
+
     // Constructor and helpers
 
     statistics_counters() { reset(); }
@@ -178,6 +200,13 @@ struct statistics_counters {
 
     const counter_type& field ( size_t index ) const { return reinterpret_cast<const counter_type*>(this)[index]; }
 
+    void record_enqueue_latency ( double seconds ) {
+        size_t i = 0;
+        for ( double bound = 1E-6; i < num_latency_buckets - 1 && seconds >= bound; bound *= 4 )
+            ++i;
+        ++enqueue_latency[i];
+    }
+
     static size_t size () { return sizeof(statistics_counters) / sizeof(counter_type); }
 
     const statistics_counters& operator += ( const statistics_counters& rhs ) {
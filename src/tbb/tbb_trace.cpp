@@ -0,0 +1,192 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#include "tbb_trace.h"
+
+#if __TBB_TRACING
+
+#include <cstdio>
+#include "tbb/spin_mutex.h"
+#include "tbb/cache_aligned_allocator.h"
+#include "tbb/tbb_machine.h"
+
+namespace tbb {
+namespace internal {
+
+bool TraceEnabled;
+
+//! Names of the events in the trace, in the order of trace_event_kind.
+static const char* const TraceEventNames[] = {
+    "spawn", "steal attempt", "steal", "mailbox", "enqueue", "dequeue",
+    "active", "active", "arena", "arena"
+};
+
+//! Chrome trace phases of the events: instant, or beginning and end of a duration.
+static const char TraceEventPhases[] = "iiiiiiBEBE";
+
+//! Names of the arguments of the events, or NULL if the argument is not written.
+static const char* const TraceArgumentNames[] = {
+    NULL, "victim", "victim", NULL, NULL, NULL, NULL, NULL, "slot", NULL
+};
+
+//! A recorded event
+struct trace_record {
+    tick_count time;
+    int kind;
+    int arg;
+};
+
+//! The ring buffer of the events of one thread.
+class trace_buffer : no_copy {
+public:
+    //! Number of the events kept; must be a power of two
+    static const size_t capacity = 8192;
+
+    trace_record my_records[capacity];
+    //! Number of the events ever recorded; the last capacity of them are kept
+    size_t my_count;
+    //! Number of the thread in the trace
+    int my_thread_id;
+    //! True while a thread records into the buffer
+    bool my_in_use;
+    //! Next buffer in the list of all buffers
+    trace_buffer* my_next;
+
+    //! Called by the owner thread only.
+    void record( trace_event_kind kind, int arg ) {
+        size_t n = my_count;
+        trace_record& r = my_records[n & (capacity-1)];
+        r.time = tick_count::now();
+        r.kind = kind;
+        r.arg = arg;
+        // Publishes the record to the writers of the trace
+        __TBB_store_with_release( my_count, n+1 );
+    }
+
+    //! Copies the kept events into the array, which must be of the capacity size.
+    /** Can be called concurrently with recording. Returns the number of events
+        copied; the events that could be overwritten while copying are dropped. **/
+    size_t snapshot( trace_record* records, size_t& first ) const {
+        size_t end = __TBB_load_with_acquire( my_count );
+        size_t begin = end>capacity ? end-capacity : 0;
+        for( size_t i=begin; i<end; ++i )
+            records[i & (capacity-1)] = my_records[i & (capacity-1)];
+        // The records copied must be read before the count is read again
+        __TBB_full_memory_fence();
+        size_t new_end = __TBB_load_with_acquire( my_count );
+        // The owner may be overwriting the record at new_end, evicting the one at new_end-capacity
+        if( new_end+1>capacity && new_end+1-capacity>begin )
+            begin = new_end+1-capacity;
+        first = begin;
+        return begin<end ? end-begin : 0;
+    }
+};
+
+//! The list of all buffers; protected by TraceBuffersMutex
+static trace_buffer* TraceBuffers;
+static spin_mutex TraceBuffersMutex;
+//! Number of threads that have recorded events; protected by TraceBuffersMutex
+static int TraceThreadCount;
+//! The moment tracing was turned on first; the timestamps in the trace are relative to it
+static tick_count TraceStartTime;
+
+//! Finds a released buffer or allocates a new one.
+static trace_buffer* acquire_trace_buffer() {
+    spin_mutex::scoped_lock lock( TraceBuffersMutex );
+    trace_buffer* b = TraceBuffers;
+    while( b && b->my_in_use )
+        b = b->my_next;
+    if( !b ) {
+        b = new( NFS_Allocate( sizeof(trace_buffer), 1, NULL ) ) trace_buffer;
+        b->my_next = TraceBuffers;
+        TraceBuffers = b;
+    }
+    // The events of the previous owner are discarded
+    b->my_count = 0;
+    b->my_thread_id = ++TraceThreadCount;
+    b->my_in_use = true;
+    return b;
+}
+
+void record_trace_event( trace_buffer*& buffer, trace_event_kind kind, int arg ) {
+    if( !buffer )
+        buffer = acquire_trace_buffer();
+    buffer->record( kind, arg );
+}
+
+void release_trace_buffer( trace_buffer* buffer ) {
+    if( buffer ) {
+        spin_mutex::scoped_lock lock( TraceBuffersMutex );
+        buffer->my_in_use = false;
+    }
+}
+
+void SetTracing( bool enable ) {
+    if( enable ) {
+        spin_mutex::scoped_lock lock( TraceBuffersMutex );
+        if( !TraceThreadCount )
+            TraceStartTime = tick_count::now();
+    }
+    TraceEnabled = enable;
+}
+
+bool WriteTrace( const char* file_name ) {
+    FILE* f = fopen( file_name, "w" );
+    if( !f )
+        return false;
+    trace_record* records = static_cast<trace_record*>( NFS_Allocate( sizeof(trace_record), trace_buffer::capacity, NULL ) );
+    fputs( "{\"traceEvents\":[", f );
+    const char* separator = "\n";
+    // Holding the lock prevents reuse of the buffers while they are written
+    spin_mutex::scoped_lock lock( TraceBuffersMutex );
+    for( trace_buffer* b = TraceBuffers; b; b = b->my_next ) {
+        size_t first, n = b->snapshot( records, first );
+        for( size_t i=first; i<first+n; ++i ) {
+            const trace_record& r = records[i & (trace_buffer::capacity-1)];
+            __TBB_ASSERT( r.kind>=0 && r.kind<te_end, "corrupted trace record" );
+            fprintf( f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                     separator, TraceEventNames[r.kind], TraceEventPhases[r.kind],
+                     (r.time-TraceStartTime).seconds()*1E6, b->my_thread_id );
+            if( TraceEventPhases[r.kind]=='i' )
+                fputs( ",\"s\":\"t\"", f );
+            if( TraceArgumentNames[r.kind] )
+                fprintf( f, ",\"args\":{\"%s\":%d}", TraceArgumentNames[r.kind], r.arg );
+            fputc( '}', f );
+            separator = ",\n";
+        }
+    }
+    lock.release();
+    fputs( "\n]}\n", f );
+    NFS_Free( records );
+    return fclose(f)==0;
+}
+
+} // namespace internal
+} // namespace tbb
+
+#endif /* __TBB_TRACING */
@@ -0,0 +1,122 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#ifndef _TBB_tbb_trace_H
+#define _TBB_tbb_trace_H
+
+/**
+    This file defines the tracing of the task scheduler events.
+
+    When tracing is turned on by task_scheduler_init::set_tracing, each thread
+    records its scheduler events with timestamps into its own ring buffer. Only
+    the owner thread writes into a buffer, so recording takes no locks. When a
+    buffer is full, the oldest events are overwritten. The buffers are written
+    out by task_scheduler_init::write_trace in the Chrome trace format (JSON),
+    which can be viewed by chrome://tracing or Perfetto.
+
+    When tracing is compiled in but turned off, recording an event costs a check
+    of a global flag. Set __TBB_TRACING to 0 to compile the tracing out.
+
+    To add new event:
+    1) Insert it into trace_event_kind before te_end;
+    2) Insert its name and Chrome trace phase into TraceEventNames and
+       TraceEventPhases (preserving the order of the events).
+**/
+
+#include "tbb/tbb_stddef.h"
+
+#ifndef __TBB_TRACING
+#define __TBB_TRACING 1
+#endif /* __TBB_TRACING */
+
+#if __TBB_TRACING
+
+#include "tbb/tick_count.h"
+
+namespace tbb {
+namespace internal {
+
+//! Kinds of the recorded events.
+enum trace_event_kind {
+    //! Tasks were put into the task pool of the thread
+    te_spawn,
+    //! The thread tried to steal a task; the argument is the slot of the victim
+    te_steal_attempt,
+    //! The thread stole a task; the argument is the slot of the victim
+    te_steal,
+    //! The thread took a task from its mailbox
+    te_mailbox,
+    //! A task was enqueued into the arena
+    te_enqueue,
+    //! The thread took an enqueued task
+    te_dequeue,
+    //! The worker came from the thread pool to serve arenas
+    te_wake,
+    //! The worker returned to the thread pool
+    te_sleep,
+    //! The worker joined an arena; the argument is its slot
+    te_arena_join,
+    //! The worker left the arena
+    te_arena_leave,
+    // List end marker. Insert new events only before it.
+    te_end
+};
+
+class trace_buffer;
+
+//! True if the events are recorded.
+/** Checked on every event, so it is not wrapped into an atomic. **/
+extern bool TraceEnabled;
+
+//! Records the event into the buffer; allocates the buffer if it is NULL.
+void record_trace_event( trace_buffer*& buffer, trace_event_kind kind, int arg );
+
+//! Makes the buffer available for reuse by another thread.
+/** The events remain available for writing until the buffer is reused. **/
+void release_trace_buffer( trace_buffer* buffer );
+
+//! Turns recording of the events on or off.
+void SetTracing( bool enable );
+
+//! Writes the events kept in the buffers into the file in the Chrome trace format.
+/** Returns false if the file cannot be written. **/
+bool WriteTrace( const char* file_name );
+
+} // namespace internal
+} // namespace tbb
+
+//! Records the event of the scheduler s if tracing is on.
+#define RECORD_EVENT(s,kind,arg) (tbb::internal::TraceEnabled ? tbb::internal::record_trace_event( (s).my_trace_buffer, tbb::internal::kind, arg ) : (void)0)
+
+#else /* !__TBB_TRACING */
+
+#define RECORD_EVENT(s,kind,arg) ((void)0)
+
+#endif /* !__TBB_TRACING */
+
+#endif /* _TBB_tbb_trace_H */
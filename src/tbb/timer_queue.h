@@ -0,0 +1,173 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#ifndef _TBB_timer_queue_H
+#define _TBB_timer_queue_H
+
+#include "tbb/tbb_stddef.h"
+
+#if __TBB_ARENA_PER_MASTER
+
+#include <vector>
+#include <algorithm>
+#include "tbb/atomic.h"
+#include "tbb/mutex.h"
+#include "tbb/tick_count.h"
+#include "tbb/tbb_allocator.h"
+#include "tbb/compat/condition_variable"
+
+namespace tbb {
+namespace internal {
+
+//! The tasks enqueued with a deadline, waiting for it to come.
+/** The tasks are kept in a binary heap ordered by deadline. Threads that look
+    for work take the tasks whose deadline has come. When the arena runs out
+    of work, one worker (the keeper) sleeps until the earliest deadline instead
+    of leaving the arena; it is woken up earlier if a task with an earlier
+    deadline or a task without deadline is enqueued, if tasks are spawned in
+    the arena, or if the market takes workers away from the arena. **/
+class timer_queue : no_copy {
+    struct timer_item {
+        tick_count my_deadline;
+        task* my_task;
+    };
+
+    //! Orders the heap so that the earliest deadline is at the front.
+    struct later_deadline {
+        bool operator()( const timer_item& a, const timer_item& b ) const {
+            return (a.my_deadline-b.my_deadline).seconds() > 0;
+        }
+    };
+
+    typedef std::vector< timer_item, tbb_allocator<timer_item> > heap_type;
+    typedef interface5::unique_lock<mutex> lock_type;
+
+    heap_type my_heap;
+
+    //! Number of tasks in the heap. Allows to check for emptiness without locking.
+    atomic<size_t> my_size;
+
+    //! True while the keeper sleeps. Read without locking by threads enqueuing tasks.
+    atomic<bool> my_keeper_sleeps;
+
+    //! Protects the heap and serializes sleeping of the keeper.
+    mutex my_mutex;
+
+    //! Wakes up the keeper.
+    interface5::condition_variable my_wakeup;
+
+    //! True if the earliest deadline has come. Must be called under my_mutex.
+    bool front_is_due() const {
+        return (my_heap.front().my_deadline-tick_count::now()).seconds() <= 0;
+    }
+
+    //! Removes the task with the earliest deadline. Must be called under my_mutex.
+    task* pop_front() {
+        task* result = my_heap.front().my_task;
+        std::pop_heap( my_heap.begin(), my_heap.end(), later_deadline() );
+        my_heap.pop_back();
+        my_size = my_heap.size();
+        return result;
+    }
+
+public:
+    timer_queue() {
+        my_size = 0;
+        my_keeper_sleeps = false;
+    }
+
+    bool empty() const { return !my_size; }
+
+    //! Puts the task to wait for the deadline.
+    void push( task* t, tick_count deadline ) {
+        lock_type lock( my_mutex );
+        timer_item item;
+        item.my_deadline = deadline;
+        item.my_task = t;
+        my_heap.push_back( item );
+        std::push_heap( my_heap.begin(), my_heap.end(), later_deadline() );
+        my_size = my_heap.size();
+        // The keeper sleeps until the previous earliest deadline
+        if( my_keeper_sleeps && my_heap.front().my_task==t )
+            my_wakeup.notify_one();
+    }
+
+    //! Returns a task whose deadline has come, or NULL.
+    /** Does not wait for the lock, so that busy threads do not queue up here. **/
+    task* pop_due() {
+        if( empty() )
+            return NULL;
+        lock_type lock( my_mutex, interface5::try_to_lock );
+        if( !lock || my_heap.empty() || !front_is_due() )
+            return NULL;
+        return pop_front();
+    }
+
+    //! Sleeps until the earliest deadline, and returns the task.
+    /** Returns NULL without sleeping if there are no tasks, or another thread already sleeps.
+        Returns NULL as well if the arena gets other work while sleeping, as told by
+        owner.keeper_has_work(), which must not take locks. **/
+    template<typename Owner>
+    task* sleep_until_due( Owner& owner ) {
+        if( empty() )
+            return NULL;
+        lock_type lock( my_mutex );
+        if( my_keeper_sleeps )
+            return NULL;
+        my_keeper_sleeps = true;
+        // Pairs with the fences in arena::advertise_new_work and market::update_allotment,
+        // which precede wake_keeper
+        __TBB_full_memory_fence();
+        task* result = NULL;
+        while( !my_heap.empty() && !owner.keeper_has_work() ) {
+            tick_count::interval_t remaining = my_heap.front().my_deadline-tick_count::now();
+            if( remaining.seconds() <= 0 ) {
+                result = pop_front();
+                break;
+            }
+            my_wakeup.wait_for( lock, remaining );
+        }
+        my_keeper_sleeps = false;
+        return result;
+    }
+
+    //! Wakes up the keeper to check whether the arena has other work for it.
+    void wake_keeper() {
+        if( my_keeper_sleeps ) {
+            lock_type lock( my_mutex );
+            my_wakeup.notify_one();
+        }
+    }
+}; // class timer_queue
+
+} // namespace internal
+} // namespace tbb
+
+#endif /* __TBB_ARENA_PER_MASTER */
+
+#endif /* _TBB_timer_queue_H */
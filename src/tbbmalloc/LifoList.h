@@ -48,6 +48,8 @@ public:
     inline void push(void** ptr);
     inline void* pop(void);
     inline void pushList(void **head, void **tail);
+    inline void* grab(void);
+    bool isEmpty() const { return !top; }
 
 private:
     void * top;
@@ -97,6 +99,20 @@ done:
     return result;
 }
 
+/* Takes the whole list at once, the elements stay linked */
+void * LifoList::grab( )
+{
+    void *result=NULL;
+    if (!top) goto done;
+    {
+        MallocMutex::scoped_lock scoped_cs(lock);
+        result = top;
+        top = NULL;
+    }
+done:
+    return result;
+}
+
 #endif /* FINE_GRAIN_LOCKS     */
 
 } // namespace internal
@@ -29,6 +29,12 @@
 #ifndef _itt_shared_malloc_MapMemory_H
 #define _itt_shared_malloc_MapMemory_H
 
+enum PageType {
+    REGULAR = 0,
+    PREALLOCATED_HUGE_PAGE,
+    TRANSPARENT_HUGE_PAGE
+};
+
 #if __linux__ || __APPLE__ || __sun || __FreeBSD__
 
 #if __sun && !defined(_XPG4_2)
@@ -45,28 +51,148 @@
 #endif
 
 #define MEMORY_MAPPING_USES_MALLOC 0
-void* MapMemory (size_t bytes)
+
+#if __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/syscall.h>
+#endif
+
+static inline void* mmapAnonymous(size_t bytes, int extraFlags)
 {
     void* result = 0;
 #ifndef MAP_ANONYMOUS
 // Mac OS* X defines MAP_ANON, which is deprecated in Linux.
 #define MAP_ANONYMOUS MAP_ANON
 #endif /* MAP_ANONYMOUS */
-    result = mmap(result, bytes, (PROT_READ | PROT_WRITE), MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    result = mmap(result, bytes, (PROT_READ | PROT_WRITE), MAP_PRIVATE|MAP_ANONYMOUS|extraFlags, -1, 0);
     return result==MAP_FAILED? 0: result;
 }
 
+/* Over-maps by alignment and cuts off the unaligned ends. */
+static void* mmapAligned(size_t bytes, size_t alignment)
+{
+    void *unaligned = mmapAnonymous(bytes+alignment, 0);
+    if (!unaligned) return 0;
+    void *result = alignUp(unaligned, alignment);
+    size_t head = (uintptr_t)result - (uintptr_t)unaligned;
+    if (head)
+        munmap(unaligned, head);
+    if (alignment-head)
+        munmap((char*)result+bytes, alignment-head);
+    return result;
+}
+
+void* MapMemoryAligned (size_t bytes, size_t alignment)
+{
+    return mmapAligned(bytes, alignment);
+}
+
+void* MapMemory (size_t bytes, PageType pageType = REGULAR)
+{
+    if (pageType == REGULAR)
+        return mmapAnonymous(bytes, 0);
+#if __linux__
+    MALLOC_ASSERT( isAligned(bytes, hugePageSize), ASSERT_TEXT );
+    if (pageType == PREALLOCATED_HUGE_PAGE) {
+#ifdef MAP_HUGETLB
+        // the kernel aligns such mappings to the huge page size itself
+        return mmapAnonymous(bytes, MAP_HUGETLB);
+#else
+        return 0;
+#endif
+    }
+    // transparent huge pages are used only for huge page aligned ranges
+    void *result = mmapAligned(bytes, hugePageSize);
+    if (!result) return 0;
+#ifdef MADV_HUGEPAGE
+    madvise(result, bytes, MADV_HUGEPAGE);
+#endif
+    return result;
+#else
+    return 0;
+#endif /* __linux__ */
+}
+
 int UnmapMemory(void *area, size_t bytes)
 {
     return munmap(area, bytes);
 }
 
+#if __linux__ && defined(MREMAP_MAYMOVE)
+#define MEMORY_REMAP_SUPPORTED 1
+/* Resizes the mapping, it can be moved without copying the data. */
+void* RemapMemory(void *area, size_t oldBytes, size_t newBytes)
+{
+    void *result = mremap(area, oldBytes, newBytes, MREMAP_MAYMOVE);
+    return result==MAP_FAILED? 0: result;
+}
+#endif
+
+#if __linux__ && defined(SYS_mbind)
+#define MEMORY_NODE_BINDING_SUPPORTED 1
+/* Physical pages of the range are to be taken from the NUMA node while it has
+   free memory. The system call is used directly to not depend on libnuma. */
+bool BindMemoryToNode(void *area, size_t bytes, unsigned node)
+{
+    const int mpolPreferred = 1; // MPOL_PREFERRED from numaif.h
+    const unsigned bitsPerLong = 8*sizeof(unsigned long);
+    unsigned long nodeMask[64/bitsPerLong];
+    const unsigned maxNode = 8*sizeof(nodeMask);
+
+    // the kernel uses maxNode-1 bits of the mask
+    if (node >= maxNode-1) return false;
+    memset(nodeMask, 0, sizeof(nodeMask));
+    nodeMask[node/bitsPerLong] = 1UL << node%bitsPerLong;
+    return !syscall(SYS_mbind, area, bytes, mpolPreferred, nodeMask, maxNode, 0);
+}
+#endif
+
+#if __linux__
+/* Reads a small system file into buf without calling malloc,
+   as it is used during the allocator initialization. */
+static size_t readSystemFile(const char *name, char *buf, size_t bufSize)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t len = read(fd, buf, bufSize-1);
+    close(fd);
+    if (len < 0) len = 0;
+    buf[len] = 0;
+    return len;
+}
+
+//! Checks whether transparent and preallocated (hugetlbfs) huge pages are available
+static void detectHugePages(bool *transparent, bool *preallocated)
+{
+    char buf[4096];
+
+    *transparent = false;
+    if (readSystemFile("/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf)))
+        *transparent = strstr(buf, "[always]") || strstr(buf, "[madvise]");
+
+    *preallocated = false;
+    if (readSystemFile("/proc/meminfo", buf, sizeof(buf))) {
+        if (const char *total = strstr(buf, "HugePages_Total:"))
+            *preallocated = strtol(total+sizeof("HugePages_Total:")-1, NULL, 10) > 0;
+    }
+}
+#else
+static void detectHugePages(bool *transparent, bool *preallocated)
+{
+    *transparent = *preallocated = false;
+}
+#endif /* __linux__ */
+
 #elif _WIN32 || _WIN64
 #include <windows.h>
 
 #define MEMORY_MAPPING_USES_MALLOC 0
-void* MapMemory (size_t bytes)
+void* MapMemory (size_t bytes, PageType pageType = REGULAR)
 {
+    // large pages require the "lock pages in memory" privilege, not supported for now
+    if (pageType != REGULAR) return NULL;
     /* Is VirtualAlloc thread safe? */
     return VirtualAlloc(NULL, bytes, (MEM_RESERVE | MEM_COMMIT | MEM_TOP_DOWN), PAGE_READWRITE);
 }
@@ -77,12 +203,33 @@ int UnmapMemory(void *area, size_t bytes)
     return !result;
 }
 
+void* MapMemoryAligned (size_t bytes, size_t alignment)
+{
+    /* A range can be released only as a whole, so find a suitable address by
+       reserving a bigger range and then map at the aligned address within it.
+       Another thread can take the address in between, so retry in this case. */
+    for (;;) {
+        void *range = VirtualAlloc(NULL, bytes+alignment, MEM_RESERVE, PAGE_NOACCESS);
+        if (!range) return NULL;
+        void *result = alignUp(range, alignment);
+        VirtualFree(range, 0, MEM_RELEASE);
+        if (result == VirtualAlloc(result, bytes, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE))
+            return result;
+    }
+}
+
+static void detectHugePages(bool *transparent, bool *preallocated)
+{
+    *transparent = *preallocated = false;
+}
+
 #else
 #include <stdlib.h>
 
 #define MEMORY_MAPPING_USES_MALLOC 1
-void* MapMemory (size_t bytes)
+void* MapMemory (size_t bytes, PageType pageType = REGULAR)
 {
+    if (pageType != REGULAR) return NULL;
     return malloc( bytes );
 }
 
@@ -92,8 +239,28 @@ int UnmapMemory(void *area, size_t bytes)
     return 0;
 }
 
+/* The result can't be passed to UnmapMemory, so memory obtained this way
+   is never returned. */
+void* MapMemoryAligned (size_t bytes, size_t alignment)
+{
+    void *unaligned = malloc( bytes+alignment );
+    return unaligned? alignUp(unaligned, alignment) : NULL;
+}
+
+static void detectHugePages(bool *transparent, bool *preallocated)
+{
+    *transparent = *preallocated = false;
+}
+
 #endif /* OS dependent */
 
+#ifndef MEMORY_REMAP_SUPPORTED
+#define MEMORY_REMAP_SUPPORTED 0
+#endif
+#ifndef MEMORY_NODE_BINDING_SUPPORTED
+#define MEMORY_NODE_BINDING_SUPPORTED 0
+#endif
+
 #if MALLOC_CHECK_RECURSION && MEMORY_MAPPING_USES_MALLOC
 #error Impossible to protect against malloc recursion when memory mapping uses malloc.
 #endif
@@ -27,7 +27,7 @@
 */
 
 #define MAX_THREADS 1024
-#define NUM_OF_BINS 30
+#define NUM_OF_BINS 54
 #define ThreadCommonCounters NUM_OF_BINS
 
 enum counter_type {
@@ -51,8 +51,10 @@ enum common_counter_type {
     allocCachedLargeObj,
     cacheLargeObj,
     freeLargeObj,
+    reallocLargeObj,
     lockPublicFreeList,
-    freeToOtherThread
+    freeToOtherThread,
+    allocRemoteNodeBlock
 };
 
 #if COLLECT_STATISTICS
@@ -128,8 +130,34 @@ static inline void STAT_print(int thread)
     fprintf(outfile, ": allocCachedLargeObject %5d", ctrs.counter[allocCachedLargeObj]);
     fprintf(outfile, ", cacheLargeObject %5d", ctrs.counter[cacheLargeObj]);
     fprintf(outfile, ", freeLargeObject %5d", ctrs.counter[freeLargeObj]);
+    fprintf(outfile, ", reallocLargeObject %5d", ctrs.counter[reallocLargeObj]);
     fprintf(outfile, ", lockPublicFreeList %5d", ctrs.counter[lockPublicFreeList]);
     fprintf(outfile, ", freeToOtherThread %10d", ctrs.counter[freeToOtherThread]);
+    fprintf(outfile, ", allocRemoteNodeBlock %5d", ctrs.counter[allocRemoteNodeBlock]);
+    fprintf(outfile, "\n");
+
+    fclose(outfile);
+#endif
+}
+
+/* Process-wide counters are maintained regardless of COLLECT_STATISTICS,
+   only their reporting depends on it. */
+static inline void STAT_printProcess(uintptr_t hugePagesCurrent, uintptr_t hugePagesTotal)
+{
+#if COLLECT_STATISTICS
+    if (!reportAllocationStatistics)
+        return;
+
+    char filename[100];
+#if USE_PTHREAD
+    sprintf(filename, "stat_ScalableMalloc_proc%04d.log", getpid());
+#else
+    sprintf(filename, "stat_ScalableMalloc_proc.log");
+#endif
+    FILE* outfile = fopen(filename, "w");
+    fprintf(outfile, "Process counters");
+    fprintf(outfile, ": hugePagesBackedBytes %10lu", (unsigned long)hugePagesCurrent);
+    fprintf(outfile, ", hugePagesBackedTotal %10lu", (unsigned long)hugePagesTotal);
     fprintf(outfile, "\n");
 
     fclose(outfile);
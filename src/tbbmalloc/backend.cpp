@@ -26,15 +26,14 @@
     the GNU General Public License.
 */
 
-// intrin.h available since VS2005
-#if defined(_MSC_VER) && _MSC_VER >= 1400
-#define __TBB_HAS_INTRIN_H 1
+/* sched_getcpu is available since glibc 2.6 */
+#if __linux__ && defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC__ == 2 && __GLIBC_MINOR__ >= 6)
+#define USE_SCHED_GETCPU 1
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #else
-#define __TBB_HAS_INTRIN_H 0
-#endif
-
-#if __TBB_HAS_INTRIN_H
-#include <intrin.h>   /* for __cpuid */
+#define USE_SCHED_GETCPU 0
 #endif
 
 #include "tbbmalloc_internal.h"
@@ -82,11 +81,14 @@ void* getRawMemory (size_t size, bool useMapMem = false)
 #else
     object = malloc(size);
 #endif /* MALLOC_CHECK_RECURSION */
+    if (object)
+        rawMemoryUsage.add(size);
     return object;
 }
 
 void freeRawMemory (void *object, size_t size, bool useMapMem)
 {
+    rawMemoryUsage.sub(size);
     if (useMapMem)
         UnmapMemory(object, size);
     else
@@ -104,167 +106,403 @@ void freeRawMemory (void *object, size_t size, bool useMapMem)
 
 #else /* USE_MALLOC_FOR_LARGE_OBJECT */
 
-void* getRawMemory (size_t size, bool = false) { return MapMemory(size); }
+void* getRawMemory (size_t size, bool = false)
+{
+    void *object = MapMemory(size);
+    if (object)
+        rawMemoryUsage.add(size);
+    return object;
+}
 
-void freeRawMemory (void *object, size_t size, bool) {
+void freeRawMemory (void *object, size_t size, bool)
+{
+    rawMemoryUsage.sub(size);
     UnmapMemory(object, size);
 }
 
 #endif /* USE_MALLOC_FOR_LARGE_OBJECT */
 
-/********* End memory acquisition code ********************************/
+#if USE_MALLOC_FOR_LARGE_OBJECT && MEMORY_REMAP_SUPPORTED
+/* Bigger objects are worth to be grown without copying, and for them
+   the cost of mapping is small relative to the cost of use. */
+const size_t minRemappableObjectSize = 1024*1024;
+#else
+const size_t minRemappableObjectSize = ~(size_t)0;
+#endif
 
-static unsigned int getCPUid()
+/* Returns NULL if the memory can't be remapped, it is left untouched then. */
+void* remapRawMemory (void *object, size_t oldSize, size_t newSize)
 {
-    unsigned int id;
-
-#if (__ARCH_x86_32||__ARCH_x86_64) && (__linux__||__APPLE__||__FreeBSD__||__sun||__MINGW32__)
-    int res;
- #if __ARCH_x86_32
-    /* EBX used for PIC support. Having EAX in output operands 
-       prevents ICC from crash like in __TBB_ICC_ASM_VOLATILE_BROKEN. */
-    int _eax, _ecx, _edx;
-    __asm__ ("xchgl %%ebx, %1\n\t"
-             "cpuid\n\t"
-             "xchgl %%ebx, %1\n\t"
-             : "=a" (_eax), "=r" (res)
-             : "a" (1) : "ecx", "edx");
- #else
-    __asm__ ("cpuid\n\t"
-             : "=b" (res)
-             : "a" (1) );
- #endif // __ARCH_x86_32
-    id = (res >> 24) & 0xff;
-#elif _WIN32 || _WIN64
- #if __TBB_HAS_INTRIN_H
-    int CPUInfo[4];
-    __cpuid(CPUInfo, 1);
-    id = (CPUInfo[1] >> 24) & 0xff;
- #else
-    int res;
-    _asm {
-        push ebx
-        push ecx
-        mov  eax,1
-        cpuid
-        mov  res,ebx
-        pop  ecx
-        pop  ebx
+#if MEMORY_REMAP_SUPPORTED
+    void *result = RemapMemory(object, oldSize, newSize);
+    if (result) {
+        rawMemoryUsage.add(newSize);
+        rawMemoryUsage.sub(oldSize);
     }
-    id = (res >> 24) & 0xff;
- #endif
-# else
-    id = getThreadId();
+    return result;
+#else
+    return NULL;
 #endif
-    return id;
 }
 
+RawMemoryUsage rawMemoryUsage;
+HugePagesStatus hugePages;
+
+void HugePagesStatus::init()
+{
+    detectHugePages(&transparent, &preallocated);
+    // scalable_allocation_mode can override it later
+    const char *env = getenv("TBB_MALLOC_USE_HUGE_PAGES");
+    requested = env && 0 != strcmp(env, "0");
+}
+
+void* getHugeRawMemory (size_t size)
+{
+    MALLOC_ASSERT( isAligned(size, hugePageSize), ASSERT_TEXT );
+    void *object = NULL;
+
+    if (hugePages.preallocated)
+        object = MapMemory(size, PREALLOCATED_HUGE_PAGE);
+    // the pool of preallocated pages can be exhausted, fall back to transparent ones
+    if (!object && hugePages.transparent)
+        object = MapMemory(size, TRANSPARENT_HUGE_PAGE);
+    if (object) {
+        AtomicAdd(hugePages.currentBytes, size);
+        AtomicAdd(hugePages.totalBytes, size);
+        rawMemoryUsage.add(size);
+    }
+    return object;
+}
+
+void freeHugeRawMemory (void *object, size_t size)
+{
+    AtomicAdd(hugePages.currentBytes, -size);
+    rawMemoryUsage.sub(size);
+    UnmapMemory(object, size);
+}
+
+/* Regions must be aligned to their size, see BackendRegion. */
+static void* getRegionMemory (size_t size)
+{
+    void *region = MapMemoryAligned(size, size);
+    if (region)
+        rawMemoryUsage.add(size);
+    return region;
+}
+
+static void freeRegionMemory (void *region, size_t size)
+{
+    rawMemoryUsage.sub(size);
+    UnmapMemory(region, size);
+}
+
+/********* End memory acquisition code ********************************/
+
+/*
+ * To decrease contention for free blocks, they are cached per CPU, so threads
+ * running on different CPUs take and return blocks without sharing a lock.
+ * A CPU cache is short; its excess, as well as blocks of new regions and
+ * blocks released by thread pools, goes to the pool of the CPU's NUMA node.
+ * Blocks of other nodes are used only when the node has no free blocks.
+ */
+const unsigned maxCPUBlockCaches = 128; // CPUs with bigger numbers share caches
+const unsigned maxNUMANodes = 16;       // nodes with bigger numbers share pools
 
-/* 
- * To decrease contention for free blocks, free blocks are split, and access
- * to them is based on process number.
+/*
+ * LIFO list of runs of free blocks, holds at most CAPACITY runs.
+ * Assumes zero initialization, like LifoList.
  */
-const int numOfFreeBlockLists = 4;
+class CPUBlockCache {
+public:
+    static const unsigned CAPACITY = 4;
+private:
+    void       **top;
+    unsigned     count;
+    MallocMutex  lock;
+public:
+    // false if the cache is full
+    bool push(void **ptr) {
+        MallocMutex::scoped_lock scoped_cs(lock);
+        if (count == CAPACITY)
+            return false;
+        *ptr = top;
+        top = ptr;
+        count++;
+        return true;
+    }
+    void *pop() {
+        void **result = NULL;
+        if (!top) return NULL;
+        {
+            MallocMutex::scoped_lock scoped_cs(lock);
+            if (!top) return NULL;
+            result = top;
+            top = (void**)*result;
+            count--;
+        }
+        *result = NULL;
+        return result;
+    }
+    // takes the whole list at once, the elements stay linked
+    void *grab() {
+        void *result = NULL;
+        if (!top) return NULL;
+        {
+            MallocMutex::scoped_lock scoped_cs(lock);
+            result = top;
+            top = NULL;
+            count = 0;
+        }
+        return result;
+    }
+    bool isEmpty() const { return !top; }
+};
+
+// a cache line per CPU cache to avoid false sharing
+static struct {
+    CPUBlockCache cache;
+    char          pad[128-sizeof(CPUBlockCache)];
+} cpuBlockCache[maxCPUBlockCaches];
+
+static LifoList nodeBlockPool[maxNUMANodes];
+
+/* NUMA node plus 1 of a CPU cache; 0 while the node is not known */
+static unsigned char cpuCacheNode[maxCPUBlockCaches];
+/* caches with greater or equal indices were never used */
+static intptr_t cpuCachesInUse;
+
+/* Regions are bound to the node of the thread that mapped them, once CPUs
+   of more than one node are seen. Binding is given up if the system does not
+   allow it or node numbers do not fit, as pool index is not the node then. */
+static bool multipleNodesSeen;
+static bool nodeBindingOff;
+
+/* Returns the index actually registered, as it can differ from idx
+   when the thread migrates to another CPU. */
+static unsigned registerCPUBlockCache(unsigned idx)
+{
+    unsigned node = 0;
+#if USE_SCHED_GETCPU && defined(SYS_getcpu)
+    unsigned cpu, cpuNode;
+    // sched_getcpu does not report the node; done once per CPU, as the call is slower
+    if (syscall(SYS_getcpu, &cpu, &cpuNode, NULL) == 0) {
+        idx = cpu % maxCPUBlockCaches;
+        node = cpuNode % maxNUMANodes;
+        if (cpuNode)
+            multipleNodesSeen = true;
+        if (cpuNode >= maxNUMANodes || cpu >= maxCPUBlockCaches)
+            nodeBindingOff = true;
+    }
+#endif
+    if (cpuCacheNode[idx])
+        return idx;
+    for (;;) {
+        intptr_t inUse = cpuCachesInUse;
+        if ((intptr_t)idx < inUse
+            || AtomicCompareExchange(cpuCachesInUse, idx+1, inUse) == inUse)
+            break;
+    }
+    cpuCacheNode[idx] = node+1;
+    return idx;
+}
+
+/* Where there is no cheap way to find the current CPU, a thread uses
+   the cache of its own id, so the cache is shared by few threads. */
+static inline unsigned getCPUBlockCacheIdx()
+{
+    unsigned idx;
+#if USE_SCHED_GETCPU
+    int cpu = sched_getcpu();
+    idx = cpu >= 0? cpu : getThreadId();
+#else
+    idx = getThreadId();
+#endif
+    idx %= maxCPUBlockCaches;
+    return cpuCacheNode[idx]? idx : registerCPUBlockCache(idx);
+}
+
+static inline unsigned getCPUCacheNode(unsigned idx)
+{
+    unsigned node = cpuCacheNode[idx];
+    return node? node-1 : 0;
+}
 
 /*
- * This is a LIFO linked list that one can init, push or pop from
+ * Regions are pieces of virtual memory obtained by mallocBigBlock. A region
+ * is aligned to its size, so a block can find it. The header occupies the
+ * first block of the region. All regions are linked in a list to return
+ * those that became completely free back to the OS.
  */
-static LifoList freeBlockList[numOfFreeBlockLists];
+struct BackendRegion {
+    BackendRegion *next,
+                  *prev;
+    size_t         freeSpace;     // valid only inside releaseFreeRegions
+    unsigned       node;          // pool of the free blocks of the region
+    bool           fromHugePages; // mapped by getHugeRawMemory
+};
+
+static BackendRegion *regionList;
+static MallocMutex regionListLock;
+
+static inline BackendRegion *getRegion(void *block, size_t regionSize)
+{
+    return (BackendRegion*)alignDown(block, regionSize);
+}
 
 FreeBlocks freeBlocks;
 
 bool FreeBlocks::bootstrap(RawAlloc myAlloc, RawFree myFree, size_t /*myReqSize*/)
 {
     if (!myAlloc && !myFree) {
-        rawAlloc = getRawMemory;
-        rawFree = freeRawMemory;
-        // Get virtual memory in pieces of this size: 0x0100000 is 1 megabyte decimal
-        memReqSize = 0x0100000;
+        rawAlloc = getRegionMemory;
+        rawFree = freeRegionMemory;
+        /* Get virtual memory in pieces of huge page size, as then a region
+           can be backed by huge pages without changing its layout. */
+        memReqSize = hugePageSize;
     } else
         MALLOC_ASSERT(0, "Not implemented yet.");
-    return mallocBigBlock();
+    return mallocBigBlock(/*node=*/0);
 }
 
+/* Blocks of the node held in caches of its CPUs, or of any node. */
+static void *stealFromCPUCaches(unsigned node, bool anyNode)
+{
+    void *block = NULL;
+    for (intptr_t i=0; i<cpuCachesInUse && !block; i++)
+        if (anyNode || getCPUCacheNode(i) == node)
+            block = cpuBlockCache[i].cache.pop();
+    return block;
+}
+
+/* A thread is given blocks of its own node, mapping a new region if needed.
+   Blocks of other nodes are given only when there is no memory for that. */
 BlockI *FreeBlocks::get(bool startup)
 {
-    BlockI *bigBlock;
-    // must not call getCPUid during malloc initialization 
-    // because getCPUid can call malloc
-    const unsigned myFreeList = startup? 0 : getCPUid()%numOfFreeBlockLists;
-    unsigned currListIdx = myFreeList;
-
-    do {
-        if (bigBlock = (BlockI *) freeBlockList[currListIdx].pop()) {
-            MALLOC_ITT_SYNC_ACQUIRED(freeBlockList+currListIdx);
+    void *bigBlock;
+    // must not look for the CPU during malloc initialization,
+    // because getThreadId is not ready yet
+    const unsigned cacheIdx = startup? 0 : getCPUBlockCacheIdx();
+    const unsigned node = getCPUCacheNode(cacheIdx);
+
+    if (!startup && (bigBlock = cpuBlockCache[cacheIdx].cache.pop()))
+        goto done;
+    if (!startup && (bigBlock = stealFromCPUCaches(node, /*anyNode=*/false)))
+        goto done;
+
+    while (!(bigBlock = nodeBlockPool[node].pop())) {
+        /* We are out of blocks so go to the OS and get another one */
+        if (!mallocBigBlock(node)) {
+            for (unsigned i=1; i<maxNUMANodes && !bigBlock; i++)
+                bigBlock = nodeBlockPool[(node+i) % maxNUMANodes].pop();
+            if (!bigBlock && !startup)
+                bigBlock = stealFromCPUCaches(node, /*anyNode=*/true);
+            if (!bigBlock)
+                return NULL;
+            if (!startup)
+                STAT_increment(getThreadId(), ThreadCommonCounters, allocRemoteNodeBlock);
             break;
         }
-        currListIdx = (currListIdx+1) % numOfFreeBlockLists;
-    } while (currListIdx != myFreeList);
-
-    while (!bigBlock) {
-        /* We are out of blocks so go to the OS and get another one */
-        if (!mallocBigBlock()) return NULL;
-
-        bigBlock = (BlockI *) freeBlockList[myFreeList].pop();
-        if (bigBlock)
-            MALLOC_ITT_SYNC_ACQUIRED(freeBlockList+myFreeList);
     }
-
-    return bigBlock;
+done:
+    MALLOC_ITT_SYNC_ACQUIRED(nodeBlockPool+node);
+    return (BlockI*)bigBlock;
 }
 
+/* Blocks go back to the pool of the node of their region,
+   the CPU cache gets only the blocks of its node. */
 void FreeBlocks::put(BlockI *ptr, bool startup)
 {
-    unsigned myFreeList = startup? 0 : getCPUid()%numOfFreeBlockLists;
-    MALLOC_ITT_SYNC_RELEASING(freeBlockList+myFreeList);
-    freeBlockList[myFreeList].push((void **)ptr);
+    const unsigned node = getRegion(ptr, memReqSize)->node;
+
+    MALLOC_ITT_SYNC_RELEASING(nodeBlockPool+node);
+    if (!startup) {
+        const unsigned cacheIdx = getCPUBlockCacheIdx();
+        if (getCPUCacheNode(cacheIdx) == node
+            && cpuBlockCache[cacheIdx].cache.push((void**)ptr))
+            return;
+    }
+    nodeBlockPool[node].push((void**)ptr);
 }
 
+/* Lists are released by thread pools, they go to the node pools right away
+   to be available to all CPUs of the nodes. The list is split into runs
+   of blocks of the same node. */
 void FreeBlocks::putList(BlockI *head, BlockI *tail)
 {
-    unsigned myFreeList = getCPUid()%numOfFreeBlockLists;
-    MALLOC_ITT_SYNC_RELEASING(freeBlockList+myFreeList);
-    freeBlockList[myFreeList].pushList((void**)head, (void**)tail);
+    void **first = (void**)head;
+    while (first) {
+        const unsigned node = getRegion(first, memReqSize)->node;
+        void **last = first;
+        while (last != (void**)tail && getRegion(*last, memReqSize)->node == node)
+            last = (void**)*last;
+        void **next = last == (void**)tail? NULL : (void**)*last;
+        MALLOC_ITT_SYNC_RELEASING(nodeBlockPool+node);
+        nodeBlockPool[node].pushList(first, last);
+        first = next;
+    }
 }
 
 /*
  * Big Blocks are the blocks we get from the OS or some similar place using getMemory above.
- * They are placed on the freeBlockList once they are acquired.
+ * They are placed on the pool of the node once they are acquired.
  */
-bool FreeBlocks::mallocBigBlock()
+bool FreeBlocks::mallocBigBlock(unsigned node)
 {
 /* Divide the big block into smaller bigBlocks that hold that many blocks.
- * This is done since we really need a lot of blocks on the freeBlockList 
+ * This is done since we really need a lot of blocks on the pool 
  * or there will be contention problems.
  */
-    const unsigned int blocksPerBigBlock = 16/numOfFreeBlockLists;
+    const unsigned int blocksPerBigBlock = 4;
+
+    BackendRegion *region = NULL;
+    bool fromHugePages = false;
 
-    void *unalignedBigBlock = (*rawAlloc)(memReqSize, /*useMapMem=*/true);
+    if (hugePages.isEnabled()) {
+        region = (BackendRegion*)getHugeRawMemory(memReqSize);
+        fromHugePages = region;
+    }
+    if (!region)
+        region = (BackendRegion*)(*rawAlloc)(memReqSize);
 
-    if (!unalignedBigBlock) {
+    if (!region) {
         TRACEF(( "[ScalableMalloc trace] in mallocBigBlock, getMemory returns 0\n" ));
         /* We can't get any more memory from the OS or executive */
         return false;
     }
+    MALLOC_ASSERT( isAligned(region, memReqSize), ASSERT_TEXT );
+#if MEMORY_NODE_BINDING_SUPPORTED
+    // must be done before the region is touched
+    if (multipleNodesSeen && !nodeBindingOff && !BindMemoryToNode(region, memReqSize, node))
+        nodeBindingOff = true;
+#endif
+    region->fromHugePages = fromHugePages;
+    region->freeSpace = 0;
+    region->node = node;
+    {
+        MallocMutex::scoped_lock lock(regionListLock);
+        region->prev = NULL;
+        region->next = regionList;
+        if (regionList)
+            regionList->prev = region;
+        regionList = region;
+    }
 
-    void *alignedBigBlock = alignUp(unalignedBigBlock, blockSize);
-    void *bigBlockCeiling = (void*)((uintptr_t)unalignedBigBlock + memReqSize);
+    // the first block is occupied by the region header
+    void *alignedBigBlock = (void*)((uintptr_t)region + blockSize);
+    void *bigBlockCeiling = (void*)((uintptr_t)region + memReqSize);
 
     size_t bigBlockSplitSize = blocksPerBigBlock * blockSize;
 
     BlockI *splitBlock = (BlockI*)alignedBigBlock;
 
-    // distribute alignedBigBlock between all freeBlockList elements
-    for (unsigned currListIdx = 0;
-         ((uintptr_t)splitBlock + blockSize) <= (uintptr_t)bigBlockCeiling;
-         currListIdx = (currListIdx+1) % numOfFreeBlockLists) {
+    MALLOC_ITT_SYNC_RELEASING(nodeBlockPool+node);
+    while (((uintptr_t)splitBlock + blockSize) <= (uintptr_t)bigBlockCeiling) {
         void *splitEdge = (void*)((uintptr_t)splitBlock + bigBlockSplitSize);
         if( splitEdge > bigBlockCeiling) {
             splitEdge = alignDown(bigBlockCeiling, blockSize);
         }
         ((BlockI*)splitBlock)->initialize(splitEdge);
-        MALLOC_ITT_SYNC_RELEASING(freeBlockList+currListIdx);
-        freeBlockList[currListIdx].push((void**) splitBlock);
+        nodeBlockPool[node].push((void**) splitBlock);
         splitBlock = (BlockI*)splitEdge;
     }
 
@@ -272,4 +510,95 @@ bool FreeBlocks::mallocBigBlock()
     return true;
 }
 
+/*
+ * Returns to the OS the regions all blocks of which are free.
+ * The free blocks are taken out of the lists while the regions are checked,
+ * so concurrent allocations may map new regions meanwhile, and blocks
+ * released concurrently keep their regions till the next call.
+ */
+bool FreeBlocks::releaseFreeRegions()
+{
+#if MEMORY_MAPPING_USES_MALLOC
+    // regions obtained via malloc can't be released, see MapMemoryAligned
+    return false;
+#else
+    const size_t regionBlocksSpace = memReqSize - blockSize;
+    void **freeList = NULL;
+    bool released = false;
+
+    // one release at a time, as freeSpace of the regions is shared
+    MallocMutex::scoped_lock lock(regionListLock);
+
+    for (BackendRegion *curr = regionList; curr; curr = curr->next)
+        curr->freeSpace = 0;
+    // every element of the lists is a run of free blocks up to its bumpPtr
+    for (unsigned i=0; i<maxCPUBlockCaches+maxNUMANodes; i++) {
+        void **curr = (void**)(i<maxCPUBlockCaches?
+            cpuBlockCache[i].cache.grab() : nodeBlockPool[i-maxCPUBlockCaches].grab());
+        while (curr) {
+            void **next = (void**)*curr;
+            BackendRegion *region = getRegion(curr, memReqSize);
+            region->freeSpace += (uintptr_t)((BlockI*)curr)->getBumpPtr() - (uintptr_t)curr;
+            MALLOC_ASSERT( region->freeSpace <= regionBlocksSpace, ASSERT_TEXT );
+            *curr = freeList;
+            freeList = curr;
+            curr = next;
+        }
+    }
+    // blocks of the regions to be released are not returned to the pools
+    while (freeList) {
+        void **next = (void**)*freeList;
+        BackendRegion *region = getRegion(freeList, memReqSize);
+        if (region->freeSpace < regionBlocksSpace) {
+            MALLOC_ITT_SYNC_RELEASING(nodeBlockPool+region->node);
+            nodeBlockPool[region->node].push(freeList);
+        }
+        freeList = next;
+    }
+    for (BackendRegion *curr = regionList; curr; ) {
+        BackendRegion *next = curr->next;
+        if (curr->freeSpace == regionBlocksSpace) {
+            if (curr->prev)
+                curr->prev->next = curr->next;
+            else
+                regionList = curr->next;
+            if (curr->next)
+                curr->next->prev = curr->prev;
+            if (curr->fromHugePages)
+                freeHugeRawMemory(curr, memReqSize);
+            else
+                (*rawFree)(curr, memReqSize);
+            released = true;
+        }
+        curr = next;
+    }
+    return released;
+#endif /* MEMORY_MAPPING_USES_MALLOC */
+}
+
+bool FreeBlocks::isEmpty() const
+{
+    for (unsigned i=0; i<maxNUMANodes; i++)
+        if (!nodeBlockPool[i].isEmpty())
+            return false;
+    for (intptr_t i=0; i<cpuCachesInUse; i++)
+        if (!cpuBlockCache[i].cache.isEmpty())
+            return false;
+    return true;
+}
+
+/* Must not be called under allocator locks, as releasing memory takes them.
+   The soft limit is not a reason to fail, so memory is obtained anyway
+   when nothing more can be released. */
+void relieveMemoryPressure (size_t size)
+{
+    if (!rawMemoryUsage.exceedsLimit(size))
+        return;
+    cleanThreadBuffers();
+    releaseRetiredHeaps();
+    releaseCachedLargeObjects(numLargeBlockBins);
+    if (rawMemoryUsage.exceedsLimit(size))
+        freeBlocks.releaseFreeRegions();
+}
+
 } } // namespaces
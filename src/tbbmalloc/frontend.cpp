@@ -29,6 +29,7 @@
 
 #include "tbbmalloc_internal.h"
 #include <errno.h>
+#include "tbb/tick_count.h"
 
 //! Define the main synchronization method
 /** It should be specified before including LifoList.h */
@@ -85,7 +86,7 @@ const unsigned int startupAllocObjSizeMark = ~(unsigned int)0;
 /*
  * This number of bins in the TLS that leads to blocks that we can allocate in.
  */
-const uint32_t numBlockBinLimit = 31;
+const uint32_t numBlockBinLimit = 54;
 
 /*
  * The following constant is used to define the size of struct Block, the block header.
@@ -143,6 +144,12 @@ public:
         }
         return result;
     }
+    /* Makes the calling thread the owner of blocks of tid, see createTLS.
+       A thread id that is not defined makes a new id to be taken. */
+    static void set(ThreadId tid) {
+        RecursiveMallocCallProtector scoped;
+        TlsSetValue_func( Tid_key, reinterpret_cast<void*>(tid.id) );
+    }
     bool defined() const { return id; }
     void undef() { id = 0; }
     void invalid() { id = (unsigned int)-1; }
@@ -176,6 +183,7 @@ unsigned int getThreadId() { return ThreadId::get().id; }
 class Bin;
 class StartupBlock;
 struct TLSData;
+static void orphanHeap(TLSData *tls);
 
 class LocalBlockFields : public BlockI {
 protected:
@@ -189,11 +197,13 @@ protected:
     BackRefIdx   backRefIdx;
     unsigned int allocatedCount;  /* Number of objects allocated (obviously by the owning thread) */
     bool         isFull;
+    bool         hasSampledObjects; /* Objects may be in the heap profile */
 
     friend void *BootStrapBlocks::allocate(size_t size);
     friend class FreeBlockPool;
     friend class StartupBlock;
     friend void BlockI::initialize(void *bumpPtr);
+    friend void *BlockI::getBumpPtr() const;
 };
     
 class Block : public LocalBlockFields {
@@ -209,7 +219,7 @@ public:
     inline FreeObject *allocateFromFreeList();
     inline bool emptyEnoughToUse();
     bool freeListNonNull() { return freeList; }
-    void freePublicObject(FreeObject *objectToFree);
+    void freePublicObjects(FreeObject *head, FreeObject *tail);
     inline void freeOwnObject(FreeObject *objectToFree);
     void returnEmpty(bool poolTheBlock);
     void privatizePublicFreeList();
@@ -219,9 +229,12 @@ public:
     unsigned int getSize() const { return objectSize; }
     const BackRefIdx *getBackRefIdx() const { return &backRefIdx; }
     bool ownBlock() const { return owner.own(); }
+    bool ownBlock(const TLSData *tls) const;
     bool isStartupAllocObject() const { return objectSize == startupAllocObjSizeMark; }
     inline FreeObject *findObjectToFree(void *object) const;
     bool checkFreePrecond() const { return allocatedCount>0; }
+    void markSampled() { hasSampledObjects = true; }
+    bool mayHaveSampledObjects() const { return hasSampledObjects; }
     const BackRefIdx *getBackRef() const { return &backRefIdx; }
     
 protected:
@@ -237,7 +250,7 @@ private:
     inline bool isProperlyPlaced(const void *object) const;
 
     friend class Bin;
-    friend void ::mallocThreadShutdownNotification(void* arg);
+    friend void orphanHeap(TLSData *tls);
     friend BlockI *BlockI::getRawBlock(bool startup);
 };
 
@@ -245,14 +258,25 @@ const float Block::emptyEnoughRatio = 1.0 / 4.0;
 
 class Bin {
     Block      *activeBlk;
+    /* Objects of the size class allocated minus the ones freed by the thread.
+       Changed by the thread only, the sum over threads is the number in use. */
+    intptr_t    objectsBalance;
     Block      *mailbox;
     MallocMutex mailLock;
 
-    static TLSData* createTLS();
 public:
+    static TLSData* createTLS();
     static inline Bin* getAllocationBin(size_t size);
 
     inline Block* getActiveBlock() const { return activeBlk; }
+    void noteAllocation() { objectsBalance++; }
+    void noteFree() { objectsBalance--; }
+    intptr_t getObjectsBalance() const { return objectsBalance; }
+    intptr_t takeObjectsBalance() {
+        intptr_t result = objectsBalance;
+        objectsBalance = 0;
+        return result;
+    }
     inline void setActiveBlock(Block *block);
     inline Block* setPreviousBlockActive();
     Block* getPublicFreeListBlock();
@@ -263,8 +287,8 @@ public:
     void verifyTLSBin (size_t size) const;
     void pushTLSBin(Block* block);
 
-    friend void ::mallocThreadShutdownNotification(void* arg);
-    friend void Block::freePublicObject (FreeObject *objectToFree);
+    friend void orphanHeap(TLSData *tls);
+    friend void Block::freePublicObjects (FreeObject *head, FreeObject *tail);
 };
 
 /********* End of the data structures                    **************/
@@ -277,30 +301,29 @@ const uint32_t numSmallObjectBins = 8;
 const uint32_t maxSmallObjectSize = 64;
 
 /*
- * There are 4 bins between each couple of powers of 2 [64-128-256-...]
- * from maxSmallObjectSize till this size; 16 bins in total
+ * There are 8 bins between each couple of powers of 2 [64-128-256-...]
+ * from maxSmallObjectSize till this size; 32 bins in total.
+ * So less than 1/9 of an object is wasted for alignment.
  */
 const uint32_t minSegregatedObjectIndex = minSmallObjectIndex+numSmallObjectBins;
-const uint32_t numSegregatedObjectBins = 16;
+const uint32_t binsPerOrder = 8;
+const uint32_t numSegregatedObjectBins = 4*binsPerOrder;
 const uint32_t maxSegregatedObjectSize = 1024;
 
 /*
- * And there are 5 bins with the following allocation sizes: 1792, 2688, 3968, 5376, 8064.
- * They selected to fit 9, 6, 4, 3, and 2 sizes per a block, and also are multiples of 128.
+ * And there are 12 "fitting" bins, from 1152 to 8064 bytes. A fitting size
+ * is the biggest multiple of 128 that fits a given number of objects
+ * per a block, for 14, 12, 11, ..., 3, 2 objects (13 gives the same size as 14).
+ * A size in between would cost as much memory as the next fitting size,
+ * because the rest of the block would stay unused.
  * If sizeof(Block) changes from 128, these sizes require close attention!
  */
 const uint32_t minFittingIndex = minSegregatedObjectIndex+numSegregatedObjectBins;
-const uint32_t numFittingBins = 5;
+const uint32_t numFittingBins = 12;
 
 const uint32_t fittingAlignment = 128;
 
-#define SET_FITTING_SIZE(N) ( (blockSize-sizeof(Block))/N ) & ~(fittingAlignment-1)
-const uint32_t fittingSize1 = SET_FITTING_SIZE(9);
-const uint32_t fittingSize2 = SET_FITTING_SIZE(6);
-const uint32_t fittingSize3 = SET_FITTING_SIZE(4);
-const uint32_t fittingSize4 = SET_FITTING_SIZE(3);
-const uint32_t fittingSize5 = SET_FITTING_SIZE(2);
-#undef SET_FITTING_SIZE
+#define FITTING_SIZE(N) ( ( (blockSize-sizeof(Block))/(N) ) & ~(fittingAlignment-1) )
 
 /*
  * The total number of thread-specific Block-based bins
@@ -310,7 +333,7 @@ const uint32_t numBlockBins = minFittingIndex+numFittingBins;
 /*
  * Objects of this size and larger are considered large objects.
  */
-const uint32_t minLargeObjectSize = fittingSize5 + 1;
+const uint32_t minLargeObjectSize = FITTING_SIZE(2) + 1;
 
 /*
  * When a block that is not completely free is returned for reuse by other threads
@@ -322,12 +345,14 @@ const uint32_t minLargeObjectSize = fittingSize5 + 1;
 
 class OrphanedBlocks {
     LifoList bins[numBlockBinLimit];
+    uintptr_t numBlocks;
 public:
     Block *get(Bin* bin, unsigned int size);
     void put(Bin* bin, Block *block);
+    size_t getNumBlocks() const { return numBlocks; }
 };
 
-static char globalBinSpace[sizeof(LifoList)*numBlockBinLimit];
+static char globalBinSpace[sizeof(OrphanedBlocks)];
 static OrphanedBlocks *orphanedBlocks = (OrphanedBlocks*)globalBinSpace;
 
 /*
@@ -345,12 +370,44 @@ public:
 
     Block *getBlock();
     void returnBlock(Block *block);
-    void releaseAllBlocks();
+    bool releaseAllBlocks();
+    int getSize() const { return size; }
+};
+
+/*
+ * Per-thread cache of objects freed by the thread, but owned by other threads.
+ * The objects are batched by blocks, so a whole batch is put to
+ * the publicFreeList of its block by a single atomic operation.
+ */
+class RemoteFreeCache {
+public:
+    static const unsigned NUM_BATCHES = 8;
+    static const unsigned MAX_BATCH_SIZE = 32;
+private:
+    struct Batch {
+        Block      *block;
+        FreeObject *head,
+                   *tail;
+        unsigned    count;
+    };
+    Batch    batch[NUM_BATCHES];
+    unsigned nextToFlush;  // the batch to flush when all batches are in use
+
+    static void flushBatch(Batch *b);
+public:
+    void put(Block *block, FreeObject *object);
+    bool flush();
 };
 
 struct TLSData {
-    Bin           bin[numBlockBinLimit];
-    FreeBlockPool pool;
+    TLSData        *nextRetired;  // must be the first, see retiredHeaps
+    Bin             bin[numBlockBinLimit];
+    FreeBlockPool   pool;
+    RemoteFreeCache remoteFrees;
+    ThreadId        threadId;     // to check block owner without another TLS lookup
+    intptr_t        bytesToSample; // countdown to the next heap profile sample
+    TLSData        *prevThread,   // in the list of all threads, see registerThread
+                   *nextThread;
 };
 
 #if MALLOC_CHECK_RECURSION
@@ -383,6 +440,44 @@ static inline void  setThreadMallocTLS( TLSData * newvalue ) {
 
 /*********** End code to provide thread ID and a TLS pointer **********/
 
+/*********** Code for the list of threads for statistics **********/
+
+/*
+ * TLSData of all threads are linked to collect statistics. The list is changed
+ * only when a thread starts or stops using the allocator, so the lock
+ * is not taken by allocations.
+ */
+static MallocMutex threadListLock;
+static TLSData *threadList;
+/* Balances of objects freed by threads without TLSData and of exited threads */
+static uintptr_t exitedThreadsBalance[numBlockBinLimit];
+
+static void registerThread(TLSData *tls)
+{
+    MallocMutex::scoped_lock lock(threadListLock);
+    tls->prevThread = NULL;
+    tls->nextThread = threadList;
+    if (threadList)
+        threadList->prevThread = tls;
+    threadList = tls;
+}
+
+/* The balances of the thread are kept, as its objects may be still in use */
+static void unregisterThread(TLSData *tls)
+{
+    MallocMutex::scoped_lock lock(threadListLock);
+    for (unsigned i=0; i<numBlockBinLimit; i++)
+        AtomicAdd(exitedThreadsBalance[i], tls->bin[i].takeObjectsBalance());
+    if (tls->prevThread)
+        tls->prevThread->nextThread = tls->nextThread;
+    else
+        threadList = tls->nextThread;
+    if (tls->nextThread)
+        tls->nextThread->prevThread = tls->prevThread;
+}
+
+/*********** End code for the list of threads **********/
+
 #if !MALLOC_DEBUG
 #if __INTEL_COMPILER || _MSC_VER
 #define NOINLINE(decl) __declspec(noinline) decl
@@ -407,96 +502,86 @@ ALWAYSINLINE( bool isMallocInitialized() );
 /********* Now some rough utility code to deal with indexing the size bins. **************/
 
 /*
- * Given a number return the highest non-zero bit in it. It is intended to work with 32-bit values only.
- * Moreover, on IPF, for sake of simplicity and performance, it is narrowed to only serve for 64 to 1023.
- * This is enough for current algorithm of distribution of sizes among bins.
+ * The size classes are computed at compile time into lookup tables,
+ * so a size is mapped to its bin without branches.
  */
-#if _WIN64 && _MSC_VER>=1400 && !__INTEL_COMPILER
-extern "C" unsigned char _BitScanReverse( unsigned long* i, unsigned long w );
-#pragma intrinsic(_BitScanReverse)
-#endif
-static inline unsigned int highestBitPos(unsigned int n)
-{
-    unsigned int pos;
-#if __ARCH_x86_32||__ARCH_x86_64
+template<unsigned int size>
+struct SizeClass {
+    // which group of segregated bin sizes?
+    static const unsigned int order = size-1 >= 512? 9 : size-1 >= 256? 8 : size-1 >= 128? 7 : 6;
+    static const unsigned int index =
+        size <= maxSmallObjectSize? (size? (size-1)>>3 : 0) :
+        size <= maxSegregatedObjectSize? minSegregatedObjectIndex - binsPerOrder
+            + binsPerOrder*(order-6) + ((size-1)>>(order-3)) :
+        minFittingIndex + (size>FITTING_SIZE(14)) + (size>FITTING_SIZE(12))
+            + (size>FITTING_SIZE(11)) + (size>FITTING_SIZE(10)) + (size>FITTING_SIZE(9))
+            + (size>FITTING_SIZE(8)) + (size>FITTING_SIZE(7)) + (size>FITTING_SIZE(6))
+            + (size>FITTING_SIZE(5)) + (size>FITTING_SIZE(4)) + (size>FITTING_SIZE(3))
+            + (size>FITTING_SIZE(2)); // numBlockBins for large objects
+};
 
-# if __linux__||__APPLE__||__FreeBSD__||__sun||__MINGW32__
-    __asm__ ("bsr %1,%0" : "=r"(pos) : "r"(n));
-# elif (_WIN32 && (!_WIN64 || __INTEL_COMPILER))
-    __asm
-    {
-        bsr eax, n
-        mov pos, eax
-    }
-# elif _WIN64 && _MSC_VER>=1400
-    _BitScanReverse((unsigned long*)&pos, (unsigned long)n);
-# else
-#   error highestBitPos() not implemented for this platform
-# endif
-
-#elif __ARCH_ipf || __ARCH_other
-    static unsigned int bsr[16] = {0,6,7,7,8,8,8,8,9,9,9,9,9,9,9,9};
-    MALLOC_ASSERT( n>=64 && n<1024, ASSERT_TEXT );
-    pos = bsr[ n>>6 ];
-#else
-#   error highestBitPos() not implemented for this platform
-#endif /* __ARCH_* */
-    return pos;
-}
+template<unsigned int index>
+struct BinObjectSize {
+    static const unsigned int order = 6 + (index-minSegregatedObjectIndex)/binsPerOrder;
+    static const unsigned int fittingNum = index-minFittingIndex;
+    static const unsigned int value =
+        index < minSegregatedObjectIndex? 8*(index+1) :
+        index < minFittingIndex? (1U<<order)
+            + ((index-minSegregatedObjectIndex)%binsPerOrder + 1)*(1U<<(order-3)) :
+        FITTING_SIZE(fittingNum? 13-fittingNum : 14);
+};
+
+#define REPEAT_1(M,n)    M(n)
+#define REPEAT_2(M,n)    REPEAT_1(M,n),   REPEAT_1(M,(n)+1)
+#define REPEAT_4(M,n)    REPEAT_2(M,n),   REPEAT_2(M,(n)+2)
+#define REPEAT_8(M,n)    REPEAT_4(M,n),   REPEAT_4(M,(n)+4)
+#define REPEAT_16(M,n)   REPEAT_8(M,n),   REPEAT_8(M,(n)+8)
+#define REPEAT_32(M,n)   REPEAT_16(M,n),  REPEAT_16(M,(n)+16)
+#define REPEAT_64(M,n)   REPEAT_32(M,n),  REPEAT_32(M,(n)+32)
+#define REPEAT_128(M,n)  REPEAT_64(M,n),  REPEAT_64(M,(n)+64)
+#define REPEAT_256(M,n)  REPEAT_128(M,n), REPEAT_128(M,(n)+128)
+#define REPEAT_512(M,n)  REPEAT_256(M,n), REPEAT_256(M,(n)+256)
+#define REPEAT_1024(M,n) REPEAT_512(M,n), REPEAT_512(M,(n)+512)
+
+#define SIZE_TO_INDEX(n)   SizeClass<8*(n)>::index
+#define BIN_OBJECT_SIZE(n) BinObjectSize<(n)>::value
+
+/* bin index for a size rounded up to 8, by size/8 */
+static const uint8_t sizeToIndex[1024] = { REPEAT_1024(SIZE_TO_INDEX, 0) };
+static const uint16_t binObjectSize[numBlockBins] = {
+    REPEAT_32(BIN_OBJECT_SIZE, 0), REPEAT_16(BIN_OBJECT_SIZE, 32), REPEAT_4(BIN_OBJECT_SIZE, 48)
+};
+
+#undef SIZE_TO_INDEX
+#undef BIN_OBJECT_SIZE
+#undef REPEAT_1
+#undef REPEAT_2
+#undef REPEAT_4
+#undef REPEAT_8
+#undef REPEAT_16
+#undef REPEAT_32
+#undef REPEAT_64
+#undef REPEAT_128
+#undef REPEAT_256
+#undef REPEAT_512
+#undef REPEAT_1024
+#undef FITTING_SIZE
 
 /*
- * Depending on indexRequest, for a given size return either the index into the bin
- * for objects of this size, or the actual size of objects in this bin.
+ * For a given size return the index into the bin for objects of this size.
  */
-template<bool indexRequest>
-static unsigned int getIndexOrObjectSize (unsigned int size)
-{
-    if (size <= maxSmallObjectSize) { // selection from 4/8/16/24/32/40/48/56/64
-         /* Index 0 holds up to 8 bytes, Index 1 16 and so forth */
-        return indexRequest ? (size - 1) >> 3 : alignUp(size,8);
-    }
-    else if (size <= maxSegregatedObjectSize ) { // 80/96/112/128 / 160/192/224/256 / 320/384/448/512 / 640/768/896/1024
-        unsigned int order = highestBitPos(size-1); // which group of bin sizes?
-        MALLOC_ASSERT( 6<=order && order<=9, ASSERT_TEXT );
-        if (indexRequest)
-            return minSegregatedObjectIndex - (4*6) - 4 + (4*order) + ((size-1)>>(order-2));
-        else {
-            unsigned int alignment = 128 >> (9-order); // alignment in the group
-            MALLOC_ASSERT( alignment==16 || alignment==32 || alignment==64 || alignment==128, ASSERT_TEXT );
-            return alignUp(size,alignment);
-        }
-    }
-    else {
-        if( size <= fittingSize3 ) {
-            if( size <= fittingSize2 ) {
-                if( size <= fittingSize1 )
-                    return indexRequest ? minFittingIndex : fittingSize1; 
-                else
-                    return indexRequest ? minFittingIndex+1 : fittingSize2;
-            } else
-                return indexRequest ? minFittingIndex+2 : fittingSize3;
-        } else {
-            if( size <= fittingSize5 ) {
-                if( size <= fittingSize4 )
-                    return indexRequest ? minFittingIndex+3 : fittingSize4;
-                else
-                    return indexRequest ? minFittingIndex+4 : fittingSize5;
-            } else {
-                MALLOC_ASSERT( 0,ASSERT_TEXT ); // this should not happen
-                return ~0U;
-            }
-        }
-    }
-}
-
-static unsigned int getIndex (unsigned int size)
+static inline unsigned int getIndex (unsigned int size)
 {
-    return getIndexOrObjectSize</*indexRequest*/true>(size);
+    MALLOC_ASSERT( size < minLargeObjectSize, ASSERT_TEXT );
+    return sizeToIndex[(size+7)>>3];
 }
 
-static unsigned int getObjectSize (unsigned int size)
+/*
+ * For a given size return the actual size of objects in its bin.
+ */
+static inline unsigned int getObjectSize (unsigned int size)
 {
-    return getIndexOrObjectSize</*indexRequest*/false>(size);
+    return binObjectSize[getIndex(size)];
 }
 
 /*
@@ -668,22 +753,56 @@ void Bin::outofTLSBin(Block* block)
     verifyTLSBin(size);
 }
 
+/*
+ * Heaps of exited threads, adopted by new threads with their blocks and
+ * block pools, so a thread creation and exit do not walk the blocks.
+ */
+static LifoList retiredHeaps;
+static uintptr_t retiredHeapsNum;
+/* Beyond it, the blocks of exited threads are orphaned */
+const uintptr_t maxRetiredHeaps = 32;
+
 TLSData* Bin::createTLS()
 {
-    MALLOC_ASSERT( sizeof(TLSData) >= sizeof(Bin) * numBlockBins + sizeof(FreeBlockPool), ASSERT_TEXT );
-    TLSData* tls = (TLSData*) bootStrapBlocks.allocate(sizeof(TLSData));
-    if ( !tls ) return NULL;
-    /* the block contains zeroes after bootStrapMalloc, so bins are initialized */
+    MALLOC_ASSERT( sizeof(TLSData) >= sizeof(Bin) * numBlockBins + sizeof(FreeBlockPool)
+                   + sizeof(RemoteFreeCache), ASSERT_TEXT );
+    TLSData* tls = (TLSData*) retiredHeaps.pop();
+    if (tls) {
+        AtomicAdd(retiredHeapsNum, -1);
+        // the exited thread has given up the id, so the blocks become ours
+        ThreadId::set(tls->threadId);
+    } else {
+        tls = (TLSData*) bootStrapBlocks.allocate(sizeof(TLSData));
+        if ( !tls ) return NULL;
+        /* the block contains zeroes after bootStrapMalloc, so bins are initialized */
 #if MALLOC_DEBUG
-    for (uint32_t i = 0; i < numBlockBinLimit; i++) {
-        MALLOC_ASSERT( tls->bin[i].activeBlk == 0, ASSERT_TEXT );
-        MALLOC_ASSERT( tls->bin[i].mailbox == 0, ASSERT_TEXT );
-    }
+        for (uint32_t i = 0; i < numBlockBinLimit; i++) {
+            MALLOC_ASSERT( tls->bin[i].activeBlk == 0, ASSERT_TEXT );
+            MALLOC_ASSERT( tls->bin[i].mailbox == 0, ASSERT_TEXT );
+        }
 #endif
+        tls->threadId = ThreadId::get();
+    }
+    registerThread(tls);
     setThreadMallocTLS(tls);
     return tls;
 }
 
+/* Returns false if there are too many retired heaps already */
+static bool retireHeap(TLSData *tls)
+{
+    if (retiredHeapsNum >= maxRetiredHeaps)
+        return false;
+    AtomicAdd(retiredHeapsNum, 1);
+    // the thread can allocate again from other TLS destructors,
+    // and must not own the blocks of the heap then
+    ThreadId noId;
+    noId.undef();
+    ThreadId::set(noId);
+    retiredHeaps.push((void**)tls);
+    return true;
+}
+
 /*
  * Return the bin for the given size. If the TLS bin structure is absent, create it.
  */
@@ -725,6 +844,8 @@ BlockI *BlockI::getRawBlock(bool startup) { return Block::getRaw(startup); }
 
 void BlockI::initialize(void *ptr) { ((LocalBlockFields*)this)->bumpPtr = (FreeObject*)ptr; }
 
+void *BlockI::getBumpPtr() const { return ((LocalBlockFields*)this)->bumpPtr; }
+
 bool Block::emptyEnoughToUse()
 {
     const float threshold = (blockSize - sizeof(Block)) * (1-emptyEnoughRatio);
@@ -759,6 +880,13 @@ void Block::restoreBumpPtr()
     isFull = 0;
 }
 
+/* A thread without TLSData owns no blocks */
+inline bool Block::ownBlock(const TLSData *tls) const
+{
+    MALLOC_ASSERT( (tls && owner == tls->threadId) == ownBlock(), ASSERT_TEXT );
+    return tls && owner == tls->threadId;
+}
+
 void Block::freeOwnObject(FreeObject *objectToFree)
 {
     objectToFree->next = freeList;
@@ -780,7 +908,9 @@ void Block::freeOwnObject(FreeObject *objectToFree)
     }
 }
 
-void Block::freePublicObject (FreeObject *objectToFree)
+/* Puts the list of objects from head to tail linked by next fields
+   to publicFreeList at once. */
+void Block::freePublicObjects (FreeObject *head, FreeObject *tail)
 {
     FreeObject *localPublicFreeList;
 
@@ -788,18 +918,18 @@ void Block::freePublicObject (FreeObject *objectToFree)
 #if FREELIST_NONBLOCKING
     FreeObject *temp = publicFreeList;
     do {
-        localPublicFreeList = objectToFree->next = temp;
+        localPublicFreeList = tail->next = temp;
         temp = (FreeObject*)AtomicCompareExchange(
                                 (intptr_t&)publicFreeList,
-                                (intptr_t)objectToFree, (intptr_t)localPublicFreeList );
+                                (intptr_t)head, (intptr_t)localPublicFreeList );
         // no backoff necessary because trying to make change, not waiting for a change
     } while( temp != localPublicFreeList );
 #else
     STAT_increment(getThreadId(), ThreadCommonCounters, lockPublicFreeList);
     {
         MallocMutex::scoped_lock scoped_cs(publicFreeListLock);
-        localPublicFreeList = objectToFree->next = publicFreeList;
-        publicFreeList = objectToFree;
+        localPublicFreeList = tail->next = publicFreeList;
+        publicFreeList = head;
     }
 #endif
 
@@ -826,6 +956,52 @@ void Block::freePublicObject (FreeObject *objectToFree)
     STAT_increment(owner, getIndex(objectSize), freeByOtherThread);
 }
 
+void RemoteFreeCache::flushBatch(Batch *b)
+{
+    b->block->freePublicObjects(b->head, b->tail);
+    b->block = NULL;
+    b->head = b->tail = NULL;
+    b->count = 0;
+}
+
+void RemoteFreeCache::put(Block *block, FreeObject *object)
+{
+    Batch *freeBatch = NULL;
+
+    for (unsigned i=0; i<NUM_BATCHES; i++) {
+        if (batch[i].block == block) {
+            object->next = batch[i].head;
+            batch[i].head = object;
+            if (++batch[i].count == MAX_BATCH_SIZE)
+                flushBatch(batch+i);
+            return;
+        }
+        if (!batch[i].block && !freeBatch)
+            freeBatch = batch+i;
+    }
+    if (!freeBatch) {
+        freeBatch = batch+nextToFlush;
+        flushBatch(freeBatch);
+        nextToFlush = (nextToFlush+1) % NUM_BATCHES;
+    }
+    object->next = NULL;
+    freeBatch->block = block;
+    freeBatch->head = freeBatch->tail = object;
+    freeBatch->count = 1;
+}
+
+bool RemoteFreeCache::flush()
+{
+    bool flushed = false;
+
+    for (unsigned i=0; i<NUM_BATCHES; i++)
+        if (batch[i].block) {
+            flushBatch(batch+i);
+            flushed = true;
+        }
+    return flushed;
+}
+
 void Block::privatizePublicFreeList()
 {
     FreeObject *temp, *localPublicFreeList;
@@ -939,16 +1115,15 @@ void Block::cleanBlockHeader()
     freeList = NULL;
     allocatedCount = 0;
     isFull = 0;
+    hasSampledObjects = false;
 
     publicFreeList = NULL;
 }
 
 void Block::initEmptyBlock(size_t size)
 {
-    // Having getIndex and getObjectSize called next to each other
-    // allows better compiler optimization as they basically share the code.
     unsigned int index = getIndex(size);
-    unsigned int objSz = getObjectSize(size); 
+    unsigned int objSz = binObjectSize[index];
     Bin* tlsBin = getThreadMallocTLS()->bin;
 
     cleanBlockHeader();
@@ -972,6 +1147,7 @@ Block *OrphanedBlocks::get(Bin* bin, unsigned int size)
     result = (Block *) bins[index].pop();
     if (result) {
         MALLOC_ITT_SYNC_ACQUIRED(bins+index);
+        AtomicAdd(numBlocks, -1);
         result->privatizeOrphaned(bin);
         STAT_increment(result->owner, index, allocBlockPublic);
     }
@@ -983,6 +1159,7 @@ void OrphanedBlocks::put(Bin* bin, Block *block)
     unsigned int index = getIndex(block->getSize());
     block->shareOrphaned(bin);
     MALLOC_ITT_SYNC_RELEASING(bins+index);
+    AtomicAdd(numBlocks, 1);
     bins[index].push((void **)block);
 }
 
@@ -1010,6 +1187,12 @@ Block *FreeBlockPool::getBlock()
 void FreeBlockPool::returnBlock(Block *block)
 {
     MALLOC_ASSERT( size <= POOL_HIGH_MARK, ASSERT_TEXT );
+    // under memory pressure, the block is shared for reuse by other threads
+    if (rawMemoryUsage.exceedsLimit(0)) {
+        removeBackRef(block->backRefIdx);
+        freeBlocks.put(block, /*startup=*/false);
+        return;
+    }
     if (size == POOL_HIGH_MARK) {
         // release cold blocks and add hot one
         Block *headToFree = head, 
@@ -1027,13 +1210,31 @@ void FreeBlockPool::returnBlock(Block *block)
     insertBlock(block);
 }
 
-void FreeBlockPool::releaseAllBlocks()
+bool FreeBlockPool::releaseAllBlocks()
 {
     if (head) {
         for (Block *currBl = head; currBl; currBl = currBl->next)
             removeBackRef(currBl->backRefIdx);
         freeBlocks.putList(head, tail);
+        head = tail = NULL;
+        size = 0;
+        return true;
     }
+    return false;
+}
+
+/* Blocks pooled by other threads can't be reached safely,
+   so only the blocks of the calling thread are released. */
+bool cleanThreadBuffers()
+{
+    TLSData *tls = getThreadMallocTLS();
+    if (!tls)
+        return false;
+    // the objects freed to other threads become available for reuse
+    bool released = tls->remoteFrees.flush();
+    if (tls->pool.releaseAllBlocks())
+        released = true;
+    return released;
 }
 
 /* Return an empty uninitialized block in a non-blocking fashion. */
@@ -1067,6 +1268,9 @@ Block *Block::getEmpty(size_t size)
     if (tls)
         result = tls->pool.getBlock();
     if (!result) {
+        // a new region is to be mapped, so obey the soft heap limit
+        if (freeBlocks.isEmpty())
+            relieveMemoryPressure(blockSize);
         BackRefIdx backRefIdx = BackRefIdx::newBackRef(/*largeObj=*/false);
         if (backRefIdx.isInvalid() || !(result = getRaw(/*startup=*/false)))
             return NULL;
@@ -1326,6 +1530,8 @@ static void initMemoryManager()
     }
 #endif /* USE_WINTHREAD */
     ThreadId::init();
+    hugePages.init();
+    initHeapProfiler();
 #if COLLECT_STATISTICS
     initStatisticsCollection();
 #endif
@@ -1438,13 +1644,24 @@ void Bin::processLessUsedBlock(Block *block)
     }
 }
 
+/* The countdown is set to the maximum while the sample is taken,
+   so the allocations done by the profiler itself are not sampled. */
+static inline void sampleObject(TLSData *tls, void *object, size_t size, bool largeObject)
+{
+    tls->bytesToSample = ~(uintptr_t)0 >> 1;
+    // aligned allocations can be large objects of a small size, so the size can't tell the kind
+    if (!largeObject)
+        ((Block*)alignDown(object, blockSize))->markSampled();
+    tls->bytesToSample = sampleAllocation(object, size);
+}
+
 /*
  * All aligned allocations fall into one of the following categories:
  *  1. if both request size and alignment are <= maxSegregatedObjectSize,
  *       we just align the size up, and request this amount, because for every size
  *       aligned to some power of 2, the allocated object is at least that aligned.
  * 2. for bigger size, check if already guaranteed fittingAlignment is enough.
- * 3. if size+alignment<minLargeObjectSize, we take an object of fittingSizeN and align
+ * 3. if size+alignment<minLargeObjectSize, we take an object of a fitting size and align
  *       its address up; given such pointer, scalable_free could find the real object.
  * 4. otherwise, aligned large object is allocated.
  */
@@ -1468,6 +1685,9 @@ static void *allocateAligned(size_t size, size_t alignment)
         // take into account only alignment that are higher then natural
         result = mallocLargeObject(size, largeObjectAlignment>alignment? 
                                          largeObjectAlignment: alignment);
+        TLSData *tls = getThreadMallocTLS();
+        if (result && tls && (tls->bytesToSample -= size) < 0)
+            sampleObject(tls, result, size, /*largeObject=*/true);
     }
 
     MALLOC_ASSERT( isAligned(result, alignment), ASSERT_TEXT );
@@ -1482,9 +1702,13 @@ static void *reallocAligned(void *ptr, size_t size, size_t alignment = 0)
     if (isLargeObject(ptr)) {
         LargeMemoryBlock* lmb = ((LargeObjectHdr *)ptr - 1)->memoryBlock;
         copySize = lmb->unalignedSize-((uintptr_t)ptr-(uintptr_t)lmb);
-        if (size <= copySize && (0==alignment || isAligned(ptr, alignment))) {
+        // shrunk to a small size, the object moves to a bin, as scalable_free_sized expects
+        if (size <= copySize && size >= minLargeObjectSize
+            && (0==alignment || isAligned(ptr, alignment))) {
             lmb->objectSize = size;
             return ptr;
+        } else if (size >= minLargeObjectSize && (result = remapLargeObject(ptr, size, alignment))) {
+            return result;
         } else {
             copySize = lmb->objectSize;
             result = alignment ? allocateAligned(size, alignment) : scalable_malloc(size);
@@ -1492,6 +1716,10 @@ static void *reallocAligned(void *ptr, size_t size, size_t alignment = 0)
     } else {
         Block* block = (Block *)alignDown(ptr, blockSize);
         copySize = block->getSize();
+        // an aligned object can start inside its slot, then only the rest of the slot is usable
+        if (copySize)
+            copySize -= (uintptr_t)ptr - (uintptr_t)block->findObjectToFree(ptr);
+        // the object stays in place while the size fits its size class
         if (size <= copySize && (0==alignment || isAligned(ptr, alignment))) {
             return ptr;
         } else {
@@ -1580,11 +1808,22 @@ static inline void freeSmallObject (void *object)
     }
 #endif
     FreeObject *objectToFree = block->findObjectToFree(object);
+    TLSData *tls = getThreadMallocTLS();
 
-    if (block->ownBlock())
+    if (block->mayHaveSampledObjects() && heapSamplesNum)
+        forgetHeapSample(objectToFree);
+    if (tls)
+        tls->bin[getIndex(block->getSize())].noteFree();
+    else
+        AtomicAdd(exitedThreadsBalance[getIndex(block->getSize())], -1);
+    if (block->ownBlock(tls))
         block->freeOwnObject(objectToFree);
-    else /* Slower path to add to the shared list, the allocatedCount is updated by the owner thread in malloc. */
-        block->freePublicObject(objectToFree);
+    else { /* Slower path to add to the shared list, the allocatedCount is updated by the owner thread in malloc. */
+        if (tls)
+            tls->remoteFrees.put(block, objectToFree);
+        else
+            block->freePublicObjects(objectToFree, objectToFree);
+    }
 
 }
 
@@ -1609,13 +1848,70 @@ static unsigned int threadGoingDownCount = 0;
  * for Windows, it should be called directly e.g. from DllMain; the argument can be NULL
  * one should include "TypeDefinitions.h" for the declaration of this function.
 */
-extern "C" void mallocThreadShutdownNotification(void* arg)
+namespace rml {
+namespace internal {
+
+/* Returns the blocks of a heap that no thread uses, and frees the heap */
+static void orphanHeap(TLSData *tls)
 {
-    TLSData *tls;
+    Bin *tlsBin = tls->bin;
     Block *threadBlock;
     Block *threadlessBlock;
     unsigned int index;
 
+    tls->pool.releaseAllBlocks();
+
+    for (index = 0; index < numBlockBins; index++) {
+        if (tlsBin[index].activeBlk==NULL)
+            continue;
+        threadlessBlock = tlsBin[index].activeBlk->previous;
+        while (threadlessBlock) {
+            threadBlock = threadlessBlock->previous;
+            if (threadlessBlock->allocatedCount==0 && threadlessBlock->publicFreeList==NULL) {
+                /* we destroy the thread, so not use its block pool */
+                threadlessBlock->returnEmpty(/*poolTheBlock=*/false);
+            } else {
+                orphanedBlocks->put(tlsBin+index, threadlessBlock);
+            }
+            threadlessBlock = threadBlock;
+        }
+        threadlessBlock = tlsBin[index].activeBlk;
+        while (threadlessBlock) {
+            threadBlock = threadlessBlock->next;
+            if (threadlessBlock->allocatedCount==0 && threadlessBlock->publicFreeList==NULL) {
+                /* we destroy the thread, so not use its block pool */
+                threadlessBlock->returnEmpty(/*poolTheBlock=*/false);
+            } else {
+                orphanedBlocks->put(tlsBin+index, threadlessBlock);
+            }
+            threadlessBlock = threadBlock;
+        }
+        tlsBin[index].activeBlk = 0;
+    }
+    bootStrapBlocks.free(tls);
+}
+
+/* Orphans the blocks of retired heaps. Returns true if there were any. */
+bool releaseRetiredHeaps()
+{
+    TLSData *tls = (TLSData*)retiredHeaps.grab();
+    bool released = tls;
+    while (tls) {
+        TLSData *next = tls->nextRetired;
+        AtomicAdd(retiredHeapsNum, -1);
+        orphanHeap(tls);
+        tls = next;
+    }
+    return released;
+}
+
+} // namespace internal
+} // namespace rml
+
+extern "C" void mallocThreadShutdownNotification(void* arg)
+{
+    TLSData *tls;
+
     // Check whether TLS has been initialized
     if (!isMallocInitialized()) return;
 
@@ -1627,37 +1923,10 @@ extern "C" void mallocThreadShutdownNotification(void* arg)
     tls = (TLSData*)arg;
 #endif
     if (tls) {
-        Bin *tlsBin = tls->bin;
-        tls->pool.releaseAllBlocks();
-
-        for (index = 0; index < numBlockBins; index++) {
-            if (tlsBin[index].activeBlk==NULL)
-                continue;
-            threadlessBlock = tlsBin[index].activeBlk->previous;
-            while (threadlessBlock) {
-                threadBlock = threadlessBlock->previous;
-                if (threadlessBlock->allocatedCount==0 && threadlessBlock->publicFreeList==NULL) {
-                    /* we destroy the thread, so not use its block pool */
-                    threadlessBlock->returnEmpty(/*poolTheBlock=*/false);
-                } else {
-                    orphanedBlocks->put(tlsBin+index, threadlessBlock);
-                }
-                threadlessBlock = threadBlock;
-            }
-            threadlessBlock = tlsBin[index].activeBlk;
-            while (threadlessBlock) {
-                threadBlock = threadlessBlock->next;
-                if (threadlessBlock->allocatedCount==0 && threadlessBlock->publicFreeList==NULL) {
-                    /* we destroy the thread, so not use its block pool */
-                    threadlessBlock->returnEmpty(/*poolTheBlock=*/false);
-                } else {
-                    orphanedBlocks->put(tlsBin+index, threadlessBlock);
-                }
-                threadlessBlock = threadBlock;
-            }
-            tlsBin[index].activeBlk = 0;
-        }
-        bootStrapBlocks.free(tls);
+        unregisterThread(tls);
+        tls->remoteFrees.flush();
+        if (!retireHeap(tls))
+            orphanHeap(tls);
         setThreadMallocTLS(NULL);
     }
 
@@ -1670,56 +1939,24 @@ extern "C" void mallocProcessShutdownNotification(void)
     ThreadId nThreads = ThreadIdCount;
     for( int i=1; i<=nThreads && i<MAX_THREADS; ++i )
         STAT_print(i);
+    STAT_printProcess(hugePages.currentBytes, hugePages.totalBytes);
 #endif
 }
 
 /********* The malloc code          *************/
 
-extern "C" void * scalable_malloc(size_t size)
+static FreeObject *mallocSmallObject(Bin *bin, size_t size)
 {
-    Bin* bin;
     Block * mallocBlock;
     FreeObject *result = NULL;
 
-    if (!size) size = sizeof(size_t);
-
-#if MALLOC_CHECK_RECURSION
-    if (RecursiveMallocCallProtector::sameThreadActive()) {
-        result = size<minLargeObjectSize? StartupBlock::allocate(size) : 
-              (FreeObject*)mallocLargeObject(size, blockSize, /*startupAlloc=*/ true);
-        if (!result) errno = ENOMEM;
-        return result;
-    }
-#endif
-
-    if (!isMallocInitialized()) 
-        doInitialization();
-
-    /*
-     * Use Large Object Allocation
-     */
-    if (size >= minLargeObjectSize) {
-        result = (FreeObject*)mallocLargeObject(size, largeObjectAlignment);
-        if (!result) errno = ENOMEM;
-        return result;
-    }
-
-    /*
-     * Get an element in thread-local array corresponding to the given size;
-     * It keeps ptr to the active block for allocations of this size
-     */
-    bin = Bin::getAllocationBin(size);
-    if ( !bin ) {
-        errno = ENOMEM;
-        return NULL;
-    }
-
     /* Get the block of you want to try to allocate in. */
     mallocBlock = bin->getActiveBlock();
 
     if (mallocBlock) {
         do {
             if( (result = mallocBlock->allocate()) ) {
+                bin->noteAllocation();
                 return result;
             }
             // the previous block, if any, should be empty enough
@@ -1736,11 +1973,12 @@ extern "C" void * scalable_malloc(size_t size)
         }
         MALLOC_ASSERT( mallocBlock->freeListNonNull(), ASSERT_TEXT );
         if ( (result = mallocBlock->allocateFromFreeList()) ) {
+            bin->noteAllocation();
             return result;
         }
         /* Else something strange happened, need to retry from the beginning; */
         TRACEF(( "[ScalableMalloc trace] Something is wrong: no objects in public free list; reentering.\n" ));
-        return scalable_malloc(size);
+        return mallocSmallObject(bin, size);
     }
 
     /*
@@ -1751,6 +1989,7 @@ extern "C" void * scalable_malloc(size_t size)
         bin->pushTLSBin(mallocBlock);
         bin->setActiveBlock(mallocBlock); // TODO: move under the below condition?
         if( (result = mallocBlock->allocate()) ) {
+            bin->noteAllocation();
             return result;
         }
         mallocBlock = orphanedBlocks->get(bin, size);
@@ -1764,11 +2003,12 @@ extern "C" void * scalable_malloc(size_t size)
         bin->pushTLSBin(mallocBlock);
         bin->setActiveBlock(mallocBlock);
         if( (result = mallocBlock->allocate()) ) {
+            bin->noteAllocation();
             return result;
         }
         /* Else something strange happened, need to retry from the beginning; */
         TRACEF(( "[ScalableMalloc trace] Something is wrong: no objects in empty block; reentering.\n" ));
-        return scalable_malloc(size);
+        return mallocSmallObject(bin, size);
     }
     /*
      * else nothing works so return NULL
@@ -1778,6 +2018,54 @@ extern "C" void * scalable_malloc(size_t size)
     return NULL;
 }
 
+extern "C" void * scalable_malloc(size_t size)
+{
+    FreeObject *result = NULL;
+
+    if (!size) size = sizeof(size_t);
+
+#if MALLOC_CHECK_RECURSION
+    if (RecursiveMallocCallProtector::sameThreadActive()) {
+        result = size<minLargeObjectSize? StartupBlock::allocate(size) : 
+              (FreeObject*)mallocLargeObject(size, blockSize, /*startupAlloc=*/ true);
+        if (!result) errno = ENOMEM;
+        return result;
+    }
+#endif
+
+    if (!isMallocInitialized()) 
+        doInitialization();
+
+    TLSData *tls = getThreadMallocTLS();
+    if( !tls && !(tls = Bin::createTLS()) ) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (size >= minLargeObjectSize) {
+        /*
+         * Use Large Object Allocation
+         */
+        result = (FreeObject*)mallocLargeObject(size, largeObjectAlignment);
+        if (!result) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    } else {
+        /*
+         * Get an element in thread-local array corresponding to the given size;
+         * It keeps ptr to the active block for allocations of this size
+         */
+        result = mallocSmallObject(tls->bin + getIndex(size), size);
+        if (!result)
+            return NULL;
+    }
+
+    if ((tls->bytesToSample -= size) < 0)
+        sampleObject(tls, result, size, size >= minLargeObjectSize);
+    return result;
+}
+
 /********* End the malloc code      *************/
 
 /********* The free code            *************/
@@ -1794,6 +2082,25 @@ if (!object)
         freeSmallObject(object);
 }
 
+/*
+ * The size tells the kind of the object, so the check of the large object header
+ * is skipped. Aligned allocations and reallocations keep the kind of an object
+ * in line with its size for alignments up to fittingAlignment.
+ */
+extern "C" void scalable_free_sized (void *object, size_t size) {
+    if (!object)
+        return;
+
+    MALLOC_ASSERT(isRecognized(object), "Invalid pointer in scalable_free_sized detected.");
+    MALLOC_ASSERT(isLargeObject(object) == (size >= minLargeObjectSize),
+                  "Wrong size in scalable_free_sized detected.");
+
+    if (size >= minLargeObjectSize)
+        freeLargeObject(object);
+    else
+        freeSmallObject(object);
+}
+
 /*
  * A variant that provides additional memory safety, by checking whether the given address
  * was obtained with this allocator, and if not redirecting to the provided alternative call.
@@ -2005,6 +2312,25 @@ extern "C" void scalable_aligned_free(void *ptr)
     scalable_free(ptr);
 }
 
+/*
+ * Cache lines are fetched by pairs, so isolated objects take whole pairs,
+ * the same as NFS_MaxLineSize of TBB.
+ */
+const size_t isolatedObjectAlignment = 128;
+
+/*
+ * With the size aligned up to the alignment, small objects come from the bins
+ * of multiples of isolatedObjectAlignment, and large objects end at a line end.
+ */
+extern "C" void * scalable_malloc_isolated(size_t size)
+{
+    size_t isolatedSize = alignUp(size? size : 1, isolatedObjectAlignment);
+    void *result = isolatedSize? allocateAligned(isolatedSize, isolatedObjectAlignment) : NULL;
+    if (!result)
+        errno = ENOMEM;
+    return result;
+}
+
 /********* end code for aligned allocation API **********/
 
 /********* Code for scalable_msize       ***********/
@@ -2055,3 +2381,170 @@ extern "C" size_t safer_scalable_msize (void *object, size_t (*original_msize)(v
 }
 
 /********* End code for scalable_msize   ***********/
+
+/********* Code for scalable_allocation_mode   ***********/
+
+extern "C" int scalable_allocation_mode(int param, intptr_t value)
+{
+    switch (param) {
+    case TBBMALLOC_USE_HUGE_PAGES:
+        if (value != 0 && value != 1)
+            return TBBMALLOC_INVALID_PARAM;
+        /* Huge pages availability is known only after initialization,
+           and initialization must not drop the mode set here. */
+        if (!isMallocInitialized())
+            doInitialization();
+        hugePages.setMode(value);
+        return !value || hugePages.isSupported()? TBBMALLOC_OK : TBBMALLOC_NO_EFFECT;
+    case TBBMALLOC_SET_SOFT_HEAP_LIMIT:
+        if (value < 0)
+            return TBBMALLOC_INVALID_PARAM;
+        if (!isMallocInitialized())
+            doInitialization();
+        rawMemoryUsage.setSoftLimit(value);
+        // the limit may be already exceeded
+        relieveMemoryPressure(0);
+        return TBBMALLOC_OK;
+    case TBBMALLOC_SET_HEAP_SAMPLING_INTERVAL:
+        if (value < 0)
+            return TBBMALLOC_INVALID_PARAM;
+        if (!isMallocInitialized())
+            doInitialization();
+        return setHeapSamplingInterval(value);
+    }
+    return TBBMALLOC_INVALID_PARAM;
+}
+
+/********* End code for scalable_allocation_mode   ***********/
+
+/********* Code for scalable_allocation_command   ***********/
+
+/* The incremental cleanup goes in passes over the buffers, split into portions.
+   The first portions release the large object cache, largeObjectBinsPerStep
+   bins each; the last one releases free backend regions. The state is shared
+   by all threads without synchronization, races only make some portions
+   to be done twice or skipped, that is harmless. */
+static const unsigned largeObjectBinsPerStep = 64;
+static const unsigned largeObjectPortions =
+    (numLargeBlockBins+largeObjectBinsPerStep-1)/largeObjectBinsPerStep;
+static unsigned nextCleanPortion;
+static bool releasedInPass;
+
+/* Performs portions of cleanup until timeBudget microseconds are over.
+   At least one portion is done, so the budget can be exceeded slightly.
+   TBBMALLOC_NO_EFFECT is returned when a whole pass released nothing. */
+static int cleanAllBuffersIncrementally(size_t timeBudget)
+{
+    tbb::tick_count start = tbb::tick_count::now();
+
+    if (cleanThreadBuffers())
+        releasedInPass = true;
+    if (releaseRetiredHeaps())
+        releasedInPass = true;
+    for (;;) {
+        unsigned portion = nextCleanPortion;
+        bool released = portion < largeObjectPortions?
+            releaseCachedLargeObjects(largeObjectBinsPerStep) : freeBlocks.releaseFreeRegions();
+        if (released)
+            releasedInPass = true;
+        if (portion >= largeObjectPortions) {
+            bool releasedSomething = releasedInPass;
+            nextCleanPortion = 0;
+            releasedInPass = false;
+            return releasedSomething? TBBMALLOC_OK : TBBMALLOC_NO_EFFECT;
+        }
+        nextCleanPortion = portion+1;
+        if ((tbb::tick_count::now()-start).seconds()*1E6 >= timeBudget)
+            return TBBMALLOC_OK;
+    }
+}
+
+extern "C" int scalable_allocation_command(int cmd, void *param)
+{
+    bool released = false;
+
+    switch (cmd) {
+    case TBBMALLOC_CLEAN_THREAD_BUFFERS:
+        if (param)
+            return TBBMALLOC_INVALID_PARAM;
+        if (!isMallocInitialized())
+            return TBBMALLOC_NO_EFFECT;
+        released = cleanThreadBuffers();
+        break;
+    case TBBMALLOC_CLEAN_ALL_BUFFERS:
+        if (param)
+            return TBBMALLOC_INVALID_PARAM;
+        if (!isMallocInitialized())
+            return TBBMALLOC_NO_EFFECT;
+        released = cleanThreadBuffers();
+        if (releaseRetiredHeaps())
+            released = true;
+        if (releaseCachedLargeObjects(numLargeBlockBins))
+            released = true;
+        // after the pool, as it may hold the last free blocks of a region
+        if (freeBlocks.releaseFreeRegions())
+            released = true;
+        break;
+    case TBBMALLOC_CLEAN_ALL_BUFFERS_INCREMENTAL:
+        if (!param)
+            return TBBMALLOC_INVALID_PARAM;
+        if (!isMallocInitialized())
+            return TBBMALLOC_NO_EFFECT;
+        return cleanAllBuffersIncrementally(*(size_t*)param);
+    case TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT:
+        if (!param)
+            return TBBMALLOC_INVALID_PARAM;
+        getLargeObjectCacheStatistics((ScalableLargeObjectCacheStat*)param);
+        return TBBMALLOC_OK;
+    case TBBMALLOC_DUMP_HEAP_PROFILE:
+        if (!param)
+            return TBBMALLOC_INVALID_PARAM;
+        return dumpHeapProfile((const char*)param);
+    default:
+        return TBBMALLOC_INVALID_PARAM;
+    }
+    return released? TBBMALLOC_OK : TBBMALLOC_NO_EFFECT;
+}
+
+/********* End code for scalable_allocation_command   ***********/
+
+/********* Code for scalable_allocation_stats   ***********/
+
+extern "C" int scalable_allocation_stats(ScalableAllocationStat *stat)
+{
+    if (!stat)
+        return TBBMALLOC_INVALID_PARAM;
+    memset(stat, 0, sizeof(ScalableAllocationStat));
+    if (!isMallocInitialized())
+        return TBBMALLOC_OK;
+    MALLOC_ASSERT( numBlockBins <= TBBMALLOC_MAX_SIZE_CLASSES, ASSERT_TEXT );
+
+    intptr_t balance[numBlockBins];
+    for (unsigned i=0; i<numBlockBins; i++)
+        balance[i] = exitedThreadsBalance[i];
+    {
+        MallocMutex::scoped_lock lock(threadListLock);
+        for (TLSData *tls = threadList; tls; tls = tls->nextThread) {
+            for (unsigned i=0; i<numBlockBins; i++)
+                balance[i] += tls->bin[i].getObjectsBalance();
+            size_t poolBlocks = tls->pool.getSize();
+            stat->threadPoolBlocks += poolBlocks;
+            if (poolBlocks > stat->maxThreadPoolBlocks)
+                stat->maxThreadPoolBlocks = poolBlocks;
+            stat->threads++;
+        }
+    }
+    stat->sizeClasses = numBlockBins;
+    for (unsigned i=0; i<numBlockBins; i++) {
+        stat->sizeClassObjectSize[i] = binObjectSize[i];
+        // counters of different threads are not read at once
+        stat->sizeClassBytes[i] = balance[i]>0? balance[i]*binObjectSize[i] : 0;
+    }
+    stat->mappedBytes = rawMemoryUsage.getCurrent();
+    getLargeObjectUsage(&stat->largeObjects, &stat->largeObjectBytes);
+    getLargeObjectCacheStatistics(&stat->largeObjectCache);
+    stat->orphanedBlocks = orphanedBlocks->getNumBlocks();
+    return TBBMALLOC_OK;
+}
+
+/********* End code for scalable_allocation_stats   ***********/
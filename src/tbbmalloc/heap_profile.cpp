@@ -0,0 +1,399 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#include "tbbmalloc_internal.h"
+#include <stdlib.h> // for getenv()
+#include <string.h> // for memset()
+
+#if __linux__ && __GLIBC__ || __APPLE__
+#define MALLOC_HEAP_PROFILE_SUPPORTED 1
+#include <execinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#else
+#define MALLOC_HEAP_PROFILE_SUPPORTED 0
+#endif
+
+/********* Sampling heap profiler ************/
+
+/*
+ * Every thread counts down bytes allocated by it, and when the counter
+ * goes below zero, the allocation is sampled: its call stack is recorded.
+ * Distances between samples are exponentially distributed with the mean of
+ * samplingInterval bytes, so the number of samples taken of an allocation
+ * of any size is proportional to its size. The profile is written in
+ * the text format of gperftools heap profiles, that pprof reads and scales
+ * back by the sampling interval.
+ */
+
+namespace rml {
+namespace internal {
+
+uintptr_t heapSamplesNum;
+
+#if MALLOC_HEAP_PROFILE_SUPPORTED
+
+const unsigned maxSampleStackDepth = 32;
+/* sampleAllocation and the allocation function called by the user */
+const int framesToSkip = 2;
+const unsigned numSampledStacks = 4*1024;    // power of 2
+const unsigned numSampledObjects = 64*1024;  // power of 2
+/* While sampling is off, threads check whether it is switched on this often */
+const intptr_t samplingCheckPeriod = 1024*1024;
+
+struct SampledStack {
+    SampledStack *next;        // in the hash bucket
+    uintptr_t     hash;
+    unsigned      depth;
+    void         *frames[maxSampleStackDepth];
+    uintptr_t     allocObjects,
+                  allocBytes,
+                  inUseObjects,
+                  inUseBytes;
+};
+
+struct SampledObject {
+    SampledObject *next;       // in the hash bucket or in the free list
+    void          *object;
+    size_t         size;
+    SampledStack  *stack;
+};
+
+/* The tables have fixed sizes; samples that don't fit are dropped. */
+struct HeapProfileData {
+    SampledStack  *stackBuckets[numSampledStacks];
+    SampledStack   stacks[numSampledStacks];
+    unsigned       stacksUsed;
+    SampledObject *objectBuckets[numSampledObjects];
+    SampledObject  objects[numSampledObjects];
+    unsigned       objectsUsed;
+    SampledObject *freeObjects;
+    uintptr_t      droppedSamples;
+};
+
+static MallocMutex profileLock;
+static HeapProfileData *profile;   // mapped at the first sample
+static size_t samplingInterval;    // 0 if sampling is off
+static size_t profileInterval;     // the last non-zero samplingInterval
+static uint32_t randomState;
+static const char *dumpFileName;
+static volatile sig_atomic_t dumpRequested;
+
+/* -ln(x/2^32) for 0 < x < 2^32, computed without libm that is not linked */
+static double minusLogOfFraction(uint32_t x)
+{
+    int e = 31;
+    while (!(x >> e))
+        e--;
+    double m = (double)x / (double)((uint32_t)1 << e); // in [1, 2)
+    double t = (m-1)/(m+1), t2 = t*t;
+    double lnM = 2*t*(1 + t2*(1./3 + t2*(1./5 + t2/7)));
+    return (32-e)*0.69314718055994531 - lnM;
+}
+
+/* Must be called under profileLock */
+static intptr_t nextSampleDistance(size_t interval)
+{
+    if (!randomState)
+        randomState = 2463534242U;
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (intptr_t)(minusLogOfFraction(randomState) * interval) + 1;
+}
+
+static inline unsigned hashObject(const void *object)
+{
+    return (unsigned)(((uintptr_t)object >> 4) * 2654435761U) & (numSampledObjects-1);
+}
+
+/* Must be called under profileLock */
+static SampledStack *findStack(void **frames, unsigned depth)
+{
+    uintptr_t hash = depth;
+    for (unsigned i=0; i<depth; i++)
+        hash = hash*31 + (uintptr_t)frames[i];
+    SampledStack **bucket = profile->stackBuckets + (hash & (numSampledStacks-1));
+    for (SampledStack *s = *bucket; s; s = s->next)
+        if (s->hash == hash && s->depth == depth
+            && !memcmp(s->frames, frames, depth*sizeof(void*)))
+            return s;
+    if (profile->stacksUsed == numSampledStacks)
+        return NULL;
+    SampledStack *s = profile->stacks + profile->stacksUsed++;
+    s->hash = hash;
+    s->depth = depth;
+    memcpy(s->frames, frames, depth*sizeof(void*));
+    s->next = *bucket;
+    *bucket = s;
+    return s;
+}
+
+/* Must be called under profileLock */
+static void recordSample(void *object, size_t size, void **frames, unsigned depth)
+{
+    SampledStack *stack = findStack(frames, depth);
+    SampledObject *obj = profile->freeObjects;
+    if (obj)
+        profile->freeObjects = obj->next;
+    else if (profile->objectsUsed < numSampledObjects)
+        obj = profile->objects + profile->objectsUsed++;
+    if (!stack || !obj) {
+        if (obj) {
+            obj->next = profile->freeObjects;
+            profile->freeObjects = obj;
+        }
+        profile->droppedSamples++;
+        return;
+    }
+    stack->allocObjects++;
+    stack->allocBytes += size;
+    stack->inUseObjects++;
+    stack->inUseBytes += size;
+    obj->object = object;
+    obj->size = size;
+    obj->stack = stack;
+    SampledObject **bucket = profile->objectBuckets + hashObject(object);
+    obj->next = *bucket;
+    *bucket = obj;
+    heapSamplesNum++;
+}
+
+/* Must be called under profileLock. Returns the unlinked record or NULL. */
+static SampledObject *unlinkSample(void *object)
+{
+    if (!profile)
+        return NULL;
+    for (SampledObject **o = profile->objectBuckets + hashObject(object); *o; o = &(*o)->next)
+        if ((*o)->object == object) {
+            SampledObject *result = *o;
+            *o = result->next;
+            return result;
+        }
+    return NULL;
+}
+
+intptr_t sampleAllocation(void *object, size_t size)
+{
+    if (dumpRequested) {
+        dumpRequested = 0;
+        dumpHeapProfile(dumpFileName);
+    }
+    size_t interval = samplingInterval;
+    if (!interval)
+        return samplingCheckPeriod;
+
+    void *frames[maxSampleStackDepth+framesToSkip];
+    int depth = backtrace(frames, maxSampleStackDepth+framesToSkip) - framesToSkip;
+
+    MallocMutex::scoped_lock lock(profileLock);
+    if (!profile)
+        profile = (HeapProfileData*)getRawMemory(sizeof(HeapProfileData), /*useMapMem=*/true);
+    if (profile)
+        recordSample(object, size, frames+framesToSkip, depth>0? depth : 0);
+    return nextSampleDistance(interval);
+}
+
+void forgetHeapSample(void *object)
+{
+    MallocMutex::scoped_lock lock(profileLock);
+    if (SampledObject *obj = unlinkSample(object)) {
+        obj->stack->inUseObjects--;
+        obj->stack->inUseBytes -= obj->size;
+        obj->next = profile->freeObjects;
+        profile->freeObjects = obj;
+        heapSamplesNum--;
+    }
+}
+
+void moveHeapSample(void *from, void *to)
+{
+    MallocMutex::scoped_lock lock(profileLock);
+    if (SampledObject *obj = unlinkSample(from)) {
+        obj->object = to;
+        SampledObject **bucket = profile->objectBuckets + hashObject(to);
+        obj->next = *bucket;
+        *bucket = obj;
+    }
+}
+
+int setHeapSamplingInterval(size_t bytes)
+{
+    // the first call of backtrace() can load libraries and allocate memory,
+    // so it is done here and not in the middle of an allocation
+    if (bytes) {
+        void *frame;
+        backtrace(&frame, 1);
+    }
+    if (bytes)
+        profileInterval = bytes;
+    samplingInterval = bytes;
+    return TBBMALLOC_OK;
+}
+
+static void requestHeapProfileDump(int)
+{
+    dumpRequested = 1;
+}
+
+void initHeapProfiler()
+{
+    const char *env = getenv("TBB_MALLOC_HEAP_PROFILE");
+    dumpFileName = env? env : "tbbmalloc.heap";
+    // backtrace() is not called during initialization, see setHeapSamplingInterval
+    if ((env = getenv("TBB_MALLOC_HEAP_SAMPLING_INTERVAL")))
+        profileInterval = samplingInterval = strtoul(env, NULL, 10);
+    if ((env = getenv("TBB_MALLOC_HEAP_PROFILE_SIGNAL"))) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = requestHeapProfileDump;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(atoi(env), &action, NULL);
+    }
+}
+
+/*
+ * The profile is written without memory allocation, as it is done under
+ * profileLock that allocations may need.
+ */
+class ProfileWriter {
+    int      fd;
+    unsigned used;
+    bool     failed;
+    char     buf[4096];
+public:
+    ProfileWriter(int file) : fd(file), used(0), failed(false) {}
+    void flush() {
+        for (unsigned done = 0; done < used && !failed; ) {
+            ssize_t written = write(fd, buf+done, used-done);
+            if (written > 0)
+                done += written;
+            else
+                failed = true;
+        }
+        used = 0;
+    }
+    void putChar(char c) {
+        if (used == sizeof(buf))
+            flush();
+        buf[used++] = c;
+    }
+    void put(const char *str) {
+        while (*str)
+            putChar(*str++);
+    }
+    void putNumber(uintptr_t value, unsigned base) {
+        char digits[2*sizeof(uintptr_t)*4];
+        int n = 0;
+        do {
+            digits[n++] = "0123456789abcdef"[value % base];
+            value /= base;
+        } while (value);
+        while (n)
+            putChar(digits[--n]);
+    }
+    void putCounts(uintptr_t inUseObjects, uintptr_t inUseBytes,
+                   uintptr_t allocObjects, uintptr_t allocBytes) {
+        putNumber(inUseObjects, 10); put(": ");
+        putNumber(inUseBytes, 10); put(" [");
+        putNumber(allocObjects, 10); put(": ");
+        putNumber(allocBytes, 10); put("] @");
+    }
+    bool ok() const { return !failed; }
+};
+
+int dumpHeapProfile(const char *fileName)
+{
+    int fd = open(fileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0)
+        return TBBMALLOC_INVALID_PARAM;
+    ProfileWriter out(fd);
+    {
+        MallocMutex::scoped_lock lock(profileLock);
+        unsigned numStacks = profile? profile->stacksUsed : 0;
+        uintptr_t total[4] = {0, 0, 0, 0};
+        for (unsigned i=0; i<numStacks; i++) {
+            const SampledStack &s = profile->stacks[i];
+            total[0] += s.inUseObjects;
+            total[1] += s.inUseBytes;
+            total[2] += s.allocObjects;
+            total[3] += s.allocBytes;
+        }
+        out.put("heap profile: ");
+        out.putCounts(total[0], total[1], total[2], total[3]);
+        out.put(" heap_v2/");
+        out.putNumber(profileInterval, 10);
+        out.putChar('\n');
+        for (unsigned i=0; i<numStacks; i++) {
+            const SampledStack &s = profile->stacks[i];
+            out.putCounts(s.inUseObjects, s.inUseBytes, s.allocObjects, s.allocBytes);
+            for (unsigned j=0; j<s.depth; j++) {
+                out.put(" 0x");
+                out.putNumber((uintptr_t)s.frames[j], 16);
+            }
+            out.putChar('\n');
+        }
+    }
+#if __linux__
+    // pprof needs the mappings to find symbols of the addresses
+    out.put("\nMAPPED_LIBRARIES:\n");
+    out.flush();
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        char buf[4096];
+        ssize_t bytes;
+        while ((bytes = read(maps, buf, sizeof(buf))) > 0)
+            if (write(fd, buf, bytes) != bytes)
+                break;
+        close(maps);
+    }
+#endif
+    out.flush();
+    bool ok = out.ok();
+    close(fd);
+    return ok? TBBMALLOC_OK : TBBMALLOC_INVALID_PARAM;
+}
+
+#else /* MALLOC_HEAP_PROFILE_SUPPORTED */
+
+intptr_t sampleAllocation(void *, size_t) { return (intptr_t)(~(uintptr_t)0 >> 1); }
+void forgetHeapSample(void *) {}
+void moveHeapSample(void *, void *) {}
+int setHeapSamplingInterval(size_t bytes) { return bytes? TBBMALLOC_NO_EFFECT : TBBMALLOC_OK; }
+void initHeapProfiler() {}
+int dumpHeapProfile(const char *) { return TBBMALLOC_UNSUPPORTED; }
+
+#endif /* MALLOC_HEAP_PROFILE_SUPPORTED */
+
+} // namespace internal
+} // namespace rml
+
+/********* End of sampling heap profiler ************/
@@ -27,6 +27,7 @@
 */
 
 #include "tbbmalloc_internal.h"
+#include <string.h> // for memset()
 
 /********* Allocation of large objects ************/
 
@@ -39,12 +40,60 @@ static struct LargeBlockCacheStat {
     size_t cacheSize;
 } loCacheStat;
 
- /*
-  * The number of bins to cache large objects.
-  */
-const uint32_t numLargeBlockBins = 1024; // for 1024 max cached size is near 8MB
- 
+/* Large objects in use and memory taken by them, for scalable_allocation_stats */
+static struct LargeObjectUsage {
+    uintptr_t objects;
+    uintptr_t bytes;
+} loUsage;
+
+/*
+ * Large objects up to maxLinearCachedLargeObjectSize are cached in bins
+ * of largeBlockCacheStep. Bigger ones are rounded up to a logarithmic bin size,
+ * so no more than 1/9 of the memory is added, and blocks of a bin can be
+ * reused for any request of the bin.
+ */
+static inline unsigned getLargeObjectOrder(size_t size)
+{
+    unsigned order = 20;
+    while ((size-1)>>(order+1))
+        order++;
+    return order;
+}
+
+static size_t alignToLargeBin(size_t size)
+{
+    if (size <= maxLinearCachedLargeObjectSize || size > maxCachedLargeObjectSize)
+        return alignUp(size, largeBlockCacheStep);
+    return alignUp(size, (size_t)1 << (getLargeObjectOrder(size)-3));
+}
+
+/* The largest size of a bin not bigger than the size. */
+static size_t alignDownToLargeBin(size_t size)
+{
+    if (size <= maxLinearCachedLargeObjectSize)
+        return alignDown(size, largeBlockCacheStep);
+    unsigned order = getLargeObjectOrder(size+1); // for powers of 2 too
+    return alignDown(size, (size_t)1 << (order-3));
+}
+
+/* numLargeBlockBins for not cached sizes */
+static inline size_t getLargeBinIdx(size_t size)
+{
+    if (size <= maxLinearCachedLargeObjectSize)
+        return (size-minLargeObjectSize)/largeBlockCacheStep;
+    if (size > maxCachedLargeObjectSize)
+        return numLargeBlockBins;
+    unsigned order = getLargeObjectOrder(size);
+    return numLinearLargeBlockBins - largeBinsPerOrder + largeBinsPerOrder*(order-20)
+        + ((size-1)>>(order-3));
+}
 
+/*
+ * LRU list of blocks of the same size. The number of blocks cached
+ * is adapted to the workload: if blocks evicted because of the capacity
+ * were missed later, the capacity grows. Blocks not reused for long
+ * are released based on their age, and then the capacity is halved.
+ */
 class CachedBlocksList {
     LargeMemoryBlock *first,
                      *last;
@@ -58,14 +107,28 @@ class CachedBlocksList {
        Set on cache miss. */
     intptr_t      ageThreshold;
 
+    unsigned      num,
+                  capacity;         // 0 stands for 1
+    unsigned      evictedSinceMiss;
+    // counters for scalable_allocation_command, updated under the lock
+    uintptr_t     hits,
+                  misses,
+                  evictions;
+
     MallocMutex   lock;
     /* CachedBlocksList should be placed in zero-initialized memory,
        ctor not needed. */
     CachedBlocksList();
+
+    LargeMemoryBlock *removeLast();
 public:
-    inline void push(LargeMemoryBlock* ptr);
+    inline LargeMemoryBlock* push(LargeMemoryBlock* ptr, unsigned maxCapacity);
     inline LargeMemoryBlock* pop();
-    void releaseLastIfOld(uintptr_t currAge, size_t size);
+    bool remove(LargeMemoryBlock *ptr);
+    bool isFull() const { return num >= (capacity? capacity : 1); }
+    void releaseLastIfOld(uintptr_t currAge);
+    bool releaseAll();
+    void addStatistics(ScalableLargeObjectCacheStat *stat, size_t blockSize) const;
 };
 
 /*
@@ -81,12 +144,55 @@ static CachedBlocksList* globalCachedBlockBins = (CachedBlocksList*)globalCached
  */
 static uintptr_t cleanupCacheIfNeed();
 
-void CachedBlocksList::push(LargeMemoryBlock *ptr)
+static void freeLargeBlockMemory(LargeMemoryBlock *lmb)
+{
+    removeBackRef(lmb->backRefIdx);
+    if (lmb->fromHugePages)
+        freeHugeRawMemory(lmb, lmb->unalignedSize);
+    else
+        freeRawMemory(lmb, lmb->unalignedSize, lmb->fromMapMemory);
+}
+
+static void freeLargeBlockList(LargeMemoryBlock *toRelease)
+{
+    while ( toRelease ) {
+        LargeMemoryBlock *helper = toRelease->next;
+        freeLargeBlockMemory(toRelease);
+        toRelease = helper;
+    }
+}
+
+/* Must be called under the lock */
+LargeMemoryBlock *CachedBlocksList::removeLast()
+{
+    LargeMemoryBlock *result = last;
+    MALLOC_ASSERT( result, ASSERT_TEXT );
+    last = result->prev;
+    if (last) {
+        last->next = NULL;
+        oldest = last->age;
+    } else {
+        first = NULL;
+        oldest = 0;
+    }
+    result->next = NULL;
+    num--;
+    return result;
+}
+
+/* Returns the least recently used block evicted to keep the capacity, or NULL */
+LargeMemoryBlock *CachedBlocksList::push(LargeMemoryBlock *ptr, unsigned maxCapacity)
 {   
+    LargeMemoryBlock *evicted = NULL;
     ptr->prev = NULL;
     ptr->age  = cleanupCacheIfNeed ();
 
     MallocMutex::scoped_lock scoped_cs(lock);
+    if (isFull()) {
+        evicted = removeLast();
+        evictedSinceMiss++;
+        evictions++;
+    }
     ptr->next = first;
     first = ptr;
     if (ptr->next) ptr->next->prev = ptr;
@@ -95,6 +201,12 @@ void CachedBlocksList::push(LargeMemoryBlock *ptr)
         oldest = ptr->age;
         last = ptr;
     }
+    num++;
+    if (!capacity)
+        capacity = 1;
+    if (capacity > maxCapacity)
+        capacity = maxCapacity;
+    return evicted;
 }
 
 LargeMemoryBlock *CachedBlocksList::pop()
@@ -112,16 +224,48 @@ LargeMemoryBlock *CachedBlocksList::pop()
                 last = NULL;
                 oldest = 0;
             }
+            num--;
+            hits++;
         } else {
             /* If cache miss occured, set ageThreshold to twice the difference 
                between current time and last time cache was cleaned. */
             ageThreshold = 2*(currAge - lastCleanedAge);
+            misses++;
+            /* the evicted blocks could be reused, so the bin needs more
+               capacity; it grows at most twice per miss */
+            if (evictedSinceMiss) {
+                unsigned curr = capacity? capacity : 1;
+                capacity = curr + (evictedSinceMiss < curr? evictedSinceMiss : curr);
+                evictedSinceMiss = 0;
+            }
         }
     }
     return result;
 }
 
-void CachedBlocksList::releaseLastIfOld(uintptr_t currAge, size_t size)
+/* Returns false if the block is not in the list (was taken already). */
+bool CachedBlocksList::remove(LargeMemoryBlock *ptr)
+{
+    MallocMutex::scoped_lock scoped_cs(lock);
+    LargeMemoryBlock *curr = first;
+    while (curr && curr != ptr)
+        curr = curr->next;
+    if (!curr)
+        return false;
+    if (ptr == last)
+        removeLast();
+    else {
+        if (ptr->prev)
+            ptr->prev->next = ptr->next;
+        else
+            first = ptr->next;
+        ptr->next->prev = ptr->prev;
+        num--;
+    }
+    return true;
+}
+
+void CachedBlocksList::releaseLastIfOld(uintptr_t currAge)
 {
     LargeMemoryBlock *toRelease = NULL;
  
@@ -133,6 +277,7 @@ void CachedBlocksList::releaseLastIfOld(uintptr_t currAge, size_t size)
         if (last && (intptr_t)(currAge - last->age) > ageThreshold) {
             do {
                 last = last->prev;
+                num--;
             } while (last && (intptr_t)(currAge - last->age) > ageThreshold);
             if (last) {
                 toRelease = last->next;
@@ -145,16 +290,83 @@ void CachedBlocksList::releaseLastIfOld(uintptr_t currAge, size_t size)
             }
             MALLOC_ASSERT( toRelease, ASSERT_TEXT );
             lastCleanedAge = toRelease->age;
+            // the bin holds more blocks than the workload reuses
+            if (capacity > 1)
+                capacity = capacity/2 > num? capacity/2 : num;
         } 
-        else 
-            return;
     }
-    while ( toRelease ) {
-        LargeMemoryBlock *helper = toRelease->next;
-        removeBackRef(toRelease->backRefIdx);
-        freeRawMemory(toRelease, size, toRelease->fromMapMemory);
-        toRelease = helper;
+    freeLargeBlockList(toRelease);
+}
+
+bool CachedBlocksList::releaseAll()
+{
+    LargeMemoryBlock *toRelease = NULL;
+
+    if (!first) return false;
+    {
+        MallocMutex::scoped_lock scoped_cs(lock);
+        toRelease = first;
+        first = last = NULL;
+        oldest = 0;
+        num = 0;
     }
+    bool released = toRelease;
+    freeLargeBlockList(toRelease);
+    return released;
+}
+
+/* Read without the lock, so the values are approximate under concurrent use */
+void CachedBlocksList::addStatistics(ScalableLargeObjectCacheStat *stat, size_t blockSize) const
+{
+    stat->hits += hits;
+    stat->misses += misses;
+    stat->evictions += evictions;
+    stat->cachedBlocks += num;
+    stat->cachedBytes += num*blockSize;
+}
+
+/* Bin to start the next releaseCachedLargeObjects from. Races on it
+   only make some bins to be visited twice or skipped, that is harmless. */
+static unsigned nextBinToClean;
+
+/*
+ * Releases all blocks cached in binsToClean bins, continuing round robin
+ * from where the previous call stopped. Returns true if something was released.
+ */
+bool releaseCachedLargeObjects (unsigned binsToClean)
+{
+    bool released = false;
+    unsigned idx = nextBinToClean;
+
+    for (unsigned i=0; i<binsToClean && i<numLargeBlockBins; i++) {
+        idx = (idx+1) % numLargeBlockBins;
+        if (globalCachedBlockBins[idx].releaseAll())
+            released = true;
+    }
+    nextBinToClean = idx;
+    return released;
+}
+
+static size_t getLargeBinBlockSize(unsigned idx)
+{
+    if (idx < numLinearLargeBlockBins)
+        return alignUp(minLargeObjectSize + idx*largeBlockCacheStep, largeBlockCacheStep);
+    unsigned logIdx = idx-numLinearLargeBlockBins;
+    unsigned order = 20 + logIdx/largeBinsPerOrder;
+    return ((size_t)1<<order) + (logIdx%largeBinsPerOrder + 1)*((size_t)1<<(order-3));
+}
+
+void getLargeObjectCacheStatistics(ScalableLargeObjectCacheStat *stat)
+{
+    memset(stat, 0, sizeof(ScalableLargeObjectCacheStat));
+    for (unsigned i=0; i<numLargeBlockBins; i++)
+        globalCachedBlockBins[i].addStatistics(stat, getLargeBinBlockSize(i));
+}
+
+void getLargeObjectUsage(size_t *objects, size_t *bytes)
+{
+    *objects = loUsage.objects;
+    *bytes = loUsage.bytes;
 }
 
 static uintptr_t cleanupCacheIfNeed ()
@@ -169,19 +381,9 @@ static uintptr_t cleanupCacheIfNeed ()
     uintptr_t currAge = (uintptr_t)AtomicIncrement((intptr_t&)loCacheStat.age);
 
     if ( 0 == currAge % cacheCleanupFreq ) {
-        size_t objSize;
-        int i;
-
-        for (i = numLargeBlockBins-1, 
-             objSize = (numLargeBlockBins-1)*largeBlockCacheStep+blockSize; 
-             i >= 0; 
-             i--, objSize-=largeBlockCacheStep) {
-            /* cached block size on iteration is
-             * i*largeBlockCacheStep+blockSize, it seems iterative
-             * computation of it improves performance.
-             */
+        for (int i = numLargeBlockBins-1; i >= 0; i--) {
             // release from cache blocks that are older than ageThreshold
-            globalCachedBlockBins[i].releaseLastIfOld(currAge, objSize);
+            globalCachedBlockBins[i].releaseLastIfOld(currAge);
         }
     }
     return currAge;
@@ -189,15 +391,15 @@ static uintptr_t cleanupCacheIfNeed ()
 
 static LargeMemoryBlock* getCachedLargeBlock (size_t size)
 {
-    MALLOC_ASSERT( size%largeBlockCacheStep==0, ASSERT_TEXT );
+    MALLOC_ASSERT( size==alignToLargeBin(size), ASSERT_TEXT );
     LargeMemoryBlock *lmb = NULL;
     // blockSize is the minimal alignment and thus the minimal size of a large object.
-    size_t idx = (size-minLargeObjectSize)/largeBlockCacheStep;
+    size_t idx = getLargeBinIdx(size);
     if (idx<numLargeBlockBins) {
         lmb = globalCachedBlockBins[idx].pop();
         if (lmb) {
             MALLOC_ITT_SYNC_ACQUIRED(globalCachedBlockBins+idx);
-            STAT_increment(getThreadId(), ThreadCommonCounters, allocCachedLargeBlk);
+            STAT_increment(getThreadId(), ThreadCommonCounters, allocCachedLargeObj);
         }
     }
     return lmb;
@@ -207,16 +409,36 @@ void* mallocLargeObject (size_t size, size_t alignment, bool startupAlloc)
 {
     LargeMemoryBlock* lmb;
     size_t headersSize = sizeof(LargeMemoryBlock)+sizeof(LargeObjectHdr);
-    size_t allocationSize = alignUp(size+headersSize+alignment, largeBlockCacheStep);
+    size_t allocationSize = alignToLargeBin(size+headersSize+alignment);
+    /* Objects not smaller than a huge page are mapped with huge pages, if possible.
+       Rounding up their size to huge page size allows to reuse them via cache;
+       a multiple of huge page size is a size of a logarithmic bin as well. */
+    bool useHugePages = !startupAlloc && allocationSize >= hugePageSize && hugePages.isEnabled();
+    if (useHugePages)
+        allocationSize = alignUp(allocationSize, hugePageSize);
 
     if (startupAlloc || !(lmb = getCachedLargeBlock(allocationSize))) {
         BackRefIdx backRefIdx;
 
+        if (!startupAlloc)
+            relieveMemoryPressure(allocationSize);
         if ((backRefIdx = BackRefIdx::newBackRef(/*largeObj=*/true)).isInvalid()) 
             return NULL;
-        lmb = (LargeMemoryBlock*)getRawMemory(allocationSize, /*useMapMem=*/startupAlloc);
-        if (!lmb) return NULL;
-        lmb->fromMapMemory = startupAlloc;
+        lmb = useHugePages? (LargeMemoryBlock*)getHugeRawMemory(allocationSize) : NULL;
+        if (lmb) {
+            lmb->fromHugePages = true;
+            lmb->fromMapMemory = true;
+        }
+        else {
+            bool useMapMem = startupAlloc || allocationSize >= minRemappableObjectSize;
+            lmb = (LargeMemoryBlock*)getRawMemory(allocationSize, useMapMem);
+            if (!lmb) {
+                removeBackRef(backRefIdx);
+                return NULL;
+            }
+            lmb->fromHugePages = false;
+            lmb->fromMapMemory = useMapMem;
+        }
         lmb->backRefIdx = backRefIdx;
         lmb->unalignedSize = allocationSize;
         STAT_increment(getThreadId(), ThreadCommonCounters, allocNewLargeObj);
@@ -229,21 +451,127 @@ void* mallocLargeObject (size_t size, size_t alignment, bool startupAlloc)
     setBackRef(header->backRefIdx, header);
  
     lmb->objectSize = size;
+    AtomicAdd(loUsage.objects, 1);
+    AtomicAdd(loUsage.bytes, lmb->unalignedSize);
 
     MALLOC_ASSERT( isLargeObject(alignedArea), ASSERT_TEXT );
     return alignedArea;
 }
 
+/*
+ * Grows the object by remapping its memory, so the data is not copied.
+ * The object keeps its offset from the page start, so its alignment is kept
+ * only for alignments up to largeObjectAlignment. Returns NULL if the object
+ * can't be remapped; it is left intact then.
+ */
+void* remapLargeObject (void *object, size_t size, size_t alignment)
+{
+    LargeObjectHdr *header = (LargeObjectHdr*)object - 1;
+    LargeMemoryBlock *lmb = header->memoryBlock;
+
+    // remapping could break huge page alignment
+    if (!lmb->fromMapMemory || lmb->fromHugePages || alignment > (size_t)largeObjectAlignment)
+        return NULL;
+    size_t offset = (uintptr_t)object - (uintptr_t)lmb;
+    // keep the size suitable for the cache
+    size_t newSize = alignToLargeBin(offset+size);
+    MALLOC_ASSERT( newSize > lmb->unalignedSize, ASSERT_TEXT );
+    size_t oldSize = lmb->unalignedSize;
+    relieveMemoryPressure(newSize - oldSize);
+    if (!(lmb = (LargeMemoryBlock*)remapRawMemory(lmb, oldSize, newSize)))
+        return NULL;
+    AtomicAdd(loUsage.bytes, newSize - oldSize);
+    lmb->unalignedSize = newSize;
+    lmb->objectSize = size;
+
+    void *result = (void*)((uintptr_t)lmb + offset);
+    header = (LargeObjectHdr*)result - 1;
+    header->memoryBlock = lmb;
+    setBackRef(header->backRefIdx, header);
+    if (heapSamplesNum && result != object)
+        moveHeapSample(object, result);
+    STAT_increment(getThreadId(), ThreadCommonCounters, reallocLargeObj);
+    return result;
+}
+
+/*
+ * The last mapped block put to the cache. A freed block adjacent to it
+ * is coalesced with it instead of evicting a block of the same size.
+ * The block can be taken from the cache meanwhile, so its address and size
+ * are kept to check adjacency without access to it.
+ */
+static MallocMutex coalesceLock;
+static LargeMemoryBlock *lastCachedMapped;
+static size_t lastCachedMappedSize;
+
+/* Adjacent mappings can be unmapped at once only with munmap */
+static bool canBeCoalesced(const LargeMemoryBlock *lmb)
+{
+#if __linux__ || __APPLE__ || __sun || __FreeBSD__
+    return lmb->fromMapMemory && !lmb->fromHugePages;
+#else
+    return false;
+#endif
+}
+
+/* Returns the coalesced block, or lmb itself if it has no free neighbour.
+   Must be called under coalesceLock. */
+static LargeMemoryBlock *coalesceWithLastCached(LargeMemoryBlock *lmb)
+{
+    LargeMemoryBlock *neighbour = lastCachedMapped;
+    size_t neighbourSize = lastCachedMappedSize,
+           totalSize = lmb->unalignedSize + neighbourSize;
+
+    if (!neighbour || totalSize > maxCachedLargeObjectSize
+        || ((uintptr_t)neighbour+neighbourSize != (uintptr_t)lmb
+            && (uintptr_t)lmb+lmb->unalignedSize != (uintptr_t)neighbour)
+        || !globalCachedBlockBins[getLargeBinIdx(neighbourSize)].remove(neighbour))
+        return lmb;
+    lastCachedMapped = NULL;
+    // the block was reused, and then a not mapped one got the same address
+    if (!canBeCoalesced(neighbour)) {
+        LargeMemoryBlock *evicted = globalCachedBlockBins[getLargeBinIdx(neighbourSize)].push(neighbour, ~0U);
+        if (evicted)
+            freeLargeBlockMemory(evicted);
+        return lmb;
+    }
+
+    LargeMemoryBlock *lower = neighbour < lmb? neighbour : lmb,
+                     *upper = neighbour < lmb? lmb : neighbour;
+    removeBackRef(upper->backRefIdx);
+    // the rest of the memory past the size of a bin is returned
+    size_t newSize = alignDownToLargeBin(totalSize);
+    if (newSize < totalSize)
+        freeRawMemory((char*)lower+newSize, totalSize-newSize, /*useMapMem=*/true);
+    lower->unalignedSize = newSize;
+    return lower;
+}
+
 static bool freeLargeObjectToCache (LargeMemoryBlock* largeBlock)
 {
-    size_t size = largeBlock->unalignedSize;
-    size_t idx = (size-minLargeObjectSize)/largeBlockCacheStep;
-    if (idx<numLargeBlockBins) {
-        MALLOC_ASSERT( size%largeBlockCacheStep==0, ASSERT_TEXT );
+    size_t idx = getLargeBinIdx(largeBlock->unalignedSize);
+    // under memory pressure the cache must not grow
+    if (idx<numLargeBlockBins && !rawMemoryUsage.exceedsLimit(0)) {
+        MALLOC_ASSERT( largeBlock->unalignedSize==alignToLargeBin(largeBlock->unalignedSize), ASSERT_TEXT );
+        LargeMemoryBlock *evicted;
+
+        if (canBeCoalesced(largeBlock)) {
+            MallocMutex::scoped_lock scoped_cs(coalesceLock);
+            if (globalCachedBlockBins[idx].isFull()) {
+                largeBlock = coalesceWithLastCached(largeBlock);
+                idx = getLargeBinIdx(largeBlock->unalignedSize);
+            }
+            lastCachedMapped = largeBlock;
+            lastCachedMappedSize = largeBlock->unalignedSize;
+        }
+        // a bin caches no more than maxCachedLargeObjectSize bytes
+        unsigned maxCapacity = maxCachedLargeObjectSize/largeBlock->unalignedSize;
         MALLOC_ITT_SYNC_RELEASING(globalCachedBlockBins+idx);
-        globalCachedBlockBins[idx].push(largeBlock);
+        evicted = globalCachedBlockBins[idx].push(largeBlock, maxCapacity);
+        if (evicted)
+            freeLargeBlockMemory(evicted);
 
-        STAT_increment(getThreadId(), ThreadCommonCounters, cacheLargeBlk);
+        STAT_increment(getThreadId(), ThreadCommonCounters, cacheLargeObj);
         return true;
     }
     return false;
@@ -255,10 +583,12 @@ void freeLargeObject (void *object)
 
     // overwrite backRefIdx to simplify double free detection
     header->backRefIdx = BackRefIdx();
+    AtomicAdd(loUsage.objects, -1);
+    AtomicAdd(loUsage.bytes, -header->memoryBlock->unalignedSize);
+    if (heapSamplesNum)
+        forgetHeapSample(object);
     if (!freeLargeObjectToCache(header->memoryBlock)) {
-        removeBackRef(header->memoryBlock->backRefIdx);
-        freeRawMemory(header->memoryBlock, header->memoryBlock->unalignedSize, 
-                      /*useMapMem=*/ header->memoryBlock->fromMapMemory);
+        freeLargeBlockMemory(header->memoryBlock);
         STAT_increment(getThreadId(), ThreadCommonCounters, freeLargeObj);
     }
 }
@@ -44,6 +44,7 @@
 
 #include <unistd.h> // for sysconf
 #include <dlfcn.h>
+#include "tbb/scalable_allocator.h"
 
 static long memoryPageSize;
 
@@ -52,6 +53,17 @@ static inline void initPageSize()
     memoryPageSize = sysconf(_SC_PAGESIZE);
 }
 
+/* As glibc does, alignment that is not a power of 2 is rounded up to the next one */
+static inline size_t alignmentPowerOfTwo(size_t alignment)
+{
+    if (alignment & (alignment-1)) {
+        for (size_t a = 1; a; a <<= 1)
+            if (a > alignment)
+                return a;
+    }
+    return alignment? alignment : 1;
+}
+
 /* For the expected behaviour (i.e., finding malloc/free/etc from libc.so, 
    not from ld-linux.so) dlsym(RTLD_NEXT) should be called from 
    a LD_PRELOADed library, not another dynamic library.
@@ -111,7 +123,13 @@ int posix_memalign(void **memptr, size_t alignment, size_t size) __THROW
    so we do not expect it to cause cyclic dependency with C RTL. */
 void * memalign(size_t alignment, size_t size)  __THROW
 {
-    return scalable_aligned_malloc(size, alignment);
+    return scalable_aligned_malloc(size, alignmentPowerOfTwo(alignment));
+}
+
+/* C11 aligned allocation; glibc treats it the same as memalign */
+void * aligned_alloc(size_t alignment, size_t size) __THROW
+{
+    return scalable_aligned_malloc(size, alignmentPowerOfTwo(alignment));
 }
 
 /* valloc allocates memory aligned on a page boundary */
@@ -127,17 +145,30 @@ void * valloc(size_t size) __THROW
 void * pvalloc(size_t size) __THROW
 {
     if (! memoryPageSize) initPageSize();
-    // align size up to the page size
-    size = ((size-1) | (memoryPageSize-1)) + 1;
+    // align size up to the page size, pvalloc(0) returns one page
+    size = size? ((size-1) | (memoryPageSize-1)) + 1 : memoryPageSize;
 
     return scalable_aligned_malloc(size, memoryPageSize);
 }
 
+size_t malloc_usable_size(void *ptr) __THROW
+{
+    return ptr? __TBB_internal_msize(ptr) : 0;
+}
+
+/* The allocator has no tunables of glibc malloc, so all of them are accepted and ignored */
 int mallopt(int /*param*/, int /*value*/) __THROW
 {
     return 1;
 }
 
+/* Returns 1 if some memory was released to the OS, 0 otherwise, as glibc does.
+   The pad is ignored, the allocator releases all memory it caches. */
+int malloc_trim(size_t /*pad*/) __THROW
+{
+    return TBBMALLOC_OK == scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+}
+
 } /* extern "C" */
 
 #if __linux__
@@ -192,6 +223,59 @@ void operator delete[](void* ptr, const std::nothrow_t&) throw() {
     scalable_free(ptr);
 }
 
+#if __cpp_sized_deallocation
+void operator delete(void* ptr, std::size_t sz) throw() {
+    scalable_free_sized(ptr, sz);
+}
+void operator delete[](void* ptr, std::size_t sz) throw() {
+    scalable_free_sized(ptr, sz);
+}
+#endif /* __cpp_sized_deallocation */
+
+#if __cpp_aligned_new
+/* Alignment of these is a power of 2 by the C++ standard */
+void* operator new(std::size_t sz, std::align_val_t al) {
+    void *res = scalable_aligned_malloc(sz, (size_t)al);
+#if TBB_USE_EXCEPTIONS
+    if (NULL == res)
+        throw std::bad_alloc();
+#endif /* TBB_USE_EXCEPTIONS */
+    return res;
+}
+void* operator new[](std::size_t sz, std::align_val_t al) {
+    void *res = scalable_aligned_malloc(sz, (size_t)al);
+#if TBB_USE_EXCEPTIONS
+    if (NULL == res)
+        throw std::bad_alloc();
+#endif /* TBB_USE_EXCEPTIONS */
+    return res;
+}
+void* operator new(std::size_t sz, std::align_val_t al, const std::nothrow_t&) throw() {
+    return scalable_aligned_malloc(sz, (size_t)al);
+}
+void* operator new[](std::size_t sz, std::align_val_t al, const std::nothrow_t&) throw() {
+    return scalable_aligned_malloc(sz, (size_t)al);
+}
+void operator delete(void* ptr, std::align_val_t) throw() {
+    scalable_aligned_free(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t) throw() {
+    scalable_aligned_free(ptr);
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) throw() {
+    scalable_aligned_free(ptr);
+}
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) throw() {
+    scalable_aligned_free(ptr);
+}
+void operator delete(void* ptr, std::size_t, std::align_val_t) throw() {
+    scalable_aligned_free(ptr);
+}
+void operator delete[](void* ptr, std::size_t, std::align_val_t) throw() {
+    scalable_aligned_free(ptr);
+}
+#endif /* __cpp_aligned_new */
+
 #endif /* MALLOC_LD_PRELOAD */
 
 
@@ -54,6 +54,7 @@ extern "C" {
 
 void   safer_scalable_free( void*, void (*)(void*) );
 void * safer_scalable_realloc( void*, size_t, void* );
+size_t safer_scalable_msize( void*, size_t (*)(void*) );
 
 bool __TBB_internal_find_original_malloc(int num, const char *names[], void *table[])  __attribute__ ((weak));
 
@@ -71,6 +72,7 @@ void* (*original_malloc_ptr)(size_t) = 0;
 void  (*original_free_ptr)(void*) = 0;
 static void* (*original_calloc_ptr)(size_t,size_t) = 0;
 static void* (*original_realloc_ptr)(void*,size_t) = 0;
+static size_t (*original_msize_ptr)(void*) = 0;
 
 #endif /* MALLOC_CHECK_RECURSION */
 
@@ -110,14 +112,15 @@ void ITT_DoOneTimeInitialization() {
 void init_tbbmalloc() {
 #if MALLOC_LD_PRELOAD
     if (malloc_proxy && __TBB_internal_find_original_malloc) {
-        const char *alloc_names[] = { "malloc", "free", "realloc", "calloc"};
-        void *orig_alloc_ptrs[4];
+        const char *alloc_names[] = { "malloc", "free", "realloc", "calloc", "malloc_usable_size"};
+        void *orig_alloc_ptrs[5];
 
-        if (__TBB_internal_find_original_malloc(4, alloc_names, orig_alloc_ptrs)) {
+        if (__TBB_internal_find_original_malloc(5, alloc_names, orig_alloc_ptrs)) {
             (void *&)original_malloc_ptr  = orig_alloc_ptrs[0];
             (void *&)original_free_ptr    = orig_alloc_ptrs[1];
             (void *&)original_realloc_ptr = orig_alloc_ptrs[2];
             (void *&)original_calloc_ptr  = orig_alloc_ptrs[3];
+            (void *&)original_msize_ptr   = orig_alloc_ptrs[4];
             MALLOC_ASSERT( original_malloc_ptr!=malloc_proxy,
                            "standard malloc not found" );
 /* It's workaround for a bug in GNU Libc 2.9 (as it shipped with Fedora 10).
@@ -193,6 +196,11 @@ void __TBB_internal_free(void *object)
     safer_scalable_free(object, original_free_ptr);
 }
 
+size_t __TBB_internal_msize(void *object)
+{
+    return safer_scalable_msize(object, original_msize_ptr);
+}
+
 } /* extern "C" */
 
 #endif /* MALLOC_LD_PRELOAD */
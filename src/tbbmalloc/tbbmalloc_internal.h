@@ -39,6 +39,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "tbb/scalable_allocator.h"
 #if MALLOC_CHECK_RECURSION
 #include <new>        /* for placement new */
 #endif
@@ -87,6 +88,24 @@ const uintptr_t blockSize = 16*1024;
  */
 const uint32_t largeBlockCacheStep = 8*1024;
 
+/*
+ * Large objects up to this size are cached in bins of largeBlockCacheStep.
+ */
+const size_t maxLinearCachedLargeObjectSize = 1024*1024;
+
+/*
+ * Bigger large objects are cached in logarithmic bins, there are this number
+ * of bins between each couple of powers of 2, till maxCachedLargeObjectSize.
+ */
+const uint32_t largeBinsPerOrder = 8;
+const size_t maxCachedLargeObjectSize = 64*1024*1024;
+
+/*
+ * The number of bins to cache large objects: 128 linear and 6*8 logarithmic.
+ */
+const uint32_t numLinearLargeBlockBins = maxLinearCachedLargeObjectSize/largeBlockCacheStep;
+const uint32_t numLargeBlockBins = numLinearLargeBlockBins + 6*largeBinsPerOrder;
+
 /*
  * Large blocks cache cleanup frequency.
  * It should be power of 2 for the fast checking.
@@ -98,6 +117,12 @@ const unsigned cacheCleanupFreq = 256;
  */
 static int largeObjectAlignment = 64; // 64 is common cache line size
 
+/*
+ * Size of a huge page; big blocks and large objects of at least this size
+ * are aligned to it when huge pages are in use.
+ */
+const size_t hugePageSize = 2*1024*1024;
+
 /********** End of numeric parameters controlling allocations *********/
 
 class BackRefIdx { // composite index to backreference array
@@ -123,6 +148,7 @@ struct LargeMemoryBlock {
     size_t            objectSize;    // the size requested by a client
     size_t            unalignedSize; // the size requested from getMemory
     bool              fromMapMemory;
+    bool              fromHugePages; // mapped by getHugeRawMemory
     BackRefIdx        backRefIdx;    // cached here, used copy is in LargeObjectHdr
 };
 
@@ -142,22 +168,26 @@ class BlockI {
 public:
     static BlockI *getRawBlock(bool startup);
     void initialize(void *bumpPtr);
+    void *getBumpPtr() const;
 };
 
 class FreeBlocks {
-    typedef void* (*RawAlloc) (size_t size, bool useMapMem);
-    typedef void (*RawFree) (void *object, size_t size, bool useMapMem);
+    typedef void* (*RawAlloc) (size_t size);
+    typedef void (*RawFree) (void *object, size_t size);
 
     RawAlloc rawAlloc;
     RawFree rawFree;
     size_t memReqSize;
 
-    bool mallocBigBlock();
+    bool mallocBigBlock(unsigned node);
 public:
     bool bootstrap(RawAlloc myAlloc, RawFree myFree, size_t myReqSize);
     BlockI *get(bool startup);
     void put(BlockI *block, bool startup);
     void putList(BlockI *head, BlockI *tail);
+    bool releaseFreeRegions();
+    // a hint only, as lists can be changed concurrently
+    bool isEmpty() const;
 };
 
 extern FreeBlocks freeBlocks;
@@ -261,10 +291,84 @@ bool isMallocInitializedExt();
 void* getRawMemory (size_t size, bool useMapMem);
 void freeRawMemory (void *object, size_t size, bool useMapMem);
 
+/*
+ * Huge pages are switched on by scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES, 1)
+ * or TBB_MALLOC_USE_HUGE_PAGES environment variable; they are used only when
+ * the OS supports them, otherwise regular pages are silently used instead.
+ */
+class HugePagesStatus {
+    bool        requested;     // switched on by a user
+    bool        transparent;   // transparent huge pages can be requested via madvise
+    bool        preallocated;  // there is a pool of preallocated huge pages
+
+    friend void* getHugeRawMemory (size_t size);
+public:
+    /* Memory currently mapped with huge pages (preallocated or advised
+       to be transparent ones), and total amount ever mapped. */
+    uintptr_t   currentBytes,
+                totalBytes;
+
+    void init();
+    void setMode(bool on) { requested = on; }
+    bool isSupported() const { return transparent || preallocated; }
+    // it is not under the lock, as the mode can be changed at any time anyway
+    bool isEnabled() const { return requested && isSupported(); }
+};
+
+extern HugePagesStatus hugePages;
+
+/* Memory the allocator got from the OS or the underlying allocator,
+   and the soft limit for it set with TBBMALLOC_SET_SOFT_HEAP_LIMIT. */
+class RawMemoryUsage {
+    uintptr_t   currentBytes;
+    uintptr_t   softLimit;    // 0 means no limit
+public:
+    void add(size_t bytes) { AtomicAdd(currentBytes, bytes); }
+    void sub(size_t bytes) { AtomicAdd(currentBytes, -bytes); }
+    size_t getCurrent() const { return currentBytes; }
+    void setSoftLimit(size_t limit) { softLimit = limit; }
+    // would the limit be exceeded if size bytes more are obtained
+    bool exceedsLimit(size_t size) const { return softLimit && currentBytes+size > softLimit; }
+};
+
+extern RawMemoryUsage rawMemoryUsage;
+
+/* Returns memory cached by the allocator to the OS if obtaining
+   size bytes more exceeds the soft heap limit. Called before
+   new memory is likely to be obtained. */
+void relieveMemoryPressure(size_t size);
+bool cleanThreadBuffers();
+bool releaseRetiredHeaps();
+
+/* Returns huge page aligned memory of size bytes (must be multiple of hugePageSize)
+   backed by huge pages, or NULL if they are unavailable. */
+void* getHugeRawMemory (size_t size);
+void freeHugeRawMemory (void *object, size_t size);
+
+/* Large objects of at least this size are mapped from the OS directly
+   if the mapping can be remapped, see remapLargeObject. */
+extern const size_t minRemappableObjectSize;
+void* remapRawMemory (void *object, size_t oldSize, size_t newSize);
+
 extern const uint32_t minLargeObjectSize;
 bool isLargeObject(void *object);
 void* mallocLargeObject (size_t size, size_t alignment, bool startupAlloc = false);
+void* remapLargeObject (void *object, size_t size, size_t alignment);
 void freeLargeObject (void *object);
+bool releaseCachedLargeObjects (unsigned binsToClean);
+void getLargeObjectCacheStatistics (ScalableLargeObjectCacheStat *stat);
+void getLargeObjectUsage (size_t *objects, size_t *bytes);
+
+/* Sampling heap profiler. sampleAllocation is called when the thread's
+   countdown of allocated bytes is over, and returns the next countdown.
+   The table of samples is checked on free only if heapSamplesNum is not 0. */
+extern uintptr_t heapSamplesNum;
+void initHeapProfiler();
+intptr_t sampleAllocation (void *object, size_t size);
+void forgetHeapSample (void *object);
+void moveHeapSample (void *from, void *to);
+int setHeapSamplingInterval (size_t bytes);
+int dumpHeapProfile (const char *fileName);
 
 unsigned int getThreadId();
 
@@ -46,6 +46,7 @@
 #include "../tbb/arena.cpp"
 #include "../tbb/scheduler.cpp"
 #include "../tbb/observer_proxy.cpp"
+#include "../tbb/tbb_trace.cpp"
 #include "../tbb/task.cpp"
 #include "../tbb/task_group_context.cpp"
 
@@ -0,0 +1,118 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#include "tbb/blocking_region.h"
+#include "tbb/task.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/atomic.h"
+#include "tbb/tick_count.h"
+#include "harness_assert.h"
+#include "harness.h"
+
+#if __TBB_ARENA_PER_MASTER
+
+//! Time after which a blocked thread gives up waiting
+const double Timeout = 20;
+
+tbb::atomic<int> Blocked;
+tbb::atomic<bool> Released;
+tbb::atomic<int> TimedOut;
+
+//! Sets Released; spawned when all the threads of the arena are blocked.
+class Releaser: public tbb::task {
+    /*override*/ tbb::task* execute() {
+        Released = true;
+        return NULL;
+    }
+};
+
+//! Blocks until Released. The last blocker spawns the releaser, which only an extra worker can take.
+class Blocker: public tbb::task {
+    int my_num_blockers;
+    /*override*/ tbb::task* execute() {
+        tbb::blocking_region region;
+        {
+            // Nested region must not lend one more worker
+            tbb::blocking_region nested;
+            if( ++Blocked==my_num_blockers )
+                spawn( *new( allocate_additional_child_of(*parent()) ) Releaser );
+        }
+        tbb::tick_count t0 = tbb::tick_count::now();
+        while( !Released ) {
+            if( (tbb::tick_count::now()-t0).seconds() > Timeout ) {
+                ++TimedOut;
+                break;
+            }
+            // Really block, so that the extra worker is not starved of CPU
+            Harness::Sleep( 1 );
+        }
+        return NULL;
+    }
+public:
+    Blocker( int num_blockers ) : my_num_blockers(num_blockers) {}
+};
+
+//! Blocks all the p threads of the arena, so that the releaser can run only on an extra worker.
+void TestExtraWorkers( int p ) {
+    tbb::task_scheduler_init init( p );
+    Blocked = 0;
+    Released = false;
+    TimedOut = 0;
+    tbb::empty_task& root = *new( tbb::task::allocate_root() ) tbb::empty_task;
+    root.set_ref_count( p+1 );
+    tbb::task_list list;
+    for( int i=0; i<p; ++i )
+        list.push_back( *new( root.allocate_child() ) Blocker(p) );
+    root.spawn_and_wait_for_all( list );
+    root.destroy( root );
+    ASSERT( !TimedOut, "blocked threads were not replaced by extra workers" );
+    ASSERT( Blocked==p, NULL );
+}
+
+//! The region has no effect in a thread without the task scheduler
+void TestNoScheduler() {
+    tbb::blocking_region region;
+}
+
+int TestMain () {
+    TestNoScheduler();
+    for( int p=MinThread; p<=MaxThread; ++p ) {
+        TestExtraWorkers( p );
+        // The workers must be employed as usual after leaving the regions
+        TestExtraWorkers( p );
+    }
+    return Harness::Done;
+}
+
+#else /* !__TBB_ARENA_PER_MASTER */
+
+int TestMain () {
+    return Harness::Skipped;
+}
+
+#endif /* !__TBB_ARENA_PER_MASTER */
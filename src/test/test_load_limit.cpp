@@ -0,0 +1,160 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+/**
+    The test checks the parts of the load-aware mode that do not depend on
+    the machine: parsing of the cgroup CPU quota and of the load average,
+    and the calculation of the number of workers from them.
+**/
+
+#include "harness_inject_scheduler.h"
+
+#define HARNESS_DEFAULT_MIN_THREADS 1
+#define HARNESS_DEFAULT_MAX_THREADS 1
+
+#include "harness.h"
+#include <cstdio>
+
+using tbb::internal::CalculateLoadLimit;
+
+void TestLoadLimit () {
+    // max_workers, num_cpus, load, num_own_threads, num_masters, current_limit
+    ASSERT( CalculateLoadLimit( 7, 8, -1, 1, 1, 7 )==7, "unknown load must not limit the workers" );
+    ASSERT( CalculateLoadLimit( 7, 2, -1, 1, 1, 7 )==1, "one CPU must be left for the master" );
+    ASSERT( CalculateLoadLimit( 2, 8, 1, 1, 1, 2 )==2, "more workers than requested are provided" );
+    ASSERT( CalculateLoadLimit( 7, 8, 8, 8, 1, 7 )==7, "own threads must not count as the foreign load" );
+    ASSERT( CalculateLoadLimit( 7, 8, 5, 1, 1, 7 )==3, "foreign load must take CPUs away from the workers" );
+    ASSERT( CalculateLoadLimit( 7, 8, 30, 1, 1, 7 )==1, "at least one worker must be left" );
+    // The room of 3.8 and 2.2 workers is within the hysteresis from the limit of 3
+    ASSERT( CalculateLoadLimit( 7, 8, 4.2, 1, 1, 3 )==3, "hysteresis is not applied to growing room" );
+    ASSERT( CalculateLoadLimit( 7, 8, 5.8, 1, 1, 3 )==3, "hysteresis is not applied to shrinking room" );
+    // The room of 4.6 and 1.4 workers is beyond it
+    ASSERT( CalculateLoadLimit( 7, 8, 3.4, 1, 1, 3 )==5, "limit does not grow with the room" );
+    ASSERT( CalculateLoadLimit( 7, 8, 6.6, 1, 1, 3 )==1, "limit does not shrink with the room" );
+    // The workers come back when the foreign load is gone
+    ASSERT( CalculateLoadLimit( 7, 8, 2, 2, 1, 1 )==7, "workers do not come back" );
+}
+
+#if __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char* const Root = "test_load_limit.tmp";
+char ProcCgroup[256];
+
+void WriteFile( const char* name, const char* text ) {
+    char path[256];
+    std::snprintf( path, sizeof(path), "%s/%s", Root, name );
+    FILE* f = std::fopen( path, "w" );
+    ASSERT( f, "cannot create a file for the test" );
+    std::fputs( text, f );
+    std::fclose( f );
+}
+
+void RemoveFile( const char* name ) {
+    char path[256];
+    std::snprintf( path, sizeof(path), "%s/%s", Root, name );
+    std::remove( path );
+}
+
+void MakeDir( const char* name ) {
+    char path[256];
+    std::snprintf( path, sizeof(path), "%s/%s", Root, name );
+    mkdir( path, 0755 );
+}
+
+int DetectQuota() {
+    return tbb::internal::DetectCpuQuota( ProcCgroup, Root );
+}
+
+void TestCpuQuota () {
+    mkdir( Root, 0755 );
+    std::snprintf( ProcCgroup, sizeof(ProcCgroup), "%s/cgroup", Root );
+    ASSERT( DetectQuota()==0, "quota is found without /proc/self/cgroup" );
+
+    // cgroup v2
+    WriteFile( "cgroup", "0::/grp\n" );
+    ASSERT( DetectQuota()==0, "quota is found without cpu.max" );
+    MakeDir( "grp" );
+    WriteFile( "grp/cpu.max", "150000 100000\n" );
+    ASSERT( DetectQuota()==2, "fractional cgroup v2 quota is not rounded up" );
+    WriteFile( "grp/cpu.max", "max 100000\n" );
+    ASSERT( DetectQuota()==0, "unlimited cgroup v2 quota is not recognized" );
+    RemoveFile( "grp/cpu.max" );
+    // Inside a cgroup namespace the group is mounted at the root
+    WriteFile( "cpu.max", "400000 100000\n" );
+    ASSERT( DetectQuota()==4, "cgroup v2 quota at the root of the namespace is not found" );
+    RemoveFile( "cpu.max" );
+
+    // cgroup v1; "cpuset" must not be taken for "cpu"
+    WriteFile( "cgroup", "5:cpuset:/other\n3:cpuacct,cpu:/grp\n1:name=systemd:/grp\n" );
+    MakeDir( "cpu,cpuacct" );
+    MakeDir( "cpu,cpuacct/grp" );
+    WriteFile( "cpu,cpuacct/grp/cpu.cfs_quota_us", "300000\n" );
+    ASSERT( DetectQuota()==0, "quota is found without cpu.cfs_period_us" );
+    WriteFile( "cpu,cpuacct/grp/cpu.cfs_period_us", "100000\n" );
+    ASSERT( DetectQuota()==3, "cgroup v1 quota is not found" );
+    WriteFile( "cpu,cpuacct/grp/cpu.cfs_quota_us", "-1\n" );
+    ASSERT( DetectQuota()==0, "unlimited cgroup v1 quota is not recognized" );
+    WriteFile( "cgroup", "5:cpuset:/grp\n" );
+    WriteFile( "cpu,cpuacct/grp/cpu.cfs_quota_us", "300000\n" );
+    ASSERT( DetectQuota()==0, "quota of the cpuset controller is taken for the cpu one" );
+
+    RemoveFile( "cpu,cpuacct/grp/cpu.cfs_quota_us" );
+    RemoveFile( "cpu,cpuacct/grp/cpu.cfs_period_us" );
+    RemoveFile( "cpu,cpuacct/grp" );
+    RemoveFile( "cpu,cpuacct" );
+    RemoveFile( "grp" );
+    RemoveFile( "cgroup" );
+    std::remove( Root );
+}
+
+void TestSystemLoad () {
+    const char* file_name = "test_load_limit.loadavg";
+    ASSERT( tbb::internal::GetSystemLoad( file_name )<0, "load is found without the file" );
+    FILE* f = std::fopen( file_name, "w" );
+    ASSERT( f, "cannot create a file for the test" );
+    std::fputs( "2.50 1.25 0.75 3/417 12345\n", f );
+    std::fclose( f );
+    ASSERT( tbb::internal::GetSystemLoad( file_name )==2.5, "load average over the last minute is not read" );
+    f = std::fopen( file_name, "w" );
+    std::fputs( "unknown\n", f );
+    std::fclose( f );
+    ASSERT( tbb::internal::GetSystemLoad( file_name )<0, "malformed load is accepted" );
+    std::remove( file_name );
+}
+#endif /* __linux__ */
+
+int TestMain () {
+    TestLoadLimit();
+#if __linux__
+    TestCpuQuota();
+    TestSystemLoad();
+#endif /* __linux__ */
+    return Harness::Done;
+}
@@ -0,0 +1,98 @@
+/*
+    Copyright 2005-2010 Intel Corporation.  All Rights Reserved.
+
+    This file is part of Threading Building Blocks.
+
+    Threading Building Blocks is free software; you can redistribute it
+    and/or modify it under the terms of the GNU General Public License
+    version 2 as published by the Free Software Foundation.
+
+    Threading Building Blocks is distributed in the hope that it will be
+    useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Threading Building Blocks; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    As a special exception, you may use this file as part of a free software
+    library without restriction.  Specifically, if other files instantiate
+    templates or use macros or inline functions from this file, or you compile
+    this file and link it with other files to produce an executable, this
+    file does not by itself cause the resulting executable to be covered by
+    the GNU General Public License.  This exception does not however
+    invalidate any other reasons why the executable file might be covered by
+    the GNU General Public License.
+*/
+
+#define HARNESS_NO_PARSE_COMMAND_LINE 1
+
+#include <string.h>
+#include "tbb/scalable_allocator.h"
+#include "harness.h"
+#include "harness_memory.h"
+
+const size_t MByte = 1024*1024;
+const size_t softLimit = 64*MByte;
+
+/* The memory in use goes past the limit, so when it is freed,
+   the memory above the limit must be returned instead of being cached. */
+void TestLargeObjects() {
+    const int numObjs = 2*softLimit/MByte;
+    void *objs[numObjs];
+    // start from nothing cached to not count its release
+    scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+    size_t base = GetMemoryUsage();
+
+    for (int i=0; i<numObjs; i++) {
+        // different sizes to use different cache bins
+        size_t size = MByte + i*16*1024;
+        objs[i] = scalable_malloc(size);
+        ASSERT(objs[i], "The soft limit must not fail allocations");
+        memset(objs[i], i, size);
+    }
+    ASSERT(GetMemoryUsage() >= base + 2*softLimit, "The memory in use must go past the limit");
+    for (int i=0; i<numObjs; i++)
+        scalable_free(objs[i]);
+    size_t used = GetMemoryUsage();
+    ASSERT(used < base + softLimit, "Too much memory is kept after going past the limit");
+}
+
+void TestSmallObjects() {
+    const size_t objSize = 1024;
+    const int numObjs = 2*softLimit/objSize;
+    void **objs = (void**)scalable_malloc(numObjs*sizeof(void*));
+    // start from nothing cached to not count its release
+    scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+    size_t base = GetMemoryUsage();
+
+    for (int i=0; i<numObjs; i++) {
+        objs[i] = scalable_malloc(objSize);
+        ASSERT(objs[i], "The soft limit must not fail allocations");
+        memset(objs[i], i, objSize);
+    }
+    ASSERT(GetMemoryUsage() >= base + 2*softLimit, "The memory in use must go past the limit");
+    for (int i=0; i<numObjs; i++)
+        scalable_free(objs[i]);
+    scalable_free(objs);
+    // free blocks are returned when more memory is requested
+    void *large = scalable_malloc(MByte);
+    ASSERT(large, NULL);
+    scalable_free(large);
+    ASSERT(GetMemoryUsage() < base + softLimit, "Too much memory is kept after going past the limit");
+}
+
+int TestMain () {
+    ASSERT(scalable_allocation_mode(TBBMALLOC_SET_SOFT_HEAP_LIMIT, -1)==TBBMALLOC_INVALID_PARAM,
+           "Negative limit accepted");
+    // the test makes no sense without memory usage data
+    if (!GetMemoryUsage())
+        return Harness::Skipped;
+
+    ASSERT(scalable_allocation_mode(TBBMALLOC_SET_SOFT_HEAP_LIMIT, softLimit)==TBBMALLOC_OK, NULL);
+    TestLargeObjects();
+    TestSmallObjects();
+    ASSERT(scalable_allocation_mode(TBBMALLOC_SET_SOFT_HEAP_LIMIT, 0)==TBBMALLOC_OK, NULL);
+    return Harness::Done;
+}
@@ -219,6 +219,33 @@ int main(int , char *[]) {
            scalableMallocLargeBlock(ptr, ((sz-1) | (memoryPageSize-1)) + 1), NULL);
     free(ptr);
 
+    ptr = pvalloc(0);
+    ASSERT(ptr!=NULL && isAligned(ptr, memoryPageSize), NULL);
+    free(ptr);
+
+    ptr = aligned_alloc(4096, 3*minLargeObjectSize);
+    ASSERT(ptr!=NULL && isAligned(ptr, 4096)
+           && scalableMallocLargeBlock(ptr, 3*minLargeObjectSize), NULL);
+    ASSERT(malloc_usable_size(ptr) >= 3*minLargeObjectSize, NULL);
+    free(ptr);
+
+    // as in glibc, alignment that is not a power of 2 is rounded up
+    ptr = memalign(24, 100);
+    ASSERT(ptr!=NULL && isAligned(ptr, 32), NULL);
+    ASSERT(malloc_usable_size(ptr) >= 100, NULL);
+    free(ptr);
+    ptr = aligned_alloc(64, 100);
+    ASSERT(ptr!=NULL && isAligned(ptr, 64), NULL);
+    free(ptr);
+    ASSERT(malloc_usable_size(NULL)==0, NULL);
+
+    ASSERT(mallopt(M_TRIM_THRESHOLD, 1024)==1, NULL);
+    for (int i=0; i<10; i++)
+        free(malloc(1024*minLargeObjectSize));
+    // the freed objects are cached, so trimming releases memory
+    ASSERT(malloc_trim(0)==1, NULL);
+    ASSERT(malloc_trim(0)==0, NULL);
+
     struct mallinfo info = mallinfo();
     // right now mallinfo initialized by zero
     ASSERT(!info.arena && !info.ordblks && !info.smblks && !info.hblks 
@@ -252,6 +279,30 @@ int main(int , char *[]) {
     ASSERT(f!=NULL && scalableMallocLargeBlock(f, 2*sizeof(BigStruct)), NULL);
     delete []f;
 
+#if __cpp_sized_deallocation
+    ptr = operator new(sizeof(BigStruct));
+    ASSERT(ptr!=NULL && scalableMallocLargeBlock(ptr, sizeof(BigStruct)), NULL);
+    operator delete(ptr, sizeof(BigStruct));
+#endif
+
+#if __cpp_aligned_new
+    const std::align_val_t pageAlignment = std::align_val_t(4096);
+    ptr = operator new(sizeof(BigStruct), pageAlignment);
+    ASSERT(ptr!=NULL && isAligned(ptr, 4096)
+           && scalableMallocLargeBlock(ptr, sizeof(BigStruct)), NULL);
+    operator delete(ptr, pageAlignment);
+    ptr = operator new[](2*sizeof(BigStruct), pageAlignment);
+    ASSERT(ptr!=NULL && isAligned(ptr, 4096)
+           && scalableMallocLargeBlock(ptr, 2*sizeof(BigStruct)), NULL);
+    operator delete[](ptr, pageAlignment);
+    ptr = operator new(100, std::align_val_t(256), std::nothrow);
+    ASSERT(ptr!=NULL && isAligned(ptr, 256), NULL);
+    operator delete(ptr, std::align_val_t(256), std::nothrow);
+    ptr = operator new[](100, std::align_val_t(256), std::nothrow);
+    ASSERT(ptr!=NULL && isAligned(ptr, 256), NULL);
+    operator delete[](ptr, 100, std::align_val_t(256));
+#endif
+
 #if _WIN32
     std::string stdstring = "done";
     const char* s = stdstring.c_str();
@@ -46,7 +46,10 @@ int main(void) {
         p1 = scalable_malloc(i);
         if( !p1 )
             printf("Warning: there should be memory but scalable_malloc returned NULL\n");
-        scalable_free(p1);
+        if (i%2)
+            scalable_free(p1);
+        else
+            scalable_free_sized(p1, i);
     }
     p1 = p2 = NULL;
     for( i=1024*1024; ; i/=2 )
@@ -43,6 +43,7 @@
 #include "../tbbmalloc/backend.cpp"
 #include "../tbbmalloc/backref.cpp"
 #include "../tbbmalloc/large_objects.cpp"
+#include "../tbbmalloc/heap_profile.cpp"
 #include "../tbbmalloc/tbbmalloc.cpp"
 
 const int LARGE_MEM_SIZES_NUM = 10;
@@ -317,6 +318,450 @@ void TestObjectRecognition() {
     scalable_free(bufferLOH);
 }
 
+void TestHugePages() {
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES, 2)==TBBMALLOC_INVALID_PARAM,
+           "Incorrect huge pages mode accepted");
+    ASSERT(scalable_allocation_mode(-1, 0)==TBBMALLOC_INVALID_PARAM,
+           "Unknown parameter accepted");
+
+    int res = scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES, 1);
+    ASSERT(res==TBBMALLOC_OK || res==TBBMALLOC_NO_EFFECT, NULL);
+    ASSERT(hugePages.isEnabled() == (res==TBBMALLOC_OK), NULL);
+
+    if (hugePages.isEnabled()) {
+        uintptr_t hugeBefore = hugePages.currentBytes;
+        void *hugeMem = getHugeRawMemory(2*hugePageSize);
+        ASSERT(hugeMem && isAligned(hugeMem, hugePageSize), "Huge page memory must be aligned");
+        ASSERT(hugePages.currentBytes == hugeBefore+2*hugePageSize, "Huge page memory was not accounted");
+        memset(hugeMem, 1, 2*hugePageSize);
+        freeHugeRawMemory(hugeMem, 2*hugePageSize);
+        ASSERT(hugePages.currentBytes == hugeBefore, "Huge page memory was not accounted");
+
+        // 2nd iteration takes the object from the large objects cache
+        for (int i=0; i<2; i++) {
+            void *obj = scalable_malloc(3*MByte);
+            LargeMemoryBlock *lmb = ((LargeObjectHdr*)obj - 1)->memoryBlock;
+            ASSERT(lmb->fromHugePages && isAligned(lmb, hugePageSize) 
+                   && isAligned(lmb->unalignedSize, hugePageSize), 
+                   "Large object must be mapped with huge pages");
+            memset(obj, i, 3*MByte);
+            scalable_free(obj);
+        }
+    }
+    ASSERT(scalable_allocation_mode(TBBMALLOC_USE_HUGE_PAGES, 0)==TBBMALLOC_OK, NULL);
+    ASSERT(!hugePages.isEnabled(), NULL);
+}
+
+static int backendRegionsCount()
+{
+    int cnt = 0;
+    MallocMutex::scoped_lock lock(regionListLock);
+    for (BackendRegion *curr = regionList; curr; curr = curr->next)
+        cnt++;
+    return cnt;
+}
+
+class RegionsFiller: NoAssign {
+    // enough to fill several backend regions
+    static const int NUM_OBJS = 8*MByte/1024;
+public:
+    RegionsFiller() {}
+    void operator()(int) const {
+        void **objs = (void**)scalable_malloc(NUM_OBJS*sizeof(void*));
+
+        for (int i=0; i<NUM_OBJS; i++)
+            objs[i] = scalable_malloc(1024);
+        for (int i=0; i<NUM_OBJS; i++)
+            scalable_free(objs[i]);
+        scalable_free(objs);
+        ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, NULL)==TBBMALLOC_OK,
+               "Blocks of the thread pool were not released");
+        ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_THREAD_BUFFERS, NULL)==TBBMALLOC_NO_EFFECT,
+               "Thread pool must be empty");
+
+#ifdef USE_WINTHREAD
+        // under Windows DllMain used to call mallocThreadShutdownNotification,
+        // as we don't use it have to call the callback manually
+        mallocThreadShutdownNotification(NULL);
+#endif
+    }
+};
+
+void TestCleanAllBuffers() {
+    ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, (void*)1)==TBBMALLOC_INVALID_PARAM,
+           "Incorrect parameter accepted");
+    ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS_INCREMENTAL, NULL)==TBBMALLOC_INVALID_PARAM,
+           "Time budget must be required");
+    ASSERT(scalable_allocation_command(-1, NULL)==TBBMALLOC_INVALID_PARAM,
+           "Unknown command accepted");
+
+    scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+    int regionsBefore = backendRegionsCount();
+    NativeParallelFor( 1, RegionsFiller() );
+    int regionsPeak = backendRegionsCount();
+    ASSERT(regionsPeak > regionsBefore, "Regions were not used");
+    ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL)==TBBMALLOC_OK, NULL);
+    ASSERT(backendRegionsCount() < regionsPeak, "Free regions were not released");
+    ASSERT(!releaseCachedLargeObjects(numLargeBlockBins), "Large objects cache was not cleaned");
+    ASSERT(scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL)==TBBMALLOC_NO_EFFECT,
+           "Nothing must remain to be released");
+
+    NativeParallelFor( 1, RegionsFiller() );
+    regionsPeak = backendRegionsCount();
+    // with zero time budget every call does a single portion of work
+    size_t timeBudget = 0;
+    int calls = 0;
+    while (scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS_INCREMENTAL, &timeBudget)==TBBMALLOC_OK)
+        ASSERT(++calls <= 2*(int)(largeObjectPortions+1), "Incremental cleanup does not finish");
+    ASSERT(backendRegionsCount() < regionsPeak, "Free regions were not released");
+    ASSERT(!releaseCachedLargeObjects(numLargeBlockBins), "Large objects cache was not cleaned");
+}
+
+static void checkFilled(const char *obj, size_t size, char value)
+{
+    for (size_t i=0; i<size; i+=1024)
+        ASSERT(obj[i]==value, "Data is broken by realloc");
+}
+
+void TestRemapLargeObject() {
+    const size_t startSize = 2*MByte;
+    char *obj = (char*)scalable_malloc(startSize);
+    size_t currSize = startSize;
+
+    memset(obj, 1, startSize);
+    // direct call to know that remapping was done
+    char *remapped = (char*)remapLargeObject(obj, 2*startSize, 0);
+    ASSERT((remapped!=NULL) == (minRemappableObjectSize <= startSize), 
+           "Large object must be remapped where it is supported");
+    if (remapped) {
+        obj = remapped;
+        currSize = 2*startSize;
+        checkFilled(obj, startSize, 1);
+        memset(obj+startSize, 1, startSize);
+        ASSERT(scalable_msize(obj) >= currSize, NULL);
+        ASSERT(isLargeObject(obj), "Remapped object is not recognized");
+    }
+    for (char val=2; currSize<64*MByte; val++) {
+        obj = (char*)scalable_realloc(obj, 2*currSize);
+        ASSERT(obj, NULL);
+        checkFilled(obj, currSize, val-1);
+        currSize *= 2;
+        memset(obj, val, currSize);
+        ASSERT(isLargeObject(obj), "Reallocated object is not recognized");
+    }
+    scalable_free(obj);
+}
+
+const int remoteObjsNum = RemoteFreeCache::MAX_BATCH_SIZE;
+static void *remoteObjs[remoteObjsNum];
+
+static unsigned batchedRemoteFrees(const Block *block)
+{
+    RemoteFreeCache *cache = &getThreadMallocTLS()->remoteFrees;
+    for (unsigned i=0; i<RemoteFreeCache::NUM_BATCHES; i++)
+        if (cache->batch[i].block == block)
+            return cache->batch[i].count;
+    return 0;
+}
+
+class RemoteFreeWork: NoAssign {
+public:
+    RemoteFreeWork() {}
+    void operator()(int) const {
+        Block *block = (Block*)alignDown(remoteObjs[0], blockSize);
+        // the thread needs own allocator data to batch frees
+        scalable_free(scalable_malloc(8));
+
+        for (int i=0; i<remoteObjsNum-1; i++) {
+            scalable_free(remoteObjs[i]);
+            ASSERT(batchedRemoteFrees(block)==(unsigned)i+1, "Remote free was not batched");
+        }
+        scalable_free(remoteObjs[remoteObjsNum-1]);
+        ASSERT(!batchedRemoteFrees(block), "Full batch was not flushed");
+
+#ifdef USE_WINTHREAD
+        // under Windows DllMain used to call mallocThreadShutdownNotification,
+        // as we don't use it have to call the callback manually
+        mallocThreadShutdownNotification(NULL);
+#endif
+    }
+};
+
+void TestRemoteFreeBatching() {
+    const size_t objSize = 16;
+    // objects must be in the same block to be batched together
+    void *first = scalable_malloc(objSize);
+    Block *block = (Block*)alignDown(first, blockSize);
+    void *notInBlock[remoteObjsNum];
+    int numNotInBlock = 0;
+
+    remoteObjs[0] = first;
+    for (int i=1; i<remoteObjsNum; ) {
+        void *obj = scalable_malloc(objSize);
+        if ((Block*)alignDown(obj, blockSize) == block)
+            remoteObjs[i++] = obj;
+        else {
+            ASSERT(numNotInBlock<remoteObjsNum, "Objects are not allocated from the same block");
+            notInBlock[numNotInBlock++] = obj;
+        }
+    }
+    NativeParallelFor( 1, RemoteFreeWork() );
+    for (int i=0; i<numNotInBlock; i++)
+        scalable_free(notInBlock[i]);
+    // allocation may privatize the batch, so object counts are checked in debug
+    for (int i=0; i<remoteObjsNum; i++) {
+        remoteObjs[i] = scalable_malloc(objSize);
+        ASSERT(remoteObjs[i], NULL);
+    }
+    for (int i=0; i<remoteObjsNum; i++)
+        scalable_free(remoteObjs[i]);
+}
+
+void TestSizeClasses() {
+    const unsigned blockPayload = blockSize-sizeof(Block);
+
+    for (unsigned size=1; size<minLargeObjectSize; size++) {
+        unsigned index = getIndex(size), objSize = getObjectSize(size);
+        ASSERT(index<numBlockBins && size<=objSize, "Object does not fit its size class");
+        ASSERT(index==0 || binObjectSize[index-1]<size, "Smaller size class is not used");
+        if (size>maxSmallObjectSize && size<=maxSegregatedObjectSize)
+            ASSERT(9*(objSize-size) < objSize, "Too much space is wasted");
+        // aligned allocation relies on natural alignment of segregated objects
+        for (unsigned alignment=8; alignment<=maxSegregatedObjectSize; alignment*=2)
+            if (size<=maxSegregatedObjectSize && isAligned(size, alignment))
+                ASSERT(isAligned(objSize, alignment), "Size class breaks alignment");
+        if (size>maxSegregatedObjectSize) {
+            ASSERT(isAligned(objSize, fittingAlignment), "Fitting size is not aligned");
+            // no bigger size class fits as many objects per block
+            unsigned objsPerBlock = blockPayload/objSize;
+            ASSERT(objSize+fittingAlignment > blockPayload/objsPerBlock, 
+                   "Fitting size can be bigger");
+        }
+    }
+}
+
+void TestLargeObjectCacheStat() {
+    for (size_t size=minLargeObjectSize; size<=maxCachedLargeObjectSize; size+=size/64+1) {
+        size_t binSize = alignToLargeBin(size), idx = getLargeBinIdx(binSize);
+        ASSERT(idx<numLargeBlockBins && getLargeBinBlockSize(idx)==binSize, "Wrong large bin");
+        ASSERT(getLargeBinIdx(alignToLargeBin(size+1))>=idx, "Large bins are not ordered");
+        if (size>maxLinearCachedLargeObjectSize)
+            ASSERT(9*(binSize-size) <= binSize, "Too much space is wasted");
+        ASSERT(alignDownToLargeBin(size)<=size
+               && alignToLargeBin(alignDownToLargeBin(size))==alignDownToLargeBin(size),
+               "Wrong rounding down to a large bin");
+    }
+    ASSERT(getLargeBinIdx(alignToLargeBin(maxCachedLargeObjectSize+1))==numLargeBlockBins,
+           "Too big objects must not be cached");
+
+    ScalableLargeObjectCacheStat before, after;
+    int ret = scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, NULL);
+    ASSERT(ret==TBBMALLOC_INVALID_PARAM, NULL);
+    scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+    ret = scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, &before);
+    ASSERT(ret==TBBMALLOC_OK && !before.cachedBlocks && !before.cachedBytes,
+           "Cache must be empty after cleanup");
+    // 1.5MB is served from a logarithmic bin
+    const size_t sz = 1536*1024;
+    void *p = scalable_malloc(sz);
+    ASSERT(p, NULL);
+    scalable_free(p);
+    p = scalable_malloc(sz);
+    ASSERT(p, NULL);
+    scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, &after);
+    ASSERT(after.misses==before.misses+1 && after.hits==before.hits+1,
+           "Cache hit is expected for the same size");
+    scalable_free(p);
+    scalable_allocation_command(TBBMALLOC_GET_LARGE_OBJECT_CACHE_STAT, &after);
+    ASSERT(after.cachedBlocks==1 && after.cachedBytes>=sz, NULL);
+    scalable_allocation_command(TBBMALLOC_CLEAN_ALL_BUFFERS, NULL);
+}
+
+static const int statObjsNum = 1000;
+static void *statObjs[statObjsNum];
+
+class StatAllocWork: NoAssign {
+    size_t objSize;
+public:
+    StatAllocWork(size_t size) : objSize(size) {}
+    void operator()(int) const {
+        for (int i=0; i<statObjsNum; i++)
+            statObjs[i] = scalable_malloc(objSize);
+    }
+};
+
+void TestAllocationStats() {
+    const size_t objSize = 100;
+    const unsigned idx = getIndex(objSize);
+    ScalableAllocationStat before, after;
+
+    ASSERT(scalable_allocation_stats(NULL)==TBBMALLOC_INVALID_PARAM, NULL);
+    ASSERT(scalable_allocation_stats(&before)==TBBMALLOC_OK, NULL);
+    ASSERT(before.sizeClasses==numBlockBins && before.threads>=1 && before.mappedBytes, NULL);
+    ASSERT(before.sizeClassObjectSize[idx]==getObjectSize(objSize), NULL);
+
+    // objects of an exited thread are in use until freed
+    NativeParallelFor( 1, StatAllocWork(objSize) );
+    // the heap of the exited thread is retired, so its blocks aren't orphaned yet
+    releaseRetiredHeaps();
+    scalable_allocation_stats(&after);
+    ASSERT(after.sizeClassBytes[idx]==before.sizeClassBytes[idx]
+           + statObjsNum*getObjectSize(objSize), "Wrong bytes in use");
+    ASSERT(after.orphanedBlocks > before.orphanedBlocks, "Orphaned blocks not counted");
+    // freed by other thread
+    for (int i=0; i<statObjsNum; i++)
+        scalable_free(statObjs[i]);
+    scalable_allocation_stats(&after);
+    ASSERT(after.sizeClassBytes[idx]==before.sizeClassBytes[idx], "Wrong bytes in use");
+
+    const size_t largeSize = 3*1024*1024;
+    void *large = scalable_malloc(largeSize);
+    ASSERT(large, NULL);
+    scalable_allocation_stats(&after);
+    ASSERT(after.largeObjects==before.largeObjects+1
+           && after.largeObjectBytes>=before.largeObjectBytes+largeSize, NULL);
+    scalable_free(large);
+    scalable_allocation_stats(&after);
+    ASSERT(after.largeObjects==before.largeObjects
+           && after.largeObjectBytes==before.largeObjectBytes, NULL);
+}
+
+class RetiredHeapWork: NoAssign {
+    size_t objSize;
+public:
+    RetiredHeapWork(size_t size) : objSize(size) {}
+    void operator()(int) const {
+        if (statObjs[0]) {
+            // the heap of the previous thread is adopted with its blocks
+            void *obj = scalable_malloc(objSize);
+            ASSERT(alignDown(obj, blockSize)==alignDown(statObjs[statObjsNum-1], blockSize),
+                   "Blocks of the exited thread are not reused");
+            Block *block = (Block*)alignDown(statObjs[0], blockSize);
+            ASSERT(block->ownBlock(getThreadMallocTLS()), NULL);
+            scalable_free(obj);
+            for (int i=0; i<statObjsNum; i++)
+                scalable_free(statObjs[i]);
+        } else {
+            for (int i=0; i<statObjsNum; i++)
+                statObjs[i] = scalable_malloc(objSize);
+        }
+    }
+};
+
+void TestRetiredHeaps() {
+    const size_t objSize = 24;
+    releaseRetiredHeaps();
+    memset(statObjs, 0, sizeof(statObjs));
+
+    NativeParallelFor( 1, RetiredHeapWork(objSize) );
+    ASSERT(retiredHeapsNum==1, "The heap of the exited thread is not retired");
+    NativeParallelFor( 1, RetiredHeapWork(objSize) );
+    ASSERT(retiredHeapsNum==1, NULL);
+    ASSERT(releaseRetiredHeaps() && !retiredHeapsNum, NULL);
+    ASSERT(!releaseRetiredHeaps(), NULL);
+}
+
+void TestSizedFree() {
+    // objects of a bin for an aligned size are aligned, and from 64 bytes on
+    // the bin is of exactly that size
+    for (size_t alignment=sizeof(void*); alignment<=maxSegregatedObjectSize; alignment*=2)
+        for (size_t size=alignment; size<=maxSegregatedObjectSize; size+=alignment) {
+            ASSERT(getObjectSize(size)%alignment==0, NULL);
+            ASSERT(alignment<64 || getObjectSize(size)==size, "Aligned object is padded");
+            void *p = scalable_aligned_malloc(size-1, alignment);
+            ASSERT(isAligned(p, alignment) && !isLargeObject(p), NULL);
+            scalable_free_sized(p, size-1);
+        }
+
+    const size_t alignment = fittingAlignment;
+    for (size_t size=0; size<2*minLargeObjectSize; size+=size/8+1) {
+        void *p = scalable_malloc(size);
+        scalable_free_sized(p, size);
+        p = scalable_aligned_malloc(size, alignment);
+        ASSERT(isAligned(p, alignment), NULL);
+        scalable_free_sized(p, size);
+    }
+    // a large object shrunk to a small size goes to a bin
+    void *p = scalable_malloc(2*minLargeObjectSize);
+    p = scalable_realloc(p, 100);
+    ASSERT(!isLargeObject(p), NULL);
+    scalable_free_sized(p, 100);
+    p = scalable_aligned_malloc(2*minLargeObjectSize, alignment);
+    p = scalable_aligned_realloc(p, 100, alignment);
+    ASSERT(!isLargeObject(p) && isAligned(p, alignment), NULL);
+    scalable_free_sized(p, 100);
+    scalable_free_sized(NULL, 100);
+}
+
+void TestIsolatedObjects() {
+    const int objsNum = 16;
+    void *objs[objsNum];
+
+    for (size_t size=0; size<2*minLargeObjectSize; size+=size/4+1) {
+        for (int i=0; i<objsNum; i++) {
+            objs[i] = scalable_malloc_isolated(size);
+            ASSERT(isAligned(objs[i], isolatedObjectAlignment), NULL);
+            ASSERT(scalable_msize(objs[i]) >= size, NULL);
+        }
+        // no object reaches into the lines of another one
+        for (int i=0; i<objsNum; i++)
+            for (int j=0; j<objsNum; j++) {
+                uintptr_t end = alignUp((uintptr_t)objs[i]+(size? size: 1),
+                                        isolatedObjectAlignment);
+                ASSERT(i==j || (uintptr_t)objs[j] >= end
+                       || (uintptr_t)objs[j] < (uintptr_t)objs[i], "Objects share a cache line");
+            }
+        for (int i=0; i<objsNum; i++)
+            scalable_free(objs[i]);
+    }
+    errno = 0;
+    ASSERT(!scalable_malloc_isolated(~(size_t)0) && errno==ENOMEM, NULL);
+}
+
+#if MALLOC_HEAP_PROFILE_SUPPORTED
+// reads totals from the heap profile header
+static void readHeapProfileTotals(const char *fileName, long *inUse, long *allocated)
+{
+    FILE *f = fopen(fileName, "r");
+    ASSERT(f, "Heap profile is not written");
+    long inUseBytes, allocBytes, interval;
+    int n = fscanf(f, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld",
+                   inUse, &inUseBytes, allocated, &allocBytes, &interval);
+    ASSERT(n==5 && interval==1024, "Wrong heap profile header");
+    fclose(f);
+}
+
+void TestHeapProfile() {
+    const char *fileName = "test_malloc_whitebox.heap";
+    const int objsNum = 1000;
+    void *objs[objsNum];
+    long inUse, allocated, inUseAfter, allocatedAfter;
+    uintptr_t samplesBefore = heapSamplesNum;
+
+    ASSERT(scalable_allocation_mode(TBBMALLOC_SET_HEAP_SAMPLING_INTERVAL, -1)==TBBMALLOC_INVALID_PARAM, NULL);
+    ASSERT(scalable_allocation_command(TBBMALLOC_DUMP_HEAP_PROFILE, NULL)==TBBMALLOC_INVALID_PARAM, NULL);
+    int ret = scalable_allocation_mode(TBBMALLOC_SET_HEAP_SAMPLING_INTERVAL, 1024);
+    ASSERT(ret==TBBMALLOC_OK, NULL);
+    // the countdown of the thread may be set while sampling was off
+    scalable_free(scalable_malloc(2*samplingCheckPeriod));
+    for (int i=0; i<objsNum; i++)
+        objs[i] = scalable_malloc(i%2? 100 : minLargeObjectSize+i);
+    ASSERT(heapSamplesNum > samplesBefore+objsNum/2, "Too few samples");
+    ret = scalable_allocation_command(TBBMALLOC_DUMP_HEAP_PROFILE, (void*)fileName);
+    ASSERT(ret==TBBMALLOC_OK, NULL);
+    readHeapProfileTotals(fileName, &inUse, &allocated);
+    ASSERT(inUse>=objsNum/2 && allocated>=inUse, NULL);
+
+    for (int i=0; i<objsNum; i++)
+        scalable_free(objs[i]);
+    scalable_allocation_mode(TBBMALLOC_SET_HEAP_SAMPLING_INTERVAL, 0);
+    ASSERT(heapSamplesNum==samplesBefore, "Freed objects are in the profile");
+    scalable_allocation_command(TBBMALLOC_DUMP_HEAP_PROFILE, (void*)fileName);
+    readHeapProfileTotals(fileName, &inUseAfter, &allocatedAfter);
+    ASSERT(inUseAfter < inUse && allocatedAfter==allocated, NULL);
+    remove(fileName);
+}
+#endif
 
 int TestMain () {
     // backreference requires that initialization was done
@@ -342,5 +787,18 @@ int TestMain () {
     }
 
     TestObjectRecognition();
+    TestHugePages();
+    TestCleanAllBuffers();
+    TestRemapLargeObject();
+    TestRemoteFreeBatching();
+    TestSizeClasses();
+    TestLargeObjectCacheStat();
+    TestAllocationStats();
+    TestRetiredHeaps();
+    TestSizedFree();
+    TestIsolatedObjects();
+#if MALLOC_HEAP_PROFILE_SUPPORTED
+    TestHeapProfile();
+#endif
     return Harness::Done;
 }
@@ -432,6 +432,51 @@ void TestAlignment() {
 #endif /* HAVE_m128 */
 }
 
+//------------------------------------------------------------------------
+// Test for tasks of different sizes
+//------------------------------------------------------------------------
+
+//! Task with a payload of N bytes that must stay intact until the task executes.
+/** The task recursively creates tasks of all the sizes. */
+template<size_t N>
+class TaskWithPayload: public tbb::task {
+    unsigned char payload[N];
+    int depth;
+    /*override*/ tbb::task* execute();
+public:
+    TaskWithPayload( int d ) : depth(d) { memset( payload, d, N ); }
+};
+
+void SpawnTasksWithPayload( tbb::task& parent, int depth ) {
+    parent.set_ref_count(6);
+    tbb::task_list list;
+    list.push_back( *new( parent.allocate_child() ) TaskWithPayload<8>(depth) );
+    list.push_back( *new( parent.allocate_child() ) TaskWithPayload<300>(depth) );
+    list.push_back( *new( parent.allocate_child() ) TaskWithPayload<600>(depth) );
+    list.push_back( *new( parent.allocate_child() ) TaskWithPayload<900>(depth) );
+    list.push_back( *new( parent.allocate_child() ) TaskWithPayload<3000>(depth) );
+    parent.spawn_and_wait_for_all( list );
+}
+
+template<size_t N>
+tbb::task* TaskWithPayload<N>::execute() {
+    for( size_t i=0; i<N; ++i )
+        ASSERT( payload[i]==(unsigned char)depth, "Task memory is corrupted" );
+    if( depth>0 )
+        SpawnTasksWithPayload( *this, depth-1 );
+    return NULL;
+}
+
+void TestTaskSizes( int p ) {
+    REMARK("testing tasks of different sizes for %d threads\n",p);
+    tbb::task_scheduler_init init(p);
+    for( int i=0; i<10; ++i ) {
+        tbb::task& root = *new( tbb::task::allocate_root() ) tbb::empty_task;
+        SpawnTasksWithPayload( root, 4 );
+        tbb::task::destroy( root );
+    }
+}
+
 //------------------------------------------------------------------------
 // Test for recursing on left while spawning on right
 //------------------------------------------------------------------------
@@ -948,6 +993,288 @@ void TestEnqueue( int p ) {
     }
 }
 
+class CountingTask: public tbb::task {
+    tbb::task* execute() {
+        ++Count;
+        return NULL;
+    }
+public:
+    static tbb::atomic<int> Count;
+};
+
+tbb::atomic<int> CountingTask::Count;
+
+//! Enqueues more tasks than the rings of the stream lanes hold, in an arena with more than 32 lanes
+void TestEnqueueManyLanes() {
+    REMARK("testing task::enqueue with many lanes\n");
+    const int NumThreads = 40, NumTasks = 20000;
+    tbb::task_scheduler_init init(NumThreads);
+    CountingTask::Count = 0;
+    tbb::task* root = new (tbb::task::allocate_root()) tbb::empty_task;
+    root->set_ref_count(NumTasks+1);
+    for( int i=0; i<NumTasks; ++i )
+        tbb::task::enqueue( *new (root->allocate_child()) CountingTask );
+    root->wait_for_all();
+    ASSERT(CountingTask::Count==NumTasks, "some enqueued tasks were lost");
+    tbb::task::destroy(*root);
+}
+
+#include "tbb/tick_count.h"
+
+//! Time after which the flood of spawned tasks stops anyway
+const double FloodTimeLimit = 10.0;
+
+class FloodTask: public tbb::task {
+    tbb::task* execute() {
+        Started = true;
+        // Every task spawns the next one, so the local pool of the thread is never empty
+        if( !Done && (tbb::tick_count::now()-StartTime).seconds()<FloodTimeLimit )
+            spawn( *new( allocate_additional_child_of(*Root) ) FloodTask );
+        return NULL;
+    }
+public:
+    static tbb::task* Root;
+    static tbb::tick_count StartTime;
+    static tbb::atomic<bool> Started, Done;
+};
+
+tbb::task* FloodTask::Root;
+tbb::tick_count FloodTask::StartTime;
+tbb::atomic<bool> FloodTask::Started, FloodTask::Done;
+
+class StopFloodTask: public tbb::task {
+    tbb::task* execute() {
+        FloodTask::Done = true;
+        return NULL;
+    }
+};
+
+//! Checks that an enqueued task is executed while the only worker has plenty of spawned tasks
+void TestEnqueueFairness( unsigned max_tasks, unsigned max_microseconds ) {
+    REMARK("testing enqueue fairness for %u tasks or %u microseconds\n", max_tasks, max_microseconds);
+    tbb::task_scheduler_init::set_enqueue_fairness( max_tasks, max_microseconds );
+    tbb::task_scheduler_init init(2);
+    FloodTask::Started = FloodTask::Done = false;
+    FloodTask::StartTime = tbb::tick_count::now();
+    FloodTask::Root = new( tbb::task::allocate_root() ) tbb::empty_task;
+    FloodTask::Root->set_ref_count(1);
+    // Only workers take enqueued tasks, so the worker is the one flooded
+    tbb::task::enqueue( *new( tbb::task::allocate_additional_child_of(*FloodTask::Root) ) FloodTask );
+    while( !FloodTask::Started )
+        __TBB_Yield();
+    tbb::task::enqueue( *new( tbb::task::allocate_additional_child_of(*FloodTask::Root) ) StopFloodTask );
+    // The master does not wait for the root until the flood stops, so that it does not steal the flood.
+    // It gives up well before the flood stops by itself, after which the stop task would run anyway.
+    while( !FloodTask::Done && (tbb::tick_count::now()-FloodTask::StartTime).seconds()<FloodTimeLimit/2 )
+        __TBB_Yield();
+    // Checked before waiting, as the wait would execute the stop task anyway
+    bool done_in_time = FloodTask::Done;
+    FloodTask::Done = true;
+    FloodTask::Root->wait_for_all();
+    tbb::task::destroy(*FloodTask::Root);
+    ASSERT( done_in_time, "enqueued task starved in the fairness mode" );
+    tbb::task_scheduler_init::set_enqueue_fairness( 0, 0 );
+}
+
+class TimedTask: public tbb::task {
+    tbb::tick_count my_deadline;
+    int my_rearms;
+    tbb::task* execute() {
+        tbb::tick_count now = tbb::tick_count::now();
+        if( (now-my_deadline).seconds()<0 )
+            ++EarlyCount;
+        ExecutionTime = now;
+        ++Count;
+        if( my_rearms )
+            enqueue_after( *new( allocate_additional_child_of(*parent()) ) TimedTask(Period, my_rearms-1), Period );
+        return NULL;
+    }
+public:
+    TimedTask( tbb::tick_count::interval_t delay, int rearms )
+        : my_deadline(tbb::tick_count::now()+delay), my_rearms(rearms) {}
+    static tbb::tick_count::interval_t Period;
+    static tbb::tick_count ExecutionTime;
+    static tbb::atomic<int> Count, EarlyCount;
+};
+
+tbb::tick_count::interval_t TimedTask::Period( 0.02 );
+tbb::tick_count TimedTask::ExecutionTime;
+tbb::atomic<int> TimedTask::Count, TimedTask::EarlyCount;
+
+//! Checks that timed tasks run no earlier than due, and that a plain enqueue wakes up the sleeping worker
+void TestTimedEnqueue() {
+    REMARK("testing task::enqueue_after\n");
+    tbb::task_scheduler_init init(2);
+    TimedTask::Count = TimedTask::EarlyCount = 0;
+    tbb::task* root = new( tbb::task::allocate_root() ) tbb::empty_task;
+    root->set_ref_count(1);
+    const double delays[] = {0.2, 0.05, 0.1, 0};
+    for( int i=0; i<4; ++i ) {
+        tbb::tick_count::interval_t delay(delays[i]);
+        tbb::task::enqueue_after( *new( tbb::task::allocate_additional_child_of(*root) ) TimedTask(delay, 0), delay );
+    }
+    // The periodic task re-arms itself 3 times
+    tbb::task::enqueue_after( *new( tbb::task::allocate_additional_child_of(*root) ) TimedTask(TimedTask::Period, 3),
+                              TimedTask::Period );
+    root->wait_for_all();
+    ASSERT( TimedTask::Count==8, "some timed tasks were lost" );
+    ASSERT( !TimedTask::EarlyCount, "timed task was executed before its deadline" );
+
+    // The worker sleeps until the distant deadline, and should take the plain task immediately
+    const double distant = 2.0;
+    TimedTask::Count = 0;
+    root->set_ref_count(1);
+    tbb::task::enqueue_after( *new( tbb::task::allocate_additional_child_of(*root) ) TimedTask(tbb::tick_count::interval_t(distant), 0),
+                              tbb::tick_count::interval_t(distant) );
+    tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.1) );
+    CountingTask::Count = 0;
+    tbb::tick_count start = tbb::tick_count::now();
+    tbb::task::enqueue( *new( tbb::task::allocate_additional_child_of(*root) ) CountingTask );
+    while( !CountingTask::Count && (tbb::tick_count::now()-start).seconds()<distant )
+        tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.001) );
+    ASSERT( CountingTask::Count==1 && !TimedTask::Count, "enqueued task was not taken by the sleeping worker" );
+    root->wait_for_all();
+    ASSERT( TimedTask::Count==1 && !TimedTask::EarlyCount, NULL );
+
+    // The same for a spawned task, which the master leaves for the worker to steal
+    TimedTask::Count = 0;
+    root->set_ref_count(1);
+    tbb::task::enqueue_after( *new( tbb::task::allocate_additional_child_of(*root) ) TimedTask(tbb::tick_count::interval_t(distant), 0),
+                              tbb::tick_count::interval_t(distant) );
+    tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.1) );
+    CountingTask::Count = 0;
+    start = tbb::tick_count::now();
+    tbb::task* spawner = new( tbb::task::allocate_root() ) tbb::empty_task;
+    spawner->set_ref_count(2);
+    tbb::task::spawn( *new( spawner->allocate_child() ) CountingTask );
+    while( !CountingTask::Count && (tbb::tick_count::now()-start).seconds()<distant )
+        tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.001) );
+    ASSERT( CountingTask::Count==1 && !TimedTask::Count, "spawned task was not stolen by the sleeping worker" );
+    spawner->wait_for_all();
+    tbb::task::destroy(*spawner);
+    root->wait_for_all();
+    ASSERT( TimedTask::Count==1 && !TimedTask::EarlyCount, NULL );
+    tbb::task::destroy(*root);
+}
+
+#include <cstdio>
+#include "tbb/concurrent_queue.h"
+
+const size_t EventBlockSize = 4096;
+const int EventNumBlocks = 16;
+
+struct ReadRequest {
+    long offset;
+    tbb::completion_event* event;
+    char buffer[EventBlockSize];
+};
+
+tbb::atomic<int> ReadsInFlight, BlocksChecked, BlocksCorrupted, OverlappedComputations;
+
+//! Serves the reads in a thread unknown to TBB, like a completion thread of asynchronous I/O
+class IoService: NoAssign {
+    FILE* my_file;
+    tbb::concurrent_bounded_queue<ReadRequest*>& my_requests;
+public:
+    IoService( FILE* file, tbb::concurrent_bounded_queue<ReadRequest*>& requests )
+        : my_file(file), my_requests(requests) {}
+    void operator()() const {
+        for(;;) {
+            ReadRequest* r;
+            my_requests.pop(r);
+            if( !r ) break;
+            // Emulates disk latency
+            tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.005) );
+            fseek( my_file, r->offset, SEEK_SET );
+            size_t n = fread( r->buffer, 1, EventBlockSize, my_file );
+            ASSERT( n==EventBlockSize, "failed to read the file" );
+            --ReadsInFlight;
+            r->event->fire();
+        }
+    }
+};
+
+class CheckBlockTask: public tbb::task {
+    ReadRequest* my_request;
+    char my_value;
+    tbb::task* execute() {
+        for( size_t i=0; i<EventBlockSize; ++i )
+            if( my_request->buffer[i]!=my_value ) {
+                ++BlocksCorrupted;
+                break;
+            }
+        delete my_request->event;
+        delete my_request;
+        ++BlocksChecked;
+        return NULL;
+    }
+public:
+    CheckBlockTask( ReadRequest* r, char value ) : my_request(r), my_value(value) {}
+};
+
+class ReadBlockTask: public tbb::task {
+    int my_block;
+    tbb::task* execute() {
+        ReadRequest* r = new ReadRequest;
+        r->offset = long(my_block*EventBlockSize);
+        // The continuation runs when the read completes; meanwhile this thread is free
+        r->event = new tbb::completion_event( *new( allocate_continuation() ) CheckBlockTask(r, char(my_block)) );
+        ++ReadsInFlight;
+        Requests->push(r);
+        return NULL;
+    }
+public:
+    ReadBlockTask( int block ) : my_block(block) {}
+    static tbb::concurrent_bounded_queue<ReadRequest*>* Requests;
+};
+
+tbb::concurrent_bounded_queue<ReadRequest*>* ReadBlockTask::Requests;
+
+class ComputeTask: public tbb::task {
+    tbb::task* execute() {
+        tbb::tick_count start = tbb::tick_count::now();
+        while( (tbb::tick_count::now()-start).seconds()<0.001 )
+            __TBB_Pause(10);
+        if( ReadsInFlight )
+            ++OverlappedComputations;
+        return NULL;
+    }
+};
+
+//! Checks that continuations waiting for reads from a file run when the reads complete, and do not block threads
+void TestCompletionEvent() {
+    REMARK("testing completion_event\n");
+    FILE* file = tmpfile();
+    ASSERT( file, "failed to create a temporary file" );
+    for( int i=0; i<EventNumBlocks; ++i ) {
+        char block[EventBlockSize];
+        memset( block, i, EventBlockSize );
+        fwrite( block, 1, EventBlockSize, file );
+    }
+    fflush( file );
+    ReadsInFlight = BlocksChecked = BlocksCorrupted = OverlappedComputations = 0;
+    tbb::concurrent_bounded_queue<ReadRequest*> requests;
+    ReadBlockTask::Requests = &requests;
+    tbb::tbb_thread io_thread( IoService(file, requests) );
+    {
+        tbb::task_scheduler_init init(2);
+        tbb::task* root = new( tbb::task::allocate_root() ) tbb::empty_task;
+        root->set_ref_count(1);
+        for( int i=0; i<EventNumBlocks; ++i )
+            tbb::task::enqueue( *new( tbb::task::allocate_additional_child_of(*root) ) ReadBlockTask(i) );
+        for( int i=0; i<100; ++i )
+            tbb::task::spawn( *new( tbb::task::allocate_additional_child_of(*root) ) ComputeTask );
+        root->wait_for_all();
+        tbb::task::destroy(*root);
+    }
+    requests.push( NULL );
+    io_thread.join();
+    fclose( file );
+    ASSERT( BlocksChecked==EventNumBlocks, "some continuations were lost" );
+    ASSERT( !BlocksCorrupted, "a continuation ran before its read completed" );
+    ASSERT( OverlappedComputations, "computations did not overlap the reads" );
+}
+
 //------------------------------------------------------------------------
 // Run all tests.
 //------------------------------------------------------------------------
@@ -967,6 +1294,7 @@ int TestMain () {
         TestSpawnRootList( p );
         TestSafeContinuation( p );
         TestEnqueue( p );
+        TestTaskSizes( p );
         TestLeftRecursion( p );
         TestDag( p );
         TestAffinity( p );
@@ -977,6 +1305,13 @@ int TestMain () {
         TestMastersIsolation( p );
 #endif /* __TBB_ARENA_PER_MASTER */
     }
+#if __TBB_ARENA_PER_MASTER
+    TestEnqueueManyLanes();
+    TestEnqueueFairness( 100, 0 );
+    TestEnqueueFairness( 0, 1000 );
+    TestTimedEnqueue();
+    TestCompletionEvent();
+#endif /* __TBB_ARENA_PER_MASTER */
     return Harness::Done;
 }
 
@@ -128,6 +128,158 @@ void AssertExplicitInitIsNotSupplanted () {
             "Manual init provided more threads than requested. See also the comment at the beginning of main()." );
 }
 
+#include "tbb/atomic.h"
+#include "tbb/tick_count.h"
+
+//! Number of threads that have reached the rendezvous
+tbb::atomic<int> RendezvousCount;
+//! Whether a thread has given up waiting for the others
+tbb::atomic<bool> RendezvousFailed;
+
+//! Waits for the given number of threads to run the body concurrently, or gives up after the timeout.
+/** If switch_off is true, the load-aware mode is turned off when a worker has joined the master,
+    so that the threads already at work cannot be the ones to notice the switch. **/
+class RendezvousBody {
+    int my_num_threads;
+    double my_timeout;
+    bool my_switch_off;
+public:
+    RendezvousBody( int num_threads, double timeout, bool switch_off )
+        : my_num_threads(num_threads), my_timeout(timeout), my_switch_off(switch_off) {}
+    void operator() ( const Range& ) const {
+        Harness::ConcurrencyTracker ct;
+        if( ++RendezvousCount==2 && my_switch_off )
+            tbb::task_scheduler_init::set_load_aware_mode( false );
+        tbb::tick_count start = tbb::tick_count::now();
+        while( RendezvousCount < my_num_threads && !RendezvousFailed && (tbb::tick_count::now() - start).seconds() < my_timeout )
+            __TBB_Yield();
+        if( RendezvousCount < my_num_threads )
+            RendezvousFailed = true;
+    }
+};
+
+//! Returns the number of threads that have met, which is less than num_threads if the rendezvous failed.
+int Rendezvous( int num_threads, double timeout, bool switch_off = false ) {
+    RendezvousCount = 0;
+    RendezvousFailed = false;
+    Harness::ConcurrencyTracker::Reset();
+    tbb::parallel_for( Range(0, num_threads, 1), RendezvousBody(num_threads, timeout, switch_off), tbb::simple_partitioner() );
+    return RendezvousFailed ? (int)Harness::ConcurrencyTracker::PeakParallelism() : num_threads;
+}
+
+//! The load-aware mode must not break the work, nor provide more threads than requested.
+void TestLoadAwareMode () {
+    tbb::task_scheduler_init::set_load_aware_mode( true );
+    for( int p=MinThread; p<=MaxThread; ++p ) {
+        tbb::task_scheduler_init init(p);
+        Harness::ConcurrencyTracker::Reset();
+        tbb::parallel_for( Range(0, p * 2, 1), ConcurrencyTrackingBody(), tbb::simple_partitioner() );
+        ASSERT( Harness::ConcurrencyTracker::PeakParallelism() <= (unsigned)p, "Load-aware mode provided more threads than requested" );
+    }
+    tbb::task_scheduler_init::set_load_aware_mode( false );
+    // The scheduler outlives the switches, so that the limit has to be lifted rather than started anew.
+    // It gets fewer threads than requested while the market of the previous one is still alive.
+    tbb::task_scheduler_init init( tbb::task_scheduler_init::deferred );
+    int num_threads = 0;
+    for( int i=0; i<10 && num_threads<MaxThread; ++i ) {
+        if( init.is_active() ) {
+            init.terminate();
+            Harness::Sleep( 100 );
+        }
+        init.initialize( MaxThread );
+        num_threads = Rendezvous( MaxThread, 1 );
+    }
+    REMARK( "%d threads before the load-aware mode\n", num_threads );
+    tbb::task_scheduler_init::set_load_aware_mode( true );
+    tbb::parallel_for( Range(0, MaxThread * 2, 1), ConcurrencyTrackingBody(), tbb::simple_partitioner() );
+    tbb::task_scheduler_init::set_load_aware_mode( false );
+    // The full number of workers must come back
+    ASSERT( Rendezvous( num_threads, 10 )==num_threads, "Workers did not come back after the load-aware mode was turned off" );
+    // Including when it is turned off in the middle of the work, which does not change the demand.
+    // The load is sampled at most once a second, so the spawn of the work has to wait for it.
+    tbb::task_scheduler_init::set_load_aware_mode( true );
+    Harness::Sleep( 1100 );
+    ASSERT( Rendezvous( num_threads, 10, /*switch_off=*/true )==num_threads, "Workers did not come back after the load-aware mode was turned off during the work" );
+    tbb::task_scheduler_init::set_load_aware_mode( false );
+}
+
+#if __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+//! Affinity mask of the process
+cpu_set_t ProcessMask;
+
+//! The master thread, which is bound to a single CPU
+pthread_t MasterThread;
+
+class AffinityCheckingBody {
+public:
+    void operator() ( const Range& ) const {
+        if( pthread_equal( pthread_self(), MasterThread ) )
+            return;
+        cpu_set_t mask;
+        ASSERT( !sched_getaffinity( 0, sizeof(mask), &mask ), NULL );
+        ASSERT( CPU_EQUAL( &mask, &ProcessMask ), "Worker is not bound to the CPUs of the process" );
+        for ( volatile int i = 0; i < 100000; ++i )
+            ;
+    }
+};
+
+//! The default concurrency must not exceed the number of CPUs the process may run on.
+/** Run the test under taskset to restrict the process to a part of the CPUs. **/
+void TestDefaultConcurrency () {
+    ASSERT( !sched_getaffinity( getpid(), sizeof(ProcessMask), &ProcessMask ), NULL );
+    int num_cpus = CPU_COUNT( &ProcessMask );
+    int default_num_threads = tbb::task_scheduler_init::default_num_threads();
+    REMARK( "%d threads by default, %d CPUs in the affinity mask\n", default_num_threads, num_cpus );
+    ASSERT( default_num_threads>=1 && default_num_threads<=num_cpus, "Default concurrency ignores the affinity mask" );
+    // Workers must not inherit the mask of the master that has been bound to a single CPU
+    cpu_set_t master_mask;
+    CPU_ZERO( &master_mask );
+    for( int i=0; i<CPU_SETSIZE; ++i )
+        if( CPU_ISSET( i, &ProcessMask ) ) {
+            CPU_SET( i, &master_mask );
+            break;
+        }
+    ASSERT( !sched_setaffinity( 0, sizeof(master_mask), &master_mask ), NULL );
+    MasterThread = pthread_self();
+    {
+        tbb::task_scheduler_init init(MaxThread);
+        tbb::parallel_for( Range(0, MaxThread * 4, 1), AffinityCheckingBody(), tbb::simple_partitioner() );
+    }
+    ASSERT( !sched_setaffinity( 0, sizeof(ProcessMask), &ProcessMask ), NULL );
+}
+#endif /* __linux__ */
+
+#include <cstring>
+
+//! The trace must be written as JSON, and contain the spawns of the work done while tracing is on.
+void TestTracing () {
+    const char* file_name = "test_task_scheduler_init.trace.json";
+    tbb::task_scheduler_init::set_tracing( true );
+    {
+        tbb::task_scheduler_init init(MaxThread);
+        tbb::parallel_for( Range(0, MaxThread * 2, 1), ConcurrencyTrackingBody(), tbb::simple_partitioner() );
+    }
+    tbb::task_scheduler_init::set_tracing( false );
+    if( !tbb::task_scheduler_init::write_trace( file_name ) ) {
+        REPORT( "Warning: trace not written, tracing is not tested\n" );
+        return;
+    }
+    FILE* f = std::fopen( file_name, "r" );
+    ASSERT( f, "trace file is not created" );
+    static char text[1<<20];
+    size_t n = std::fread( text, 1, sizeof(text)-1, f );
+    text[n] = 0;
+    std::fclose(f);
+    std::remove( file_name );
+    ASSERT( std::strncmp( text, "{\"traceEvents\":[", 16 )==0, "trace does not start as Chrome trace" );
+    ASSERT( n==sizeof(text)-1 || std::strstr( text, "]}" ), "trace is not complete" );
+    ASSERT( std::strstr( text, "\"name\":\"spawn\"" ), "spawns are not traced" );
+}
+
 int TestMain () {
     // Do not use tbb::task_scheduler_init directly in the scope of main's body,
     // as a static variable, or as a member of a static variable.
@@ -141,11 +293,17 @@ int TestMain () {
     #endif
 #endif /* _MSC_VER && !__TBB_NO_IMPLICIT_LINKAGE */
     std::srand(2);
+#if __linux__
+    // Goes first, so that the workers are created by the master bound to a single CPU
+    TestDefaultConcurrency();
+#endif /* __linux__ */
     InitializeAndTerminate(MaxThread);
     for( int p=MinThread; p<=MaxThread; ++p ) {
         REMARK("testing with %d threads\n", p );
         NativeParallelFor( p, ThreadedInit() );
     }
     AssertExplicitInitIsNotSupplanted();
+    TestLoadAwareMode();
+    TestTracing();
     return Harness::Done;
 }
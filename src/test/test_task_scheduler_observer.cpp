@@ -121,7 +121,64 @@ void TestObserver( int p, int q ) {
     NativeParallelFor( p, DoTest(q) );
 }
 
+#if __linux__
+#include <sched.h>
+#include "tbb/tick_count.h"
+
+cpu_set_t ProcessMask;
+tbb::atomic<int> WorkerEntryCount;
+
+//! Checks that workers are bound to CPUs allowed to the process, and to the expected one if given.
+class AffinityObserver: public tbb::task_scheduler_observer {
+    int expected_cpu;
+    /*override*/ void on_scheduler_entry( bool is_worker ) {
+        if( !is_worker )
+            return;
+        int cpu = bound_cpu();
+        ASSERT( cpu>=0 && CPU_ISSET( cpu, &ProcessMask ), "worker is not bound to an allowed CPU" );
+        ASSERT( expected_cpu<0 || cpu==expected_cpu, "worker is not bound to the CPU of the list" );
+        ++WorkerEntryCount;
+    }
+public:
+    AffinityObserver( int cpu ) : expected_cpu(cpu) {
+        observe(true);
+    }
+};
+
+void TestWorkerAffinity( tbb::task_scheduler_init::affinity_policy policy, int expected_cpu ) {
+    if( policy==tbb::task_scheduler_init::affinity_cpu_list )
+        tbb::task_scheduler_init::set_worker_affinity( policy, &expected_cpu, 1 );
+    else
+        tbb::task_scheduler_init::set_worker_affinity( policy );
+    WorkerEntryCount = 0;
+    {
+        AffinityObserver o( expected_cpu );
+        tbb::task_scheduler_init init(2);
+        // On a loaded machine the worker may be late to join
+        for( tbb::tick_count t0 = tbb::tick_count::now(); !WorkerEntryCount && (tbb::tick_count::now()-t0).seconds()<10; )
+            DoFib(0);
+        if( !WorkerEntryCount )
+            REPORT( "Warning: worker did not join, affinity not checked\n" );
+    }
+    tbb::task_scheduler_init::set_worker_affinity( tbb::task_scheduler_init::affinity_none );
+}
+
+void TestWorkerAffinity() {
+    ASSERT( !sched_getaffinity( 0, sizeof(ProcessMask), &ProcessMask ), NULL );
+    int first_cpu = 0;
+    while( !CPU_ISSET( first_cpu, &ProcessMask ) )
+        ++first_cpu;
+    TestWorkerAffinity( tbb::task_scheduler_init::affinity_cpu_list, first_cpu );
+    TestWorkerAffinity( tbb::task_scheduler_init::affinity_compact, -1 );
+    TestWorkerAffinity( tbb::task_scheduler_init::affinity_scatter, -1 );
+}
+#endif /* __linux__ */
+
 int TestMain () {
+#if __linux__
+    // Goes first, as the policy applies to worker threads created later
+    TestWorkerAffinity();
+#endif /* __linux__ */
     for( int p=MinThread; p<=MaxThread; ++p ) 
         for( int q=MinThread; q<=MaxThread; ++q ) 
             TestObserver(p,q);